@@ -14,35 +14,37 @@
  */
 void httpfds_init(httpfds_t *hfds) {
    memset(hfds, 0, sizeof(httpfds_t));
+   hfds->free_head = HTTPFDS_NOSLOT;
 }
 
 /* httpfds_resize()
- * DESC: resizes all 3 arrays (fds, reqs, resps) to length _newlen_. If the number
+ * DESC: resizes both arrays (fds, conns) to length _newlen_. If the number
  *       of elements before resizing is less than _newlen_, these elements are lost.
  * ARGS:
- *  - newlen: new length of the 3 arrays.
+ *  - newlen: new length of the 2 arrays.
  *  - hfds: pointer to the HTTP fds record.
  * RETV: returns 0 upon success, -1 upon error.
  */
 int httpfds_resize(size_t newlen, httpfds_t *hfds) {
    struct pollfd *fds_tmp;
-   httpmsg_t *reqs_tmp, *resps_tmp;
+   httpconn_t *conns_tmp;
 
    if ((fds_tmp = reallocarray(hfds->fds, newlen, sizeof(struct pollfd))) == NULL) {
       return -1;
    }
    hfds->fds = fds_tmp;
    
-   if ((reqs_tmp = reallocarray(hfds->reqs, newlen, sizeof(httpmsg_t))) == NULL) {
+   if ((conns_tmp = reallocarray(hfds->conns, newlen, sizeof(httpconn_t))) == NULL) {
       return -1;
    }
-   hfds->reqs = reqs_tmp;
-   
-   if ((resps_tmp = reallocarray(hfds->resps, newlen, sizeof(httpmsg_t))) == NULL) {
-      return -1;
-   }
-   hfds->resps = resps_tmp;
+   hfds->conns = conns_tmp;
 
+   /* both arrays count against the memory budget */
+   if (newlen > hfds->len) {
+      mem_charge((newlen - hfds->len) * (sizeof(struct pollfd) + sizeof(httpconn_t)));
+   } else {
+      mem_uncharge((hfds->len - newlen) * (sizeof(struct pollfd) + sizeof(httpconn_t)));
+   }
    hfds->len = newlen;
 
    return 0;
@@ -51,116 +53,210 @@ int httpfds_resize(size_t newlen, httpfds_t *hfds) {
 
 /* httpfds_insert()
  * DESC: add new entry for file descriptor _fd_ with events mask _events_ into 
- *       HTTP file descriptor array _hfds_.
+ *       HTTP file descriptor array _hfds_, reusing a free slot if there is one (O(1)).
+ *       The connection starts out idle.
  * ARGS:
  *  - fd: file descriptor to insert.
  *  - events: events mask for file descriptor (see poll(2)).
+ *  - deadline: time at which the connection is closed if it is still idle (0 for never).
  *  - hfds: list of HTTP file descriptors to inserts entry into.
- * RETV: 0 on success, -1 on error.
+ * RETV: the index of the new entry on success, -1 on error.
+ * ERRS:
+ *  - EMFILE: too many entries for a connection handle (see httpconn_id_t).
+ *  - see httpfds_resize()
  */
-int httpfds_insert(int fd, int events, httpfds_t *hfds) {
+ssize_t httpfds_insert(int fd, int events, time_t deadline, httpfds_t *hfds) {
    struct pollfd *fdentry;
-   httpmsg_t *reqentry, *respentry;
+   httpconn_t *connentry;
    size_t index;
+   uint32_t gen;
 
-   /* resize if necessary */
-   if (hfds->count == hfds->len) {
-      size_t newlen;
+   if (hfds->free_head != HTTPFDS_NOSLOT) {
+      /* pop free slot */
+      index = hfds->free_head;
+      hfds->free_head = hfds->conns[index].next_free;
+      gen = hfds->conns[index].gen;
+   } else {
+      /* resize if necessary */
+      if (hfds->count == hfds->len) {
+         size_t newlen;
 
-      newlen = smax(hfds->len * 2, HTTPFDS_MINLEN);
-      if (httpfds_resize(newlen, hfds) < 0) {
-         return -1;
+         newlen = smax(hfds->len * 2, HTTPFDS_MINLEN);
+         if (newlen > UINT32_MAX) {
+            errno = EMFILE;
+            return -1;
+         }
+         if (httpfds_resize(newlen, hfds) < 0) {
+            return -1;
+         }
       }
+      index = hfds->count++;
+      gen = 0;
    }
 
-   index = hfds->count;
    fdentry = &hfds->fds[index];
-   reqentry = &hfds->reqs[index];
-   respentry = &hfds->resps[index];
+   connentry = &hfds->conns[index];
 
    /* initialize entry */
    fdentry->fd = fd;
    fdentry->events = events;
-   request_init(reqentry);
-   response_init(respentry);
+   fdentry->revents = 0;
+   memset(connentry, 0, sizeof(*connentry));
+   connentry->gen = gen;
+   connentry->state = HC_IDLE;
+   connentry->deadline = deadline;
 
-   ++hfds->count;
    ++hfds->nopen;
    
-   return 0;
+   return index;
+}
+
+/* httpfds_id()
+ * DESC: returns the handle of the connection at index _index_ of _hfds_.
+ */
+httpconn_id_t httpfds_id(size_t index, const httpfds_t *hfds) {
+   return ((httpconn_id_t) hfds->conns[index].gen << 32) | index;
+}
+
+/* httpfds_lookup()
+ * DESC: finds the connection with handle _id_ in _hfds_.
+ * RETV: the index of the connection, or -1 if it has been removed since.
+ */
+ssize_t httpfds_lookup(httpconn_id_t id, const httpfds_t *hfds) {
+   size_t index;
+
+   index = id & UINT32_MAX;
+   if (index >= hfds->count || hfds->fds[index].fd == -1
+       || hfds->conns[index].gen != (uint32_t) (id >> 32)) {
+      return -1;
+   }
+   return index;
+}
+
+/* httpfds_attach()
+ * DESC: attaches an empty request & response to the connection at index _index_ of
+ *       _hfds_ (if it has none), e.g. once it starts receiving a request.
+ * ARGS:
+ *  - index: index of connection.
+ *  - pool: pool the request & response borrow their buffers from.
+ *  - hfds: pointer to HTTP file descriptor array.
+ * RETV: the connection's request & response, or NULL on error.
+ * ERRS:
+ *  - see malloc(3)
+ */
+httpconn_msgs_t *httpfds_attach(size_t index, bufpool_t *pool, httpfds_t *hfds) {
+   httpconn_t *conn;
+
+   conn = &hfds->conns[index];
+   if (conn->msgs == NULL) {
+      if ((conn->msgs = malloc(sizeof(*conn->msgs))) == NULL) {
+         return NULL;
+      }
+      mem_charge(sizeof(*conn->msgs));
+      request_init(&conn->msgs->req);
+      response_init(&conn->msgs->res);
+      message_set_pool(pool, &conn->msgs->req);
+      message_set_pool(pool, &conn->msgs->res);
+   }
+
+   return conn->msgs;
+}
+
+/* httpfds_detach()
+ * DESC: deletes & frees the request & response of the connection at index _index_ of
+ *       _hfds_ (if any), returning their buffers to their pool.
+ */
+void httpfds_detach(size_t index, httpfds_t *hfds) {
+   httpconn_t *conn;
+
+   conn = &hfds->conns[index];
+   if (conn->msgs) {
+      request_delete(&conn->msgs->req);
+      response_delete(&conn->msgs->res);
+      free(conn->msgs);
+      mem_uncharge(sizeof(*conn->msgs));
+      conn->msgs = NULL;
+   }
+}
+
+/* httpfds_suspend()
+ * DESC: stops polling the connection at index _index_ of _hfds_ until httpfds_resume()
+ *       (e.g. while another thread works on its request): its fd is hidden from poll(2),
+ *       which ignores negative fds. Its slot & handle stay valid; it is not expired.
+ * NOTE: the connection must not be removed until it is resumed, or until no other thread
+ *       uses it any more (httpfds_remove() frees its request & response and closes its
+ *       socket regardless).
+ */
+void httpfds_suspend(size_t index, httpfds_t *hfds) {
+   hfds->fds[index].fd = HTTPFDS_HIDE(hfds->fds[index].fd);
+   hfds->fds[index].revents = 0;
+}
+
+/* httpfds_resume()
+ * DESC: resumes polling the connection at index _index_ of _hfds_ (see httpfds_suspend()).
+ */
+void httpfds_resume(size_t index, httpfds_t *hfds) {
+   hfds->fds[index].fd = HTTPFDS_HIDE(hfds->fds[index].fd);
 }
 
 /* httpfds_remove() 
- * DESC: mark entry at index _index_ from HTTP file descriptor array as removed
- *       (without changing the indices of other entries in the array).
+ * DESC: mark entry at index _index_ from HTTP file descriptor array as removed and put its
+ *       slot on the free list (without changing the indices of other entries in the array).
  * ARGS:
  *  - index: index of entry to remove.
  *  - hfds: pointer to HTTP file descriptor array.
  * RETV: 0 on success, -1 on error.
- * NOTE: does not change the indices of other entries in the array. Use httpfds_pack()
- *       to compact the array after removing elements.
+ * NOTE: handles of the removed connection become invalid (see httpfds_lookup()).
  */
 int httpfds_remove(size_t index, httpfds_t *hfds) {
    int *fdp;
-   httpmsg_t *reqp, *resp;
    int retv;
 
    /* initialize vars */
    fdp = &hfds->fds[index].fd;
-   reqp = &hfds->reqs[index];
-   resp = &hfds->resps[index];
    retv = 0;
 
-   if (*fdp >= 0) {
-      /* close socket & delete response & request */
+   if (*fdp != -1) {
+      /* close socket (even if suspended) & delete response & request */
+      if (*fdp < 0) {
+         *fdp = HTTPFDS_HIDE(*fdp);
+      }
       if (close(*fdp) < 0) {
          fprintf(stderr, "close(%d): %s\n", *fdp, strerror(errno));
          retv = -1;
       }
       *fdp = -1; // mark as deleted
-      request_delete(reqp);
-      response_delete(resp);
+      httpfds_detach(index, hfds);
       --hfds->nopen; // update number open
+
+      /* invalidate handles & push slot onto free list */
+      ++hfds->conns[index].gen;
+      hfds->conns[index].next_free = hfds->free_head;
+      hfds->free_head = index;
    }
    
    return retv;
 }
 
-/* httpfds_pack()
- * DESC: compact the HTTP file descriptor array _hfds_ by overwriting removed entries.
- * ARGS:
- *  - hfds: HTTP file descriptor array to pack.
- * RETV: the number of elements in the packed array.
+/* httpfds_expire()
+ * DESC: closes all connections in _hfds_ whose deadline has passed by time _now_.
+ * RETV: the number of connections closed.
+ * NOTE: like httpfds_remove(), does not change the indices of other entries.
  */
-size_t httpfds_pack(httpfds_t *hfds) {
-   ssize_t front, back;
-   size_t newcount;
-
-   newcount = hfds->count;
-   front = 0;
-   back = hfds->count - 1;
-   while (front < back && hfds->fds[back].fd < 0) {
-      --back;
-      --newcount;
-   }
-   while (front < back) {
-      if (hfds->fds[front].fd < 0) {
-         memcpy(&hfds->fds[front], &hfds->fds[back], sizeof(struct pollfd));
-         memcpy(&hfds->reqs[front], &hfds->reqs[back], sizeof(httpmsg_t));
-         memcpy(&hfds->resps[front], &hfds->resps[back], sizeof(httpmsg_t));
-
-         do {
-            --back;
-            --newcount;
-         } while (front < back && hfds->fds[back].fd < 0);
+size_t httpfds_expire(time_t now, httpfds_t *hfds) {
+   size_t nexpired;
+
+   nexpired = 0;
+   for (size_t i = 0; i < hfds->count; ++i) {
+      if (hfds->fds[i].fd >= 0 && hfds->conns[i].deadline && hfds->conns[i].deadline <= now) {
+         if (httpfds_remove(i, hfds) < 0) {
+            perror("httpfds_remove");
+         }
+         ++nexpired;
       }
-      
-      ++front;
    }
 
-   hfds->count = newcount;
-   
-   return newcount;
+   return nexpired;
 }
 
 /* httpfds_delete()
@@ -179,9 +275,9 @@ int httpfds_delete(httpfds_t *hfds) {
    }
    
    free(hfds->fds);
-   free(hfds->reqs);
-   free(hfds->resps);
-   memset(hfds, 0, sizeof(httpfds_t));
+   free(hfds->conns);
+   mem_uncharge(hfds->len * (sizeof(struct pollfd) + sizeof(httpconn_t)));
+   httpfds_init(hfds);
 
    errno = errsav;
    return retv;
@@ -1,25 +1,101 @@
 #ifndef __WEBSERV_FDS_H
 #define __WEBSERV_FDS_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 /* types */
+/* connection states */
+typedef enum {
+   HC_IDLE = 0, // waiting for the next request (no request/response attached)
+   HC_READ,     // receiving request header
+   HC_IO,       // request being handled by an I/O thread (see httpfds_suspend())
+   HC_BODY,     // receiving request body
+   HC_WRITE,    // sending response
+   HC_NONE      // not a client connection (server socket, I/O completion eventfd)
+} httpconn_state_t;
+
+/* connection handle: generation (high 32 bits) and index (low 32 bits) of its slot. A
+ * handle stays valid for the connection's lifetime and never refers to a later connection
+ * that reuses the slot (see httpfds_lookup()). */
+typedef uint64_t httpconn_id_t;
+
+/* cold per-connection state: the request being handled and its response (only attached
+ * while a request is in progress, see httpfds_attach()) */
+typedef struct {
+   iopool_job_t job;         // job handling the request in an I/O thread (must be first)
+   httpmsg_t req;
+   httpmsg_t res;
+   httpconn_id_t id;         // (job) connection's handle
+   int clientfd;             // (job) client socket
+   const server_site_t *site;// (job) site being served
+   int persist;              // (job) whether connection may be kept alive (ctx->persist)
+   int retv;                 // (job result) return value of server_handle_req()
+   int err;                  // (job result) errno, if retv is -1
+   int keepalive;            // (job result) whether connection is kept alive (ctx->keepalive)
+} httpconn_msgs_t;
+
+/* hot per-connection state (the socket itself is in the parallel pollfd array). This is
+ * all the memory an idle connection holds. */
+typedef struct {
+   union {
+      httpconn_msgs_t *msgs; // request & response (NULL while idle)
+      size_t next_free;      // next slot in free list (while slot is free)
+   };
+   time_t deadline;          // time at which connection is closed (0 for never; pushed back
+                             // whenever a request body or response makes progress)
+   uint64_t accepted;        // time connection was accepted (see codel_clock()) until it is
+                             // first read from (0 after, or if not sampled)
+   uint32_t gen;             // generation of slot (incremented whenever it is freed)
+   ratelim_key_t peer;       // client's rate limit key (see ratelim_key())
+   unsigned char state;      // HC_*
+   unsigned char keepalive;  // whether connection is kept open after the response
+   unsigned char resflags;   // flags responses are sent with (see server_conn_tcp())
+   unsigned char served;     // whether a response has been sent (and the connection kept)
+   unsigned char queued;     // whether connection is in the write run queue
+} httpconn_t;
+
+/* entry of the write run queue: connection ready to be sent (more of) its response. A
+ * connection stays queued across wakeups for as long as it could be sent more (it has used
+ * up its quantum, or hasn't been served yet), and leaves it once its socket is full (it is
+ * queued again when poll(2) reports it writable) or its response is sent. */
+typedef struct {
+   size_t remaining;  // bytes of response left to send (see response_remaining())
+   httpconn_id_t id;
+} httpfds_runent_t;
+
+/* slot table of connections: slots never move, so indices are stable while a connection
+ * is open; closed slots (fd -1, ignored by poll(2)) are kept on a free list for reuse */
 typedef struct {
    struct pollfd *fds;
-   httpmsg_t   *reqs;
-   httpmsg_t  *resps;
+   httpconn_t  *conns;
    size_t        len; // length of allocated array
-   size_t      count; // number of fds currently in array
-   size_t      nopen; // number of fds that are open (count == nopen after httpfds_pack())
+   size_t      count; // number of slots in use or on the free list (passed to poll(2))
+   size_t      nopen; // number of fds that are open
+   size_t  free_head; // first free slot (HTTPFDS_NOSLOT if none)
 } httpfds_t;
 
 /* prototypes */
 void   httpfds_init(httpfds_t *hfds);
 int    httpfds_resize(size_t newlen, httpfds_t *hfds);
-int    httpfds_insert(int fd, int events, httpfds_t *hfds);
+ssize_t httpfds_insert(int fd, int events, time_t deadline, httpfds_t *hfds);
+httpconn_id_t httpfds_id(size_t index, const httpfds_t *hfds);
+ssize_t httpfds_lookup(httpconn_id_t id, const httpfds_t *hfds);
+httpconn_msgs_t *httpfds_attach(size_t index, bufpool_t *pool, httpfds_t *hfds);
+void   httpfds_detach(size_t index, httpfds_t *hfds);
+void   httpfds_suspend(size_t index, httpfds_t *hfds);
+void   httpfds_resume(size_t index, httpfds_t *hfds);
 int    httpfds_remove(size_t index, httpfds_t *hfds);
-size_t httpfds_pack(httpfds_t *hfds);
+size_t httpfds_expire(time_t now, httpfds_t *hfds);
 int    httpfds_delete(httpfds_t *hfds);
 
 /* defines */
-#define HTTPFDS_MINLEN 16
+#define HTTPFDS_MINLEN     16
+#define HTTPFDS_NOSLOT     ((size_t) -1) // end of free list
+#define HTTPFDS_HIDE(fd)   (-(fd) - 2)   // fd of suspended slot (its own inverse; -1 is free)
+#define HTTPFDS_TIMEOUT    15   // seconds a connection may stay idle or take to send a request header
+#define HTTPFDS_PROGRESS   15   // seconds a request body or response may go without progress
+#define HTTPFDS_SWEEP_MSEC 1000 // poll(2) timeout, so expired connections are closed in time
+#define HTTPFDS_PASS_QUANTA 4   // quanta sent per wakeup in all (SERVER_SCHED_SRPT)
 
 #endif
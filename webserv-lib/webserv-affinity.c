@@ -0,0 +1,204 @@
+#define _GNU_SOURCE // cpu_set_t, pthread_attr_setaffinity_np(3)
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include "webserv-affinity.h"
+
+void affinity_to_cpuset(const affinity_t *aff, cpu_set_t *set);
+
+/* affinity_parse()
+ * DESC: parses CPU list _list_ (comma-separated CPU numbers & ranges, e.g. "0-3,8,10-11",
+ *       as in cpuset(7)) into CPU set _aff_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _list_ is malformed or empty, or names a CPU of AFFINITY_MAXCPUS or above.
+ */
+int affinity_parse(const char *list, affinity_t *aff) {
+   unsigned long lo, hi;
+   char *end;
+
+   memset(aff, 0, sizeof(*aff));
+   do {
+      if (!isdigit((unsigned char) *list)) {
+         goto einval;
+      }
+      lo = hi = strtoul(list, &end, 10);
+      if (*end == '-') {
+         list = end + 1;
+         if (!isdigit((unsigned char) *list)) {
+            goto einval;
+         }
+         hi = strtoul(list, &end, 10);
+      }
+      if (lo > hi || hi >= AFFINITY_MAXCPUS) {
+         goto einval;
+      }
+      for (unsigned long cpu = lo; cpu <= hi; ++cpu) {
+         if (!affinity_has(cpu, aff)) {
+            aff->bits[cpu / 64] |= 1ull << (cpu % 64);
+            ++aff->ncpus;
+         }
+      }
+      list = end + 1;
+   } while (*end == ',');
+   if (*end != '\0') {
+      goto einval;
+   }
+
+   return 0;
+
+ einval:
+   memset(aff, 0, sizeof(*aff));
+   errno = EINVAL;
+   return -1;
+}
+
+/* affinity_single(): makes _aff_ the set of CPU _cpu_ alone. */
+void affinity_single(int cpu, affinity_t *aff) {
+   memset(aff, 0, sizeof(*aff));
+   aff->bits[cpu / 64] = 1ull << (cpu % 64);
+   aff->ncpus = 1;
+}
+
+/* affinity_has(): returns whether CPU _cpu_ is in set _aff_. */
+int affinity_has(int cpu, const affinity_t *aff) {
+   return cpu >= 0 && cpu < AFFINITY_MAXCPUS && (aff->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+/* affinity_nth()
+ * DESC: returns the _n_-th CPU in set _aff_ (counting from 0, in order of CPU number, and
+ *       wrapping around), e.g. to spread workers out one per CPU.
+ * RETV: the CPU number, -1 if the set is empty.
+ */
+int affinity_nth(size_t n, const affinity_t *aff) {
+   if (aff->ncpus == 0) {
+      return -1;
+   }
+   n %= aff->ncpus;
+   for (int cpu = 0; cpu < AFFINITY_MAXCPUS; ++cpu) {
+      if (affinity_has(cpu, aff) && n-- == 0) {
+         return cpu;
+      }
+   }
+   return -1;
+}
+
+/* affinity_to_cpuset(): converts CPU set _aff_ to _set_. */
+void affinity_to_cpuset(const affinity_t *aff, cpu_set_t *set) {
+   CPU_ZERO(set);
+   for (int cpu = 0; cpu < AFFINITY_MAXCPUS && cpu < CPU_SETSIZE; ++cpu) {
+      if (affinity_has(cpu, aff)) {
+         CPU_SET(cpu, set);
+      }
+   }
+}
+
+/* affinity_get()
+ * DESC: gets the set of CPUs the calling thread may run on into _aff_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see sched_getaffinity(2)
+ */
+int affinity_get(affinity_t *aff) {
+   cpu_set_t set;
+
+   memset(aff, 0, sizeof(*aff));
+   if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+      return -1;
+   }
+   for (int cpu = 0; cpu < AFFINITY_MAXCPUS && cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+         aff->bits[cpu / 64] |= 1ull << (cpu % 64);
+         ++aff->ncpus;
+      }
+   }
+
+   return 0;
+}
+
+/* affinity_set()
+ * DESC: confines the calling thread (and the threads & processes it starts from now on)
+ *       to the CPUs in set _aff_. Memory it touches first from then on is allocated on
+ *       those CPUs' NUMA node(s) (the kernel's default first-touch policy), so a worker
+ *       pinned before it sets up its buffers & pools gets them on its local node.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: none of the CPUs in _aff_ are online (or allowed by the cpuset cgroup).
+ *  - see sched_setaffinity(2)
+ */
+int affinity_set(const affinity_t *aff) {
+   cpu_set_t set;
+
+   affinity_to_cpuset(aff, &set);
+   return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* affinity_attr()
+ * DESC: sets thread attributes _attr_ so the thread created with them starts (and stays)
+ *       on CPU _cpu_ (so what it allocates lands on that CPU's NUMA node from the start).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see pthread_attr_setaffinity_np(3)
+ */
+int affinity_attr(int cpu, pthread_attr_t *attr) {
+   cpu_set_t set;
+   int err;
+
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   if ((err = pthread_attr_setaffinity_np(attr, sizeof(set), &set))) {
+      errno = err;
+      return -1;
+   }
+
+   return 0;
+}
+
+/* affinity_incoming_cpu()
+ * DESC: returns the CPU that last processed packets received on connection _conn_fd_
+ *       (SO_INCOMING_CPU), i.e. the one handling the NIC receive queue it hashes to, so
+ *       the connection can be served there with its data still in cache.
+ * RETV: the CPU number, -1 if unknown (e.g. nothing received yet, or not supported).
+ */
+int affinity_incoming_cpu(int conn_fd) {
+   int cpu;
+   socklen_t len;
+
+   len = sizeof(cpu);
+   if (getsockopt(conn_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+      return -1;
+   }
+   return cpu;
+}
+
+/* affinity_node()
+ * DESC: returns the NUMA node of CPU _cpu_ (from sysfs), e.g. to pick the memory pool of
+ *       threads running on it.
+ * RETV: the node number, -1 if unknown (e.g. the kernel was built without NUMA).
+ */
+int affinity_node(int cpu) {
+   char path[64];
+   DIR *dir;
+   struct dirent *ent;
+   int node;
+
+   snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+   if ((dir = opendir(path)) == NULL) {
+      return -1;
+   }
+   node = -1;
+   while ((ent = readdir(dir)) != NULL) {
+      if (strncmp(ent->d_name, "node", 4) == 0 && isdigit((unsigned char) ent->d_name[4])) {
+         node = atoi(ent->d_name + 4);
+         break;
+      }
+   }
+   closedir(dir);
+
+   return node;
+}
@@ -0,0 +1,30 @@
+#ifndef __WEBSERV_AFFINITY_H
+#define __WEBSERV_AFFINITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* defines */
+#define AFFINITY_MAXCPUS 1024 // highest CPU number + 1 a set can hold (glibc's CPU_SETSIZE)
+
+/* types */
+/* set of CPUs to run on (kept apart from cpu_set_t, which needs _GNU_SOURCE wherever it
+ * is seen) */
+typedef struct {
+   uint64_t bits[AFFINITY_MAXCPUS / 64];
+   size_t ncpus; // number of CPUs in set
+} affinity_t;
+
+/* prototypes */
+int affinity_parse(const char *list, affinity_t *aff);
+void affinity_single(int cpu, affinity_t *aff);
+int affinity_has(int cpu, const affinity_t *aff);
+int affinity_nth(size_t n, const affinity_t *aff);
+int affinity_get(affinity_t *aff);
+int affinity_set(const affinity_t *aff);
+int affinity_attr(int cpu, pthread_attr_t *attr);
+int affinity_incoming_cpu(int conn_fd);
+int affinity_node(int cpu);
+
+#endif
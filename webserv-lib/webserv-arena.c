@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "webserv-util.h"
+#include "webserv-mem.h"
+#include "webserv-arena.h"
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+#define ARENA_HDRSIZE     ARENA_ROUND(sizeof(arena_chunk_t))
+
+/* arena_init()
+ * DESC: initializes arena _arena_, which borrows its chunks from pool _pool_ (or
+ *       malloc()s them if _pool_ is NULL). No memory is allocated until first use.
+ * NOTE: a zeroed arena_t is a valid, pool-less arena.
+ */
+void arena_init(bufpool_t *pool, arena_t *arena) {
+   memset(arena, 0, sizeof(*arena));
+   arena->pool = pool;
+}
+
+/* arena_chunk_new()
+ * DESC: allocates a new chunk with room for at least _size_ bytes of data. Regular-sized
+ *       requests are borrowed from the arena's pool (if any); others are malloc()ed and
+ *       charged to the memory budget (see mem_charge()).
+ * RETV: returns the new chunk on success, NULL on error.
+ */
+arena_chunk_t *arena_chunk_new(size_t size, arena_t *arena) {
+   arena_chunk_t *chunk;
+   size_t chunksize;
+
+   chunksize = smax(ARENA_HDRSIZE + size, ARENA_CHUNKSIZE);
+   chunk = NULL;
+   if (arena->pool && chunksize == ARENA_CHUNKSIZE) {
+      chunk = bufpool_get(chunksize, &chunksize, arena->pool);
+   }
+   if (chunk) {
+      chunk->pooled = 1;
+   } else {
+      if ((chunk = malloc(chunksize)) == NULL) {
+         return NULL;
+      }
+      mem_charge(chunksize);
+      chunk->pooled = 0;
+   }
+   chunk->size = chunksize;
+   chunk->used = ARENA_HDRSIZE;
+   
+   return chunk;
+}
+
+/* arena_alloc()
+ * DESC: allocates _size_ bytes (aligned for any type) from arena _arena_.
+ * RETV: returns pointer to memory on success, NULL on error.
+ * NOTE: allocations larger than a regular chunk get a dedicated chunk, which is chained
+ *       behind the current chunk so that its free space is not wasted.
+ */
+void *arena_alloc(size_t size, arena_t *arena) {
+   arena_chunk_t *chunk;
+   void *ptr;
+
+   size = ARENA_ROUND(smax(size, 1));
+   chunk = arena->head;
+   if (chunk == NULL || chunk->size - chunk->used < size) {
+      if ((chunk = arena_chunk_new(size, arena)) == NULL) {
+         return NULL;
+      }
+      if (arena->head && ARENA_HDRSIZE + size > ARENA_CHUNKSIZE) {
+         /* dedicated chunk */
+         chunk->next = arena->head->next;
+         arena->head->next = chunk;
+      } else {
+         chunk->next = arena->head;
+         arena->head = chunk;
+      }
+   }
+   
+   ptr = (char *) chunk + chunk->used;
+   chunk->used += size;
+   arena->last = ptr;
+   
+   return ptr;
+}
+
+/* arena_realloc()
+ * DESC: resizes allocation _ptr_ of _oldsize_ bytes to _newsize_ bytes. The most recent
+ *       allocation is grown in place if it fits; otherwise, the contents are copied into
+ *       a new allocation (the old one is reclaimed only when the arena is deleted).
+ * RETV: returns pointer to resized memory on success, NULL on error.
+ */
+void *arena_realloc(void *ptr, size_t oldsize, size_t newsize, arena_t *arena) {
+   arena_chunk_t *chunk;
+   void *newptr;
+   
+   if (ptr == NULL) {
+      return arena_alloc(newsize, arena);
+   }
+
+   /* try to grow/shrink in place */
+   chunk = arena->head;
+   if (ptr == arena->last && chunk
+       && (char *) ptr + ARENA_ROUND(smax(oldsize, 1)) == (char *) chunk + chunk->used
+       && (char *) ptr + ARENA_ROUND(smax(newsize, 1)) <= (char *) chunk + chunk->size) {
+      chunk->used = (char *) ptr + ARENA_ROUND(smax(newsize, 1)) - (char *) chunk;
+      return ptr;
+   }
+
+   if ((newptr = arena_alloc(newsize, arena)) == NULL) {
+      return NULL;
+   }
+   memcpy(newptr, ptr, smin(oldsize, newsize));
+   
+   return newptr;
+}
+
+/* arena_strdup(): see strdup(3); allocates from arena _arena_. */
+char *arena_strdup(const char *str, arena_t *arena) {
+   size_t len;
+   char *dup;
+
+   len = strlen(str) + 1;
+   if ((dup = arena_alloc(len, arena))) {
+      memcpy(dup, str, len);
+   }
+   return dup;
+}
+
+/* arena_sprintf()
+ * DESC: format string into string allocated from arena _arena_ (see smprintf()).
+ * RETV: see sprintf(3)
+ */
+int arena_sprintf(char **sptr, arena_t *arena, const char *fmt, ...) {
+   va_list args;
+   int len;
+   char *str;
+
+   /* get formatted string length */
+   va_start(args, fmt);
+   len = vsnprintf(NULL, 0, fmt, args);
+   va_end(args);
+   if (len < 0) {
+      return -1;
+   }
+
+   /* allocate & format string */
+   if ((str = arena_alloc(len + 1, arena)) == NULL) {
+      return -1;
+   }
+   va_start(args, fmt);
+   vsnprintf(str, len + 1, fmt, args);
+   va_end(args);
+
+   *sptr = str;
+   return len;
+}
+
+/* arena_delete()
+ * DESC: frees all memory allocated from _arena_ at once (returning pooled chunks to the
+ *       pool). The arena may be reused afterward.
+ */
+void arena_delete(arena_t *arena) {
+   arena_chunk_t *chunk, *next;
+
+   for (chunk = arena->head; chunk; chunk = next) {
+      next = chunk->next;
+      if (chunk->pooled) {
+         bufpool_put(chunk, chunk->size, arena->pool);
+      } else {
+         mem_uncharge(chunk->size);
+         free(chunk);
+      }
+   }
+   arena->head = NULL;
+   arena->last = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef __WEBSERV_ARENA_H
+#define __WEBSERV_ARENA_H
+
+#include <stddef.h>
+#include "webserv-pool.h"
+
+/* defines */
+#define ARENA_CHUNKSIZE 0x1000 // size of regular chunks (borrowed from pool if possible)
+#define ARENA_ALIGN     (sizeof(max_align_t))
+
+/* types */
+/* chunk of arena memory (header is followed by the chunk's data) */
+typedef struct arena_chunk {
+   struct arena_chunk *next;
+   size_t size;   // total size of chunk (incl. header)
+   size_t used;   // bytes used (incl. header)
+   int pooled;    // 1 if borrowed from pool, 0 if malloc()ed
+} arena_chunk_t;
+
+/* bump allocator w/ chunk chaining; all allocations are freed at once by arena_delete() */
+typedef struct {
+   arena_chunk_t *head; // current chunk
+   bufpool_t *pool;     // pool to borrow chunks from (NULL to malloc() chunks)
+   void *last;          // most recent allocation (can be grown in place)
+} arena_t;
+
+/* prototypes */
+void arena_init(bufpool_t *pool, arena_t *arena);
+void *arena_alloc(size_t size, arena_t *arena);
+void *arena_realloc(void *ptr, size_t oldsize, size_t newsize, arena_t *arena);
+char *arena_strdup(const char *str, arena_t *arena);
+int arena_sprintf(char **sptr, arena_t *arena, const char *fmt, ...);
+void arena_delete(arena_t *arena);
+
+#endif
@@ -0,0 +1,423 @@
+#define _GNU_SOURCE // splice(2), pipe2(2), mkostemp(3)
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "webserv-util.h"
+#include "webserv-req.h"
+#include "webserv-res.h"
+#include "webserv-body.h"
+
+/* request_body_open()
+ * DESC: prepares to receive the body of parsed request _req_ into the file at _path_.
+ *       The body is written to a temporary file next to _path_ and only moved into place
+ *       by request_body_commit().
+ * ARGS:
+ *  - path: path of file to store body in.
+ *  - max: maximum body size (after chunked decoding).
+ *  - req: parsed request.
+ * RETV: returns C_OK if the body can be received, another HTTP status code (C_*) if the
+ *       request should be rejected, or -1 on error.
+ * NOTE: the framing is taken from the Transfer-Encoding and Content-Length headers.
+ */
+int request_body_open(const char *path, size_t max, httpmsg_t *req) {
+   httpreq_body_t *body;
+   const char *te, *cl;
+   char *cl_end;
+   unsigned long long len;
+   int fd;
+
+   body = &req->hm_line.reql.body;
+   memset(body, 0, sizeof(*body));
+
+   /* determine framing */
+   te = request_header_known(HM_HID_TRANSFERENCODING, req);
+   cl = request_header_known(HM_HID_CONTENTLENGTH, req);
+   if (te) {
+      if (strcasecmp(te, HM_CHUNKED)) {
+         return C_NOTIMPLEMENTED;
+      }
+      body->type = HB_CHUNKED;
+      body->cstate = HB_CS_SIZE;
+   } else if (cl) {
+      errno = 0;
+      len = strtoull(cl, &cl_end, 10);
+      if (!isdigit(*cl) || *cl_end != '\0' || errno) {
+         return C_BADREQUEST;
+      }
+      if (len > max) {
+         return C_TOOLARGE;
+      }
+      body->type = HB_LENGTH;
+      body->remaining = len;
+      body->done = (len == 0);
+   } else {
+      return C_LENGTHREQ;
+   }
+   body->max = max;
+   body->prefix = req->hm_line.reql.hdrs_end;
+
+   /* create temporary file alongside destination */
+   if (arena_sprintf(&body->tmppath, &req->hm_arena, "%s"HB_TMP_SUFFIX, path) < 0
+       || (body->path = arena_strdup(path, &req->hm_arena)) == NULL) {
+      body->type = HB_NONE;
+      return -1;
+   }
+   if ((fd = mkostemp(body->tmppath, O_CLOEXEC)) < 0) {
+      body->type = HB_NONE;
+      switch (errno) {
+      case EACCES:
+      case EROFS:
+         return C_FORBIDDEN;
+      case ENOENT:
+      case ENOTDIR:
+         return C_NOTFOUND;
+      default:
+         return -1;
+      }
+   }
+   fchmod(fd, HB_FILE_MODE); // mkstemp(3) creates files private to owner
+   body->fd = fd;
+   
+   /* Content-Length bodies are spliced socket -> pipe -> file when possible */
+   body->pipefd[0] = body->pipefd[1] = -1;
+   if (body->type == HB_LENGTH && pipe2(body->pipefd, O_CLOEXEC) < 0) {
+      body->pipefd[0] = body->pipefd[1] = -1;
+   }
+   
+   return C_OK;
+}
+
+/* request_body_pending(): returns whether _req_'s body is still being received. */
+int request_body_pending(const httpmsg_t *req) {
+   const httpreq_body_t *body = &req->hm_line.reql.body;
+   return body->type != HB_NONE && !body->done;
+}
+
+/* request_body_write()
+ * DESC: writes all _len_ bytes of _data_ to the body file of _req_.
+ * RETV: 0 on success, -1 on error.
+ * NOTE: blocks until the file has accepted the data. Since the socket is not read again
+ *       until this returns, a slow disk backpressures the client through TCP flow control.
+ */
+int request_body_write(const char *data, size_t len, httpmsg_t *req) {
+   httpreq_body_t *body;
+   ssize_t written;
+
+   body = &req->hm_line.reql.body;
+   while (len > 0) {
+      if ((written = write(body->fd, data, len)) < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return -1;
+      }
+      data += written;
+      len -= written;
+   }
+   
+   return 0;
+}
+
+/* request_body_consume()
+ * DESC: decodes _len_ received bytes _data_ of _req_'s body and writes the payload to the
+ *       body file. Bytes following the end of the body are ignored.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EBADMSG: malformed chunked encoding.
+ *  - EFBIG: body exceeds maximum size.
+ *  - see request_body_write()
+ */
+int request_body_consume(const char *data, size_t len, httpmsg_t *req) {
+   httpreq_body_t *body;
+   const char *pos, *end;
+   size_t n;
+
+   body = &req->hm_line.reql.body;
+   pos = data;
+   end = data + len;
+
+   if (body->type == HB_LENGTH) {
+      n = smin(len, body->remaining);
+      if (request_body_write(pos, n, req) < 0) {
+         return -1;
+      }
+      body->remaining -= n;
+      body->received += n;
+      body->done = (body->remaining == 0);
+      return 0;
+   }
+
+   /* chunked decoding */
+   while (pos < end && body->cstate != HB_CS_DONE) {
+      char c = *pos;
+      
+      switch (body->cstate) {
+      case HB_CS_SIZE:
+         if (isxdigit(c)) {
+            if (body->ndigits == 2 * sizeof(size_t) - 1) {
+               errno = EFBIG;
+               return -1;
+            }
+            body->remaining = body->remaining * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+            ++body->ndigits;
+            ++pos;
+            break;
+         } else if (c != '\n' && c != ';' && c != ' ' && c != '\t' && c != '\r') {
+            errno = EBADMSG;
+            return -1;
+         }
+         body->cstate = HB_CS_EXT;
+         /* fallthrough */
+      case HB_CS_EXT:
+         if (*pos++ != '\n') {
+            break;
+         }
+         /* end of chunk size line */
+         if (body->ndigits == 0) {
+            errno = EBADMSG;
+            return -1;
+         }
+         if (body->remaining > body->max - body->received) {
+            errno = EFBIG;
+            return -1;
+         }
+         body->ndigits = 0;
+         body->cstate = body->remaining ? HB_CS_DATA : HB_CS_TRAILER;
+         break;
+         
+      case HB_CS_DATA:
+         n = smin(end - pos, body->remaining);
+         if (request_body_write(pos, n, req) < 0) {
+            return -1;
+         }
+         pos += n;
+         body->remaining -= n;
+         body->received += n;
+         if (body->remaining == 0) {
+            body->cstate = HB_CS_DATAEND;
+         }
+         break;
+
+      case HB_CS_DATAEND:
+         if (c == '\n') {
+            body->cstate = HB_CS_SIZE;
+         } else if (c != '\r') {
+            errno = EBADMSG;
+            return -1;
+         }
+         ++pos;
+         break;
+
+      case HB_CS_TRAILER:
+         if (c == '\n') {
+            body->cstate = HB_CS_DONE;
+         } else if (c != '\r') {
+            body->cstate = HB_CS_TRLINE;
+         }
+         ++pos;
+         break;
+
+      case HB_CS_TRLINE:
+         if (c == '\n') {
+            body->cstate = HB_CS_TRAILER;
+         }
+         ++pos;
+         break;
+
+      default:
+         break;
+      }
+   }
+   body->done = (body->cstate == HB_CS_DONE);
+   
+   return 0;
+}
+
+/* request_body_splice()
+ * DESC: moves up to _remaining_ bytes of _req_'s (Content-Length) body from socket
+ *       _conn_fd_ to the body file through a pipe, without copying it into userspace.
+ * RETV: returns 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: the socket or file does not support splice(2). Any data already spliced
+ *            into the pipe has been written to the file (which may complete the body),
+ *            and the pipe is closed.
+ *  - ECONNABORTED: client closed the connection.
+ *  - see splice(2)
+ */
+int request_body_splice(int conn_fd, httpmsg_t *req) {
+   httpreq_body_t *body;
+   ssize_t in, out;
+
+   body = &req->hm_line.reql.body;
+   in = splice(conn_fd, NULL, body->pipefd[1], NULL, smin(body->remaining, HB_PIPE_MAX),
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+   if (in < 0) {
+      return -1;
+   } else if (in == 0) {
+      errno = ECONNABORTED;
+      return -1;
+   }
+
+   /* drain pipe into file */
+   while (in > 0) {
+      out = splice(body->pipefd[0], NULL, body->fd, NULL, in, SPLICE_F_MOVE);
+      if (out < 0) {
+         if (errno == EINTR) {
+            continue;
+         } else if (errno != EINVAL) {
+            return -1;
+         }
+         /* file doesn't support splice(2) -- copy out remaining pipe contents */
+         while (in > 0) {
+            if ((out = read(body->pipefd[0], body->buf, smin(in, body->bufsize))) <= 0
+                || request_body_write(body->buf, out, req) < 0) {
+               return -1;
+            }
+            in -= out;
+            body->remaining -= out;
+            body->received += out;
+         }
+         body->done = (body->remaining == 0);
+         errno = EINVAL;
+         return -1;
+      }
+      in -= out;
+      body->remaining -= out;
+      body->received += out;
+   }
+   body->done = (body->remaining == 0);
+
+   return 0;
+}
+
+/* request_body_read()
+ * DESC: receive (more of) the body of request _req_ (NONBLOCKING/ASYNCHRONOUS) and stream
+ *       it to the file opened by request_body_open().
+ * ARGS:
+ *  - conn_fd: client socket.
+ *  - req: request whose body is being received.
+ * RETV: returns 0 once the entire body has been received, or
+ *       returns -1 if an error occurred OR reading would block.
+ * ERRS:
+ *  - EAGAIN: more data to come.
+ *  - ECONNABORTED: client closed the connection before sending the full body.
+ *  - see request_body_consume(), recv(2), splice(2)
+ * NOTE: at most HB_PIPE_MAX (spliced) or one buffer (copied) of data is in flight at once,
+ *       independent of the body's size.
+ */
+int request_body_read(int conn_fd, httpmsg_t *req) {
+   httpreq_body_t *body;
+   size_t text_len;
+   ssize_t bytes_received;
+
+   body = &req->hm_line.reql.body;
+
+   /* consume body bytes that were received along with the headers */
+   text_len = req->hm_text_ptr - req->hm_text;
+   if (body->prefix < text_len) {
+      if (request_body_consume(req->hm_text + body->prefix, text_len - body->prefix, req) < 0) {
+         return -1;
+      }
+      body->prefix = text_len;
+   }
+
+   /* get copy buffer */
+   if (body->buf == NULL && !body->done) {
+      size_t bufsize = HM_BODYBUF_SIZE;
+      if (req->hm_pool) {
+         bufsize = smin(bufsize, req->hm_pool->maxsize);
+         body->buf = bufpool_get(bufsize, &body->bufsize, req->hm_pool);
+         body->buf_pooled = (body->buf != NULL);
+      }
+      if (body->buf == NULL) {
+         if ((body->buf = arena_alloc(HM_BODYBUF_SIZE, &req->hm_arena)) == NULL) {
+            return -1;
+         }
+         body->bufsize = HM_BODYBUF_SIZE;
+      }
+   }
+   
+   while (!body->done) {
+      /* splice if possible */
+      if (body->pipefd[0] >= 0) {
+         if (request_body_splice(conn_fd, req) == 0) {
+            continue;
+         } else if (errno != EINVAL) {
+            return -1;
+         }
+         close(body->pipefd[0]);
+         close(body->pipefd[1]);
+         body->pipefd[0] = body->pipefd[1] = -1;
+         continue;
+      }
+      
+      /* otherwise, copy through buffer */
+      bytes_received = recv(conn_fd, body->buf, body->type == HB_LENGTH ?
+                            smin(body->bufsize, body->remaining) : body->bufsize, MSG_DONTWAIT);
+      if (bytes_received < 0) {
+         return -1;
+      } else if (bytes_received == 0) {
+         errno = ECONNABORTED;
+         return -1;
+      }
+      if (request_body_consume(body->buf, bytes_received, req) < 0) {
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+/* request_body_commit()
+ * DESC: moves the fully received body of _req_ into place at the path passed to
+ *       request_body_open().
+ * RETV: 0 on success, -1 on error.
+ */
+int request_body_commit(httpmsg_t *req) {
+   httpreq_body_t *body;
+
+   body = &req->hm_line.reql.body;
+   if (body->type == HB_NONE || !body->done) {
+      errno = EINVAL;
+      return -1;
+   }
+   if (rename(body->tmppath, body->path) < 0) {
+      return -1;
+   }
+   body->tmppath = NULL;
+
+   return 0;
+}
+
+/* request_body_delete()
+ * DESC: stops receiving _req_'s body, closing its file and pipe. If the body was not
+ *       committed, the temporary file is removed.
+ */
+void request_body_delete(httpmsg_t *req) {
+   httpreq_body_t *body;
+
+   body = &req->hm_line.reql.body;
+   if (body->type == HB_NONE) {
+      return;
+   }
+
+   close(body->fd);
+   if (body->pipefd[0] >= 0) {
+      close(body->pipefd[0]);
+      close(body->pipefd[1]);
+   }
+   if (body->tmppath) {
+      unlink(body->tmppath);
+   }
+   if (body->buf_pooled) {
+      bufpool_put(body->buf, body->bufsize, req->hm_pool);
+   }
+   memset(body, 0, sizeof(*body));
+}
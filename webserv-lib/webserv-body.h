@@ -0,0 +1,19 @@
+#ifndef __WEBSERV_BODY_H
+#define __WEBSERV_BODY_H
+
+/* required headers */
+#include "webserv-msg.h"
+
+/* defines */
+#define HB_PIPE_MAX   0x10000 // max bytes spliced through the pipe at once (default capacity)
+#define HB_TMP_SUFFIX ".XXXXXX"
+#define HB_FILE_MODE  0644
+
+/* prototypes */
+int request_body_open(const char *path, size_t max, httpmsg_t *req);
+int request_body_read(int conn_fd, httpmsg_t *req);
+int request_body_pending(const httpmsg_t *req);
+int request_body_commit(httpmsg_t *req);
+void request_body_delete(httpmsg_t *req);
+
+#endif
@@ -0,0 +1,149 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "webserv-codel.h"
+
+uint64_t codel_control_law(uint64_t t, uint32_t count, const codel_t *codel);
+uint32_t codel_isqrt(uint32_t n);
+
+/* codel_init()
+ * DESC: initializes admission controller _codel_ with target delay _target_ and interval
+ *       _interval_ (in nanoseconds).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _target_ or _interval_ is 0.
+ *  - see pthread_mutex_init(3)
+ */
+int codel_init(uint64_t target, uint64_t interval, codel_t *codel) {
+   int err;
+
+   memset(codel, 0, sizeof(*codel));
+   if (target == 0 || interval == 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   codel->target = target;
+   codel->interval = interval;
+   if ((err = pthread_mutex_init(&codel->lock, NULL))) {
+      errno = err;
+      return -1;
+   }
+
+   return 0;
+}
+
+/* codel_clock()
+ * DESC: returns the current time (CLOCK_MONOTONIC, in nanoseconds), as passed to the other
+ *       codel_* functions.
+ */
+uint64_t codel_clock(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* codel_sample()
+ * DESC: records the delay of a connection accepted at time _accepted_ that is first read
+ *       from at time _now_.
+ * NOTE: thread-safe.
+ */
+void codel_sample(uint64_t accepted, uint64_t now, codel_t *codel) {
+   uint64_t delay;
+
+   delay = (now > accepted) ? now - accepted : 0;
+
+   pthread_mutex_lock(&codel->lock);
+   codel->last_sample = now;
+   if (delay < codel->target) {
+      codel->first_above = 0;
+      codel->above = 0;
+   } else if (codel->first_above == 0) {
+      codel->first_above = now + codel->interval;
+   } else if (now >= codel->first_above) {
+      codel->above = 1;
+   }
+   pthread_mutex_unlock(&codel->lock);
+}
+
+/* codel_admit()
+ * DESC: decides whether to admit a connection accepted at time _now_ (see RFC 8289, with
+ *       turning away a connection in place of dropping a packet).
+ * RETV: 1 if the connection is to be served, 0 if it is to be turned away.
+ * NOTE: thread-safe. If no connection has been sampled for an interval, the delay is taken
+ *       to be below target (the connections turned away aren't sampled).
+ */
+int codel_admit(uint64_t now, codel_t *codel) {
+   uint32_t delta;
+   int admit;
+
+   admit = 1;
+   pthread_mutex_lock(&codel->lock);
+   if (codel->above && now - codel->last_sample >= codel->interval) {
+      codel->first_above = 0;
+      codel->above = 0;
+   }
+
+   if (codel->dropping) {
+      if (!codel->above) {
+         codel->dropping = 0;
+      } else if (now >= codel->drop_next) {
+         admit = 0;
+         ++codel->count;
+         codel->drop_next = codel_control_law(codel->drop_next, codel->count, codel);
+      }
+   } else if (codel->above) {
+      /* start dropping (at the rate we left off at, if that was recently) */
+      admit = 0;
+      codel->dropping = 1;
+      delta = codel->count - codel->lastcount;
+      codel->count = 1;
+      if (delta > 1 && now - codel->drop_next < 16 * codel->interval) {
+         codel->count = delta;
+      }
+      codel->drop_next = codel_control_law(now, codel->count, codel);
+      codel->lastcount = codel->count;
+   }
+
+   if (!admit) {
+      ++codel->ndropped;
+   }
+   pthread_mutex_unlock(&codel->lock);
+
+   return admit;
+}
+
+/* codel_control_law()
+ * DESC: returns the time the next connection is turned away at, _count_ connections into
+ *       dropping, the last one at time _t_.
+ */
+uint64_t codel_control_law(uint64_t t, uint32_t count, const codel_t *codel) {
+   return t + codel->interval / codel_isqrt(count);
+}
+
+/* codel_isqrt(): returns floor(sqrt(_n_)), or 1 if _n_ is 0. */
+uint32_t codel_isqrt(uint32_t n) {
+   uint32_t root;
+
+   for (root = 1; (uint64_t) (root + 1) * (root + 1) <= n; ++root) {}
+   return root;
+}
+
+/* codel_dropped(): returns the number of connections _codel_ has turned away. */
+uint64_t codel_dropped(codel_t *codel) {
+   uint64_t ndropped;
+
+   pthread_mutex_lock(&codel->lock);
+   ndropped = codel->ndropped;
+   pthread_mutex_unlock(&codel->lock);
+
+   return ndropped;
+}
+
+/* codel_delete()
+ * DESC: frees admission controller _codel_.
+ */
+void codel_delete(codel_t *codel) {
+   pthread_mutex_destroy(&codel->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef __WEBSERV_CODEL_H
+#define __WEBSERV_CODEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* defines */
+#define CODEL_INTERVAL  100000000ull // default interval (ns): how long the delay may stay above
+                                     // target before connections are turned away (100 ms)
+#define CODEL_RETRY_AFTER 1          // seconds connections turned away are asked to wait
+
+/* types */
+/* CoDel-style admission controller: the delay from accepting a connection to first
+ * reading from it (how long it sat in the server's queues) is sampled; once it has stayed
+ * above _target_ for an _interval_, new connections are turned away at a rate that grows
+ * with the square root of the number turned away, until the delay drops below target. */
+typedef struct {
+   uint64_t target;       // target delay (ns)
+   uint64_t interval;     // (ns)
+   uint64_t first_above;  // time the delay may stay above target until (0 if below target)
+   int above;             // whether the delay has been above target for an interval
+   uint64_t last_sample;  // time of last sample (samples go stale after an interval)
+   int dropping;          // whether connections are being turned away
+   uint64_t drop_next;    // time the next connection is turned away at (if dropping)
+   uint32_t count;        // connections turned away since dropping started
+   uint32_t lastcount;    // _count_ when dropping last started
+   uint64_t ndropped;     // connections turned away in total
+   pthread_mutex_t lock;
+} codel_t;
+
+/* prototypes */
+int codel_init(uint64_t target, uint64_t interval, codel_t *codel);
+uint64_t codel_clock(void);
+void codel_sample(uint64_t accepted, uint64_t now, codel_t *codel);
+int codel_admit(uint64_t now, codel_t *codel);
+uint64_t codel_dropped(codel_t *codel);
+void codel_delete(codel_t *codel);
+
+#endif
@@ -7,9 +7,10 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <strings.h>
+#include <stdint.h>
 
 #include "webserv-util.h"
-#include "webserv-vec.h"
 #include "webserv-dbg.h"
 #include "webserv-contype.h"
 
@@ -19,19 +20,29 @@
  *  - tabpath: path to table file (e.g. "/etc/mime.types").
  *  - ftypes: pointer to content type table. 
  * RETV: 0 on success, -1 on error.
+ * NOTE: each line of the file is a content type followed by its extensions (if any);
+ *       lines beginning with '#' are ignored. If an extension is listed more than once,
+ *       the first content type listed for it is used.
  */
+int content_types_pool(const char *str, size_t len, int lower, uint32_t *offp,
+                       filetype_table_t *ftypes);
+void content_types_src(const struct stat *tabstat, filetype_src_t *src);
+int content_types_check(const filetype_slot_t *slots, uint32_t nslots, size_t strs_len);
 int content_types_load(const char *tabpath, filetype_table_t *ftypes) {
    int tabfd;
    off_t tablen;
    struct stat tabstat;
    char *tab;
+   const char *pos, *end, *line_end, *tok, *tok_end, *name;
+   size_t name_len;
+   uint32_t name_off;
    int retv, errsav;
    
    /* initialize vars */
    tabfd = -1;
-   tab = NULL;
+   tab = MAP_FAILED;
    retv = -1;
-   VECTOR_INIT(ftypes);
+   memset(ftypes, 0, sizeof(*ftypes));
    
    /* open type table file */
    if ((tabfd = open(tabpath, O_RDONLY)) < 0) {
@@ -43,78 +54,61 @@ int content_types_load(const char *tabpath, filetype_table_t *ftypes) {
       goto cleanup;
    }
    tablen = tabstat.st_size;
+   content_types_src(&tabstat, &ftypes->src);
 
+   /* reserve offset 0 of string pool for the empty string */
+   if (content_types_pool("", 0, 0, &name_off, ftypes) < 0) {
+      goto cleanup;
+   }
+   
    /* map types filedes into memory */
-   if ((tab = mmap(NULL, tablen, PROT_READ|PROT_WRITE, MAP_PRIVATE, tabfd, 0)) == NULL) {
+   if (tablen > 0
+       && (tab = mmap(NULL, tablen, PROT_READ, MAP_PRIVATE, tabfd, 0)) == MAP_FAILED) {
       goto cleanup;
    }
 
-   /* tokenize file's contents and store into vector */
-   char *name, *ext, *line;
-   char *line_last; // for strtok_r()'s parsing of lines
-   const char *line_term = "\n", *name_term = " \t", *ext_term = " \t";
-   filetype_t ftype;
-
-   if ((line = strtok_r(tab, line_term, &line_last))) {
-      line = strstrip(line, line_term);
-   }
-   while (line && *line == '#') {
-      if ((line = strtok_r(NULL, line_term, &line_last))) {
-         line = strstrip(line, line_term);
+   /* parse lines: content type, followed by its extensions */
+   for (pos = tab, end = tab + tablen; tablen > 0 && pos < end; pos = line_end + 1) {
+      if ((line_end = memchr(pos, '\n', end - pos)) == NULL) {
+         line_end = end;
       }
-   }
-   while (line && isgraph(*line)) {
-      /* parse name */
-      if ((name = strtok(line, name_term)) == NULL || !isgraph(*name)) {
-         errno = EINVAL;
-         goto cleanup;
+      if (*pos == '#') {
+         continue;
       }
-      
-      /* parse all extensions (if any) */
-      while ((ext = strtok(NULL, ext_term))) {
-         /* strip leading spaces */
-         ext = strstrip(ext, name_term);
-         
-         /* validate extension */
-         if (!isgraph(*ext)) {
-            errno = EINVAL;
-            goto cleanup;
+
+      name = NULL;
+      name_len = name_off = 0;
+      for (tok = pos; ; tok = tok_end) {
+         /* find next token */
+         while (tok < line_end && isspace((unsigned char) *tok)) {
+            ++tok;
          }
-         
-         /* dupe name & extension */
-         content_type_init(&ftype);
-         if ((ftype.name = strdup(name)) == NULL) {
-            goto cleanup;
+         if (tok == line_end) {
+            break;
          }
-         if ((ftype.ext = strdup(ext)) == NULL) {
-            content_type_del(&ftype);
-            goto cleanup;
+         for (tok_end = tok; tok_end < line_end && !isspace((unsigned char) *tok_end);
+              ++tok_end) {}
+
+         if (name == NULL) {
+            name = tok;
+            name_len = tok_end - tok;
+            continue;
          }
          
-         /* insert (name, ext.) pair into table */
-         if (VECTOR_INSERT(&ftype, ftypes) < 0) {
-            content_type_del(&ftype);
+         /* store content type (once per line) & insert extension */
+         if ((name_off == 0 && content_types_pool(name, name_len, 0, &name_off, ftypes) < 0)
+             || content_type_insert(tok, tok_end - tok, name_off, ftypes) < 0) {
             goto cleanup;
          }
       }
-      
-      /* read in next line */
-      do {
-         if ((line = strtok_r(NULL, line_term, &line_last))) {
-            line = strstrip(line, line_term);
-         }
-      } while (line && *line == '#');
    }
-   
-   /* sort table (by extension) */
-   VECTOR_QSORT(ftypes, content_types_cmp);
 
    retv = 0; // success
 
    /* cleanup */
  cleanup:
    errsav = errno; // save error, if any
-   if (tab && munmap(tab, tablen) < 0) {
+   if (tab != MAP_FAILED && munmap(tab, tablen) < 0) {
       if (retv >= 0) {
          errsav = errno;
       }
@@ -127,93 +121,373 @@ int content_types_load(const char *tabpath, filetype_table_t *ftypes) {
       retv = -1;
    }
    if (retv < 0) {
-      VECTOR_DELETE(ftypes, content_type_del); // always succeeds
+      content_types_delete(ftypes);
    }
 
    errno = errsav;
    return retv;
 }
 
-/* content_type_init(): initialize content type struct. */
-void content_type_init(filetype_t *ftype) {
-   memset(ftype, 0, sizeof(*ftype));
+/* content_types_open()
+ * DESC: loads content types table from types file _tabpath_, using its snapshot at
+ *       _snappath_ if it is up to date, or else parsing the types file and (re)creating
+ *       the snapshot.
+ * ARGS:
+ *  - tabpath: path to table file (e.g. "/etc/mime.types").
+ *  - snappath: path to snapshot (NULL for none).
+ *  - ftypes: pointer to content type table.
+ * RETV: 0 on success, -1 on error.
+ * NOTE: failing to save the snapshot is not an error (but is printed).
+ */
+int content_types_open(const char *tabpath, const char *snappath, filetype_table_t *ftypes) {
+   if (snappath && content_types_map(snappath, tabpath, ftypes) == 0) {
+      return 0;
+   }
+   if (content_types_load(tabpath, ftypes) < 0) {
+      return -1;
+   }
+   if (snappath && content_types_save(snappath, ftypes) < 0) {
+      perror("content_types_save");
+   }
+
+   return 0;
 }
 
-/* content_types_cmp(): compare two content types. */
-int content_types_cmp(const filetype_t *ft1, const filetype_t *ft2) {
-   return strcmp(ft1->ext, ft2->ext);
+/* content_types_src()
+ * DESC: records the identity of types file with status _tabstat_ in _src_.
+ */
+void content_types_src(const struct stat *tabstat, filetype_src_t *src) {
+   memset(src, 0, sizeof(*src));
+   src->size = tabstat->st_size;
+   src->mtime_sec = tabstat->st_mtim.tv_sec;
+   src->mtime_nsec = tabstat->st_mtim.tv_nsec;
+   src->ino = tabstat->st_ino;
+   src->dev = tabstat->st_dev;
 }
 
-/* content_type_del(): delete a content type struct. */
-int content_type_del(filetype_t *ft) {
-   free(ft->name);
-   free(ft->ext);
-   return 0; // always succeeds
+/* content_types_check()
+ * DESC: checks that all _nslots_ slots at _slots_ refer to strings inside a string pool
+ *       of _strs_len_ bytes.
+ * RETV: 1 if so, 0 otherwise.
+ */
+int content_types_check(const filetype_slot_t *slots, uint32_t nslots, size_t strs_len) {
+   for (uint32_t i = 0; i < nslots; ++i) {
+      if (slots[i].ext >= strs_len || slots[i].name >= strs_len) {
+         return 0;
+      }
+   }
+   return 1;
 }
 
-/* content_type_get()
- * DESC: find content type of file at path _path_ by looking in table _ftypes_.
- * RETV: returns pointer to content type as string.
+/* content_types_map()
+ * DESC: maps binary snapshot of a content types table (see content_types_save()) into
+ *       memory and uses it in place as table _ftypes_, without any parsing.
+ * ARGS:
+ *  - snappath: path of snapshot.
+ *  - tabpath: path of the types file the snapshot was saved from.
+ *  - ftypes: pointer to content type table.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - ESTALE: the snapshot is not a valid snapshot of the current types file at _tabpath_
+ *            (e.g. the types file was modified since); load the types file instead.
+ *  - see open(2), stat(2), mmap(2)
+ * NOTE: the mapped table is read-only (content_type_insert() fails with EROFS).
  */
-const char *content_type_get(const char *path, const filetype_table_t *ftypes) {
-   char *name, *ext;
-   filetype_t key, *match;
+int content_types_map(const char *snappath, const char *tabpath, filetype_table_t *ftypes) {
+   struct stat tabstat, snapstat;
+   filetype_src_t src;
+   const filetype_snaphdr_t *hdr;
+   size_t slots_len;
+   void *map;
+   int snapfd, errsav;
+
+   memset(ftypes, 0, sizeof(*ftypes));
+   map = MAP_FAILED;
+   
+   /* get identity of current types file */
+   if (stat(tabpath, &tabstat) < 0) {
+      return -1;
+   }
+   content_types_src(&tabstat, &src);
+
+   /* map snapshot */
+   if ((snapfd = open(snappath, O_RDONLY)) < 0) {
+      return -1;
+   }
+   if (fstat(snapfd, &snapstat) == 0 && (size_t) snapstat.st_size >= sizeof(*hdr)) {
+      map = mmap(NULL, snapstat.st_size, PROT_READ, MAP_SHARED, snapfd, 0);
+   } else {
+      errno = ESTALE;
+   }
+   errsav = errno;
+   close(snapfd);
+   if (map == MAP_FAILED) {
+      errno = errsav;
+      return -1;
+   }
+
+   /* validate snapshot */
+   hdr = map;
+   slots_len = (size_t) hdr->nslots * sizeof(*ftypes->slots);
+   if (memcmp(hdr->magic, CONTENT_TYPES_MAGIC, sizeof(hdr->magic)) != 0
+       || memcmp(&hdr->src, &src, sizeof(src)) != 0
+       || (hdr->nslots & (hdr->nslots - 1)) != 0
+       || hdr->cnt * 2 > hdr->nslots
+       || hdr->strs_len == 0
+       || sizeof(*hdr) + slots_len + hdr->strs_len != (size_t) snapstat.st_size
+       || ((char *) map)[snapstat.st_size - 1] != '\0'
+       || !content_types_check((const filetype_slot_t *) (hdr + 1), hdr->nslots,
+                               hdr->strs_len)) {
+      munmap(map, snapstat.st_size);
+      errno = ESTALE;
+      return -1;
+   }
+
+   /* use snapshot in place */
+   ftypes->slots = (filetype_slot_t *) (hdr + 1);
+   ftypes->nslots = hdr->nslots;
+   ftypes->cnt = hdr->cnt;
+   ftypes->strs = (char *) ftypes->slots + slots_len;
+   ftypes->strs_len = hdr->strs_len;
+   ftypes->src = src;
+   ftypes->map = map;
+   ftypes->map_len = snapstat.st_size;
+
+   return 0;
+}
+
+/* content_types_pool()
+ * DESC: appends string _str_ of length _len_ (lowercased if _lower_) to the string pool of
+ *       table _ftypes_ and returns its offset in _*offp_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EFBIG: string pool would exceed 4 GiB.
+ *  - see realloc(3)
+ */
+int content_types_pool(const char *str, size_t len, int lower, uint32_t *offp,
+                       filetype_table_t *ftypes) {
+   size_t new_size;
+   char *new_strs, *dst;
+
+   if (ftypes->strs_len + len + 1 > UINT32_MAX) {
+      errno = EFBIG;
+      return -1;
+   }
+   
+   /* grow pool if necessary */
+   if (ftypes->strs_len + len + 1 > ftypes->strs_size) {
+      new_size = smax(CONTENT_TYPES_STRS_MIN, ftypes->strs_size * 2);
+      new_size = smax(new_size, ftypes->strs_len + len + 1);
+      if ((new_strs = realloc(ftypes->strs, new_size)) == NULL) {
+         return -1;
+      }
+      ftypes->strs = new_strs;
+      ftypes->strs_size = new_size;
+   }
+
+   /* copy string */
+   *offp = ftypes->strs_len;
+   dst = ftypes->strs + ftypes->strs_len;
+   for (size_t i = 0; i < len; ++i) {
+      dst[i] = lower ? tolower((unsigned char) str[i]) : str[i];
+   }
+   dst[len] = '\0';
+   ftypes->strs_len += len + 1;
+
+   return 0;
+}
+
+/* content_type_hash()
+ * DESC: case-insensitive (FNV-1a) hash of extension _ext_ of length _len_.
+ */
+uint32_t content_type_hash(const char *ext, size_t len) {
+   uint32_t hash;
 
-   /* parse extension */
-   if ((ext = strrchr(path, '.'))) {
-      ext += 1; // skip over leading '.' of extension
-      
-      /* find extension in file type table */
-      key.ext = ext;
-      match = bsearch(&key, ftypes->arr, ftypes->cnt, sizeof(*ftypes->arr),
-                     (int (*) (const void *, const void *)) content_types_cmp);
+   hash = 2166136261u;
+   for (size_t i = 0; i < len; ++i) {
+      hash = (hash ^ (unsigned char) tolower((unsigned char) ext[i])) * 16777619u;
    }
+   return hash;
+}
+
+/* content_type_find()
+ * DESC: finds the slot of extension _ext_ of length _len_ (and hash _hash_) in table
+ *       _ftypes_, or the empty slot where it would be inserted.
+ * NOTE: table must have at least one empty slot.
+ */
+filetype_slot_t *content_type_find(const char *ext, size_t len, uint32_t hash,
+                                   const filetype_table_t *ftypes) {
+   filetype_slot_t *slot;
+   uint32_t mask;
+
+   mask = ftypes->nslots - 1;
+   for (uint32_t i = hash & mask; (slot = &ftypes->slots[i])->ext; i = (i + 1) & mask) {
+      if (slot->hash == hash && strncasecmp(ftypes->strs + slot->ext, ext, len) == 0
+          && ftypes->strs[slot->ext + len] == '\0') {
+         break;
+      }
+   }
+
+   return slot;
+}
+
+/* content_types_rehash()
+ * DESC: resizes the slot array of table _ftypes_ to _nslots_ slots (a power of 2).
+ * RETV: 0 on success, -1 on error.
+ */
+int content_types_rehash(uint32_t nslots, filetype_table_t *ftypes) {
+   filetype_slot_t *old_slots, *slot;
+   uint32_t old_nslots, mask;
+
+   old_slots = ftypes->slots;
+   old_nslots = ftypes->nslots;
+   if ((ftypes->slots = calloc(nslots, sizeof(*ftypes->slots))) == NULL) {
+      ftypes->slots = old_slots;
+      return -1;
+   }
+   ftypes->nslots = nslots;
+
+   /* reinsert extensions (all distinct, so just find an empty slot) */
+   mask = nslots - 1;
+   for (uint32_t i = 0; i < old_nslots; ++i) {
+      if (old_slots[i].ext) {
+         uint32_t j;
+         for (j = old_slots[i].hash & mask; (slot = &ftypes->slots[j])->ext; j = (j + 1) & mask) {}
+         *slot = old_slots[i];
+      }
+   }
+   free(old_slots);
+
+   return 0;
+}
+
+/* content_type_insert()
+ * DESC: inserts extension _ext_ of length _len_ with content type at offset _name_ of the
+ *       string pool into table _ftypes_. If the extension is already present, the table
+ *       is not modified.
+ * RETV: 0 on success, -1 on error.
+ */
+int content_type_insert(const char *ext, size_t len, uint32_t name, filetype_table_t *ftypes) {
+   filetype_slot_t *slot;
+   uint32_t hash, ext_off;
+
+   if (ftypes->map) {
+      errno = EROFS;
+      return -1;
+   }
+
+   /* keep load factor at most 1/2 */
+   if ((ftypes->cnt + 1) * 2 > ftypes->nslots) {
+      if (content_types_rehash(ftypes->nslots ? ftypes->nslots * 2 : CONTENT_TYPES_NSLOTS_MIN,
+                               ftypes) < 0) {
+         return -1;
+      }
+   }
+
+   hash = content_type_hash(ext, len);
+   if ((slot = content_type_find(ext, len, hash, ftypes))->ext) {
+      return 0; // already present
+   }
+   if (content_types_pool(ext, len, 1, &ext_off, ftypes) < 0) {
+      return -1;
+   }
+   slot->hash = hash;
+   slot->ext = ext_off;
+   slot->name = name;
+   ++ftypes->cnt;
+
+   return 0;
+}
 
-   name = match ? match->name : CONTENT_TYPE_PLAIN;
+/* content_type_get()
+ * DESC: find content type of file at path _path_ by looking in table _ftypes_ (the
+ *       extension is matched case-insensitively).
+ * RETV: returns pointer to content type as string (valid as long as _ftypes_ is).
+ */
+const char *content_type_get(const char *path, const filetype_table_t *ftypes) {
+   const char *base, *ext;
+   const filetype_slot_t *slot;
+   size_t len;
 
-   if (DEBUG) {
-      fprintf(stderr, "(name, ext) = (%s, %s)\n", name, ext);
+   /* parse extension (of last path component) */
+   base = (base = strrchr(path, '/')) ? base + 1 : path;
+   if ((ext = strrchr(base, '.')) == NULL || ftypes->nslots == 0) {
+      return CONTENT_TYPE_PLAIN;
    }
+   ext += 1; // skip over leading '.' of extension
+   len = strlen(ext);
 
-   return name;
+   /* find extension in file type table */
+   slot = content_type_find(ext, len, content_type_hash(ext, len), ftypes);
+
+   return slot->ext ? ftypes->strs + slot->name : CONTENT_TYPE_PLAIN;
 }
 
 /* content_types_save()
- * DESC: save content type table to file.
+ * DESC: save binary snapshot of content type table to file, which content_types_map() can
+ *       map & use without parsing (as long as the types file it was loaded from is unchanged).
  * ARGS:
  *  - path: path at which to save table.
  *  - ftypes: pointer to table to save.
  * RETV: 0 on success, -1 on error.
+ * NOTE: the snapshot is written to a temporary file that is then renamed to _path_, so
+ *       processes mapping _path_ never see a partial snapshot.
  */
 int content_types_save(const char *path, const filetype_table_t *ftypes) {
    FILE *file;
-   size_t i;
-   filetype_t *ftype;
-   int retv, errsav;
+   filetype_snaphdr_t hdr;
+   char *tmppath;
+   int fd, retv, errsav;
 
-   retv = 0;
+   retv = -1;
+   file = NULL;
+   fd = -1;
 
-   if ((file = fopen(path, "w")) == NULL) {
+   /* create temporary file next to _path_ */
+   if (smprintf(&tmppath, "%s" CONTENT_TYPES_TMP_SUFFIX, path) < 0) {
       return -1;
    }
+   if ((fd = mkstemp(tmppath)) < 0 || fchmod(fd, 0644) < 0
+       || (file = fdopen(fd, "w")) == NULL) {
+      goto cleanup;
+   }
 
-   for (i = 0, ftype = ftypes->arr; i < ftypes->cnt; ++i, ++ftype) {
-      if (fprintf(file, "%s\t\t\t%s\n", ftype->name, ftype->ext) < 0) {
-         retv = -1;
-         errsav = errno;
-         break;
-      }
+   /* write header, slots & string pool */
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, CONTENT_TYPES_MAGIC, sizeof(hdr.magic));
+   hdr.nslots = ftypes->nslots;
+   hdr.cnt = ftypes->cnt;
+   hdr.strs_len = ftypes->strs_len;
+   hdr.src = ftypes->src;
+   if (fwrite(&hdr, sizeof(hdr), 1, file) != 1
+       || fwrite(ftypes->slots, sizeof(*ftypes->slots), ftypes->nslots, file) != ftypes->nslots
+       || fwrite(ftypes->strs, 1, ftypes->strs_len, file) != ftypes->strs_len) {
+      goto cleanup;
    }
 
+   retv = 0;
+
    /* cleanup */
-   if (fclose(file) < 0 && retv >= 0) {
-      retv = -1;
+ cleanup:
+   errsav = errno;
+   if (file) {
+      if (fclose(file) < 0 && retv >= 0) {
+         errsav = errno;
+         retv = -1;
+      }
+   } else if (fd >= 0) {
+      close(fd);
+   }
+   if (retv >= 0 && rename(tmppath, path) < 0) {
       errsav = errno;
+      retv = -1;
    }
-   if (retv < 0) {
-      errno = errsav;
+   if (retv < 0 && fd >= 0) {
+      unlink(tmppath);
    }
-   
+   free(tmppath);
+
+   errno = errsav;
    return retv;
 }
 
@@ -221,5 +495,11 @@ int content_types_save(const char *path, const filetype_table_t *ftypes) {
  * DESC: delete content type table.
  */
 void content_types_delete(filetype_table_t *ftypes) {
-   VECTOR_DELETE(ftypes, content_type_del);
+   if (ftypes->map) {
+      munmap(ftypes->map, ftypes->map_len);
+   } else {
+      free(ftypes->slots);
+      free(ftypes->strs);
+   }
+   memset(ftypes, 0, sizeof(*ftypes));
 }
@@ -1,22 +1,60 @@
 #ifndef __WEBSERV_CONTYPE_H
 #define __WEBSERV_CONTYPE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* content type table slot (one per extension) */
+typedef struct {
+   uint32_t hash;   // content_type_hash() of extension
+   uint32_t ext;    // offset of (lowercased) extension in string pool (0 if slot is empty)
+   uint32_t name;   // offset of content type in string pool
+} filetype_slot_t;
+
+/* identity of the types file a table was loaded from (to detect stale snapshots) */
 typedef struct {
-   char *name;
-   char *ext;
-} filetype_t;
+   uint64_t size;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   uint64_t ino;
+   uint64_t dev;
+} filetype_src_t;
 
+/* content type table: open-addressing hash table keyed by lowercased extension. All
+ * strings are stored contiguously in one string pool and referenced by offset. */
 typedef struct {
-   filetype_t *arr;
-   size_t len;
-   size_t cnt;
+   filetype_slot_t *slots;
+   uint32_t nslots;  // number of slots (power of 2, or 0 if table is empty)
+   uint32_t cnt;     // number of extensions
+   char *strs;       // string pool (offset 0 is the empty string)
+   size_t strs_len;  // bytes used in string pool
+   size_t strs_size; // bytes allocated for string pool
+   filetype_src_t src; // types file the table was loaded from
+   void *map;        // snapshot mapping that slots & strs point into (NULL if none)
+   size_t map_len;
 } filetype_table_t;
 
+/* header of binary snapshot of a table (see content_types_save()), followed by the
+ * slots and then the string pool, exactly as they are laid out in memory */
+typedef struct {
+   char magic[8];    // CONTENT_TYPES_MAGIC
+   uint32_t nslots;
+   uint32_t cnt;
+   uint64_t strs_len;
+   filetype_src_t src;
+} filetype_snaphdr_t;
+
 #define CONTENT_TYPE_PLAIN  "text/plain"
+#define CONTENT_TYPES_NSLOTS_MIN 0x100 // initial number of slots
+#define CONTENT_TYPES_STRS_MIN   0x1000 // initial size of string pool
+#define CONTENT_TYPES_MAGIC      "WSMIME\001" // snapshot magic (incl. format version)
+#define CONTENT_TYPES_TMP_SUFFIX ".XXXXXX"
+
 int content_types_load(const char *tabpath, filetype_table_t *ftypes);
-void content_type_init(filetype_t *ftype);
-int content_type_del(filetype_t *ft);
-int content_types_cmp(const filetype_t *ft1, const filetype_t *ft2);
+int content_types_open(const char *tabpath, const char *snappath, filetype_table_t *ftypes);
+int content_types_map(const char *snappath, const char *tabpath, filetype_table_t *ftypes);
+uint32_t content_type_hash(const char *ext, size_t len);
+int content_type_insert(const char *ext, size_t len, uint32_t name, filetype_table_t *ftypes);
 const char *content_type_get(const char *path, const filetype_table_t *ftypes);
 int content_types_save(const char *path, const filetype_table_t *ftypes);
 void content_types_delete(filetype_table_t *ftypes);
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/utsname.h>
+#include "webserv-ctx.h"
+
+/* webserv_ctx_init()
+ * DESC: initializes per-worker context _ctx_ for a server named _servname_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see uname(2)
+ */
+int webserv_ctx_init(const char *servname, webserv_ctx_t *ctx) {
+   struct utsname sysinfo;
+
+   memset(ctx, 0, sizeof(*ctx));
+
+   /* format Server header value */
+   if (uname(&sysinfo) < 0) {
+      return -1;
+   }
+   snprintf(ctx->servhdr, sizeof(ctx->servhdr), "%s/%s %s", sysinfo.sysname, sysinfo.release,
+            servname);
+
+   /* format current date */
+   ctx->clock = -1;
+   if (webserv_ctx_date(ctx) == NULL) {
+      return -1;
+   }
+
+   return 0;
+}
+
+/* webserv_ctx_now()
+ * DESC: returns the current time (in seconds), updating the context's clock cache.
+ */
+time_t webserv_ctx_now(webserv_ctx_t *ctx) {
+   time_t now;
+
+   if ((now = time(NULL)) != ctx->clock
+       && hm_fmtdate(&now, ctx->date) == 0) {
+      ctx->clock = now;
+   }
+   return now;
+}
+
+/* webserv_ctx_date()
+ * DESC: returns the current date formatted for the Date header. The date is only
+ *       reformatted once per second.
+ * RETV: the formatted date on success, NULL on error.
+ */
+const char *webserv_ctx_date(webserv_ctx_t *ctx) {
+   return (webserv_ctx_now(ctx) == ctx->clock) ? ctx->date : NULL;
+}
+
+/* webserv_stats_count()
+ * DESC: counts a response with status _code_ in _stats_.
+ */
+void webserv_stats_count(int code, webserv_stats_t *stats) {
+   if (code / 100 > 0 && code / 100 < WEBSERV_NCLASSES) {
+      WEBSERV_STATS_INC(stats->nresps[code / 100]);
+   }
+}
+
+/* webserv_stats_add()
+ * DESC: adds statistics shard _src_ to _dst_.
+ * NOTE: _src_ may be updated by its worker meanwhile, and _dst_ read by others (e.g. in
+ *       shared memory); each counter is read & written whole (see WEBSERV_STATS_INC()).
+ */
+void webserv_stats_add(const webserv_stats_t *src, webserv_stats_t *dst) {
+   __atomic_store_n(&dst->nreqs, dst->nreqs + __atomic_load_n(&src->nreqs, __ATOMIC_RELAXED),
+                    __ATOMIC_RELAXED);
+   for (int i = 0; i < WEBSERV_NCLASSES; ++i) {
+      __atomic_store_n(&dst->nresps[i],
+                       dst->nresps[i] + __atomic_load_n(&src->nresps[i], __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+   }
+}
+
+/* webserv_stats_print()
+ * DESC: prints summary of statistics _stats_ to _f_.
+ */
+void webserv_stats_print(FILE *f, const webserv_stats_t *stats) {
+   fprintf(f, "dispatched %" PRIu64 " requests; responses: ", stats->nreqs);
+   for (int i = 1; i < WEBSERV_NCLASSES; ++i) {
+      fprintf(f, "%s%dxx %" PRIu64, (i > 1) ? ", " : "", i, stats->nresps[i]);
+   }
+   fprintf(f, "\n");
+}
@@ -0,0 +1,52 @@
+#ifndef __WEBSERV_CTX_H
+#define __WEBSERV_CTX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "webserv-util.h"
+#include "webserv-contype.h"
+
+/* defines */
+#define WEBSERV_SERVHDR_MAX 0x100 // max length of Server header value
+#define WEBSERV_NCLASSES    6     // response status classes counted (index 1-5: 1xx-5xx)
+
+/* increments statistics counter _counter_: each counter is only written by its own worker,
+ * but may be read by others meanwhile (see webserv_stats_add()), so it is accessed as a
+ * relaxed atomic -- as cheap as a plain increment */
+#define WEBSERV_STATS_INC(counter)                                                  \
+   __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + 1, \
+                    __ATOMIC_RELAXED)
+
+/* types */
+/* request statistics (one shard per worker; shards are summed by webserv_stats_add()) */
+typedef struct {
+   uint64_t nreqs;                     // requests dispatched to a method handler
+   uint64_t nresps[WEBSERV_NCLASSES];  // responses created, by status class
+} webserv_stats_t;
+
+/* per-worker context: everything a worker (thread or event loop) needs to handle
+ * requests that would otherwise be shared or recomputed per request. A context must
+ * only be used by one thread at a time. */
+typedef struct {
+   time_t clock;                      // time (in seconds) _date_ was formatted for
+   char date[HM_DATE_LEN];            // cached Date header value
+   char servhdr[WEBSERV_SERVHDR_MAX]; // Server header value (formatted once)
+   webserv_stats_t stats;             // this worker's statistics shard
+   const filetype_table_t *ftypes;    // content types in use by current request (see
+                                      // server_handle_req())
+   int persist;                       // whether worker can keep connections open between
+                                      // requests (set by the worker; 0 by default)
+   int keepalive;                     // whether connection stays open after the response
+                                      // being created (set by server_handle_req())
+} webserv_ctx_t;
+
+/* prototypes */
+int webserv_ctx_init(const char *servname, webserv_ctx_t *ctx);
+time_t webserv_ctx_now(webserv_ctx_t *ctx);
+const char *webserv_ctx_date(webserv_ctx_t *ctx);
+void webserv_stats_count(int code, webserv_stats_t *stats);
+void webserv_stats_add(const webserv_stats_t *src, webserv_stats_t *dst);
+void webserv_stats_print(FILE *f, const webserv_stats_t *stats);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef __WEBSERV_DBG_H
 #define __WEBSERV_DBG_H
 
-#define DEBUG 1
+/* debug output (build with `make DEBUG=1`); off by default so nothing is logged per request */
+#ifndef DEBUG
+#define DEBUG 0
+#endif
 
 #endif
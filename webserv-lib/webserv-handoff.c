@@ -0,0 +1,269 @@
+#define _GNU_SOURCE // close_range(2)
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "webserv-handoff.h"
+
+extern char **environ;
+
+char **handoff_environ(int *envlenp);
+
+/* handoff_spawn()
+ * DESC: starts a new server process to hand the listening sockets off to (see
+ *       handoff_send()): execs the binary at _argv[0]_ (found anew on disk, so a deploy
+ *       can replace it) with arguments _argv_, inheriting one end of a Unix domain socket
+ *       pair as HANDOFF_FD (named by HANDOFF_ENV in its environment) and nothing else but
+ *       the standard streams.
+ * ARGS:
+ *  - argv: arguments of the new process (NULL-terminated); _argv[0]_ must be a path.
+ *  - sockp: where to return this process's end of the socket pair.
+ * RETV: the new process's pid on success, -1 on error.
+ * ERRS:
+ *  - see socketpair(2), fork(2), malloc(3)
+ * NOTE: the new process starts with no signals blocked. If exec fails, it exits with
+ *       status 127 (and the socket pair is hung up on).
+ */
+pid_t handoff_spawn(char *const argv[], int *sockp) {
+   int sv[2];
+   char **envp;
+   char envfd[sizeof(HANDOFF_ENV) + 16];
+   int envlen;
+   sigset_t sigset;
+   pid_t pid;
+
+   if ((envp = handoff_environ(&envlen)) == NULL) {
+      return -1;
+   }
+   snprintf(envfd, sizeof(envfd), HANDOFF_ENV "=%d", HANDOFF_FD);
+   envp[envlen] = envfd;
+   sigemptyset(&sigset);
+   if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+      free(envp);
+      return -1;
+   }
+
+   if ((pid = fork()) == 0) {
+      /* new process: only async-signal-safe calls until exec (dup2(2) clears
+       * FD_CLOEXEC, unless the descriptor is already in place) */
+      if ((sv[1] == HANDOFF_FD) ? fcntl(sv[1], F_SETFD, 0) < 0
+          : dup2(sv[1], HANDOFF_FD) < 0) {
+         _exit(127);
+      }
+      close_range(HANDOFF_FD + 1, ~0U, 0);
+      sigprocmask(SIG_SETMASK, &sigset, NULL);
+      execve(argv[0], argv, envp);
+      _exit(127);
+   }
+
+   free(envp);
+   close(sv[1]);
+   if (pid < 0) {
+      close(sv[0]);
+      return -1;
+   }
+   *sockp = sv[0];
+
+   return pid;
+}
+
+/* handoff_environ()
+ * DESC: copies this process's environment, less any HANDOFF_ENV variable, leaving room
+ *       for one more variable.
+ * ARGS:
+ *  - envlenp: where to return the number of variables copied (the index of the free
+ *             slot, which is followed by the terminating NULL).
+ * RETV: the copy (malloc()ed; the variables themselves are shared), NULL on error.
+ */
+char **handoff_environ(int *envlenp) {
+   char **envp;
+   int n, len;
+
+   for (n = 0; environ[n]; ++n) {}
+   if ((envp = calloc(n + 2, sizeof(*envp))) == NULL) {
+      return NULL;
+   }
+   for (len = 0, n = 0; environ[n]; ++n) {
+      if (strncmp(environ[n], HANDOFF_ENV "=", sizeof(HANDOFF_ENV)) != 0) {
+         envp[len++] = environ[n];
+      }
+   }
+   *envlenp = len;
+
+   return envp;
+}
+
+/* handoff_send()
+ * DESC: passes listening sockets _fds_ over handoff socket _sock_ (SCM_RIGHTS), along
+ *       with their number.
+ * ARGS:
+ *  - sock: this process's end of the handoff socket (see handoff_spawn()).
+ *  - fds: listening sockets (they stay open here too).
+ *  - nfds: number of listening sockets (at most HANDOFF_MAXFDS).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _nfds_ is 0 or greater than HANDOFF_MAXFDS.
+ *  - see sendmsg(2)
+ */
+int handoff_send(int sock, const int *fds, size_t nfds) {
+   union {
+      char buf[CMSG_SPACE(HANDOFF_MAXFDS * sizeof(int))];
+      struct cmsghdr align;
+   } ctl;
+   struct msghdr mh = {0};
+   struct cmsghdr *cmsg;
+   struct iovec iov;
+   unsigned char cnt;
+
+   if (nfds == 0 || nfds > HANDOFF_MAXFDS) {
+      errno = EINVAL;
+      return -1;
+   }
+   cnt = nfds;
+   iov.iov_base = &cnt;
+   iov.iov_len = sizeof(cnt);
+   mh.msg_iov = &iov;
+   mh.msg_iovlen = 1;
+   memset(&ctl, 0, sizeof(ctl));
+   mh.msg_control = ctl.buf;
+   mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+   cmsg = CMSG_FIRSTHDR(&mh);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+   memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+   return (sendmsg(sock, &mh, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+/* handoff_wait()
+ * DESC: waits (for at most _timeout_ seconds) for the new process at the other end of
+ *       handoff socket _sock_ to report that it is serving (see handoff_ready()).
+ * RETV: 0 once it is ready, -1 if it isn't.
+ * ERRS:
+ *  - ETIMEDOUT: the timeout passed first.
+ *  - EPIPE: the new process hung up (e.g. it failed to start or exited).
+ *  - see poll(2), read(2)
+ */
+int handoff_wait(int sock, int timeout) {
+   struct pollfd pfd;
+   ssize_t nread;
+   char c;
+
+   pfd.fd = sock;
+   pfd.events = POLLIN;
+   switch (poll(&pfd, 1, timeout * 1000)) {
+   case -1:
+      return -1;
+   case 0:
+      errno = ETIMEDOUT;
+      return -1;
+   }
+   if ((nread = read(sock, &c, 1)) < 0 && errno != ECONNRESET) {
+      return -1;
+   }
+   if (nread <= 0 || c != HANDOFF_READY) {
+      errno = EPIPE;
+      return -1;
+   }
+
+   return 0;
+}
+
+/* handoff_inherited()
+ * DESC: returns the handoff socket this process inherited from the process that started
+ *       it (see handoff_spawn()), or -1 if it was started normally.
+ */
+int handoff_inherited(void) {
+   const char *val;
+   char *end;
+   long fd;
+
+   if ((val = getenv(HANDOFF_ENV)) == NULL) {
+      return -1;
+   }
+   fd = strtol(val, &end, 10);
+   if (*val == '\0' || *end != '\0' || fd < 0 || fd > INT_MAX) {
+      return -1;
+   }
+   unsetenv(HANDOFF_ENV); // not to be inherited any further
+   fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+   return fd;
+}
+
+/* handoff_recv()
+ * DESC: receives the listening sockets handed off over handoff socket _sock_ (see
+ *       handoff_send()).
+ * ARGS:
+ *  - sock: inherited handoff socket (see handoff_inherited()).
+ *  - fds: where to return the listening sockets (close-on-exec).
+ *  - maxfds: capacity of _fds_.
+ * RETV: the number of listening sockets received, -1 on error.
+ * ERRS:
+ *  - EBADMSG: the message is malformed, or holds more than _maxfds_ sockets (they are
+ *             closed).
+ *  - see recvmsg(2)
+ */
+ssize_t handoff_recv(int sock, int *fds, size_t maxfds) {
+   union {
+      char buf[CMSG_SPACE(HANDOFF_MAXFDS * sizeof(int))];
+      struct cmsghdr align;
+   } ctl;
+   struct msghdr mh = {0};
+   struct cmsghdr *cmsg;
+   struct iovec iov;
+   unsigned char cnt;
+   ssize_t nread;
+   size_t nfds;
+   int *rfds;
+
+   iov.iov_base = &cnt;
+   iov.iov_len = sizeof(cnt);
+   mh.msg_iov = &iov;
+   mh.msg_iovlen = 1;
+   mh.msg_control = ctl.buf;
+   mh.msg_controllen = sizeof(ctl.buf);
+   if ((nread = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) < 0) {
+      return -1;
+   }
+
+   nfds = 0;
+   rfds = NULL;
+   if ((cmsg = CMSG_FIRSTHDR(&mh)) && cmsg->cmsg_level == SOL_SOCKET
+       && cmsg->cmsg_type == SCM_RIGHTS) {
+      rfds = (int *) CMSG_DATA(cmsg);
+      nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+   }
+   if (nread == 0 || nfds == 0 || nfds != cnt || nfds > maxfds
+       || (mh.msg_flags & MSG_CTRUNC)) {
+      for (size_t i = 0; i < nfds; ++i) {
+         close(rfds[i]);
+      }
+      errno = EBADMSG;
+      return -1;
+   }
+   memcpy(fds, rfds, nfds * sizeof(int));
+
+   return nfds;
+}
+
+/* handoff_ready()
+ * DESC: tells the process at the other end of handoff socket _sock_ that this process is
+ *       serving on the listening sockets it handed off, so it may stop accepting.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see send(2)
+ */
+int handoff_ready(int sock) {
+   char c = HANDOFF_READY;
+
+   return (send(sock, &c, 1, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
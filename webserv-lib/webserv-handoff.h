@@ -0,0 +1,23 @@
+#ifndef __WEBSERV_HANDOFF_H
+#define __WEBSERV_HANDOFF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* defines */
+#define HANDOFF_ENV     "WEBSERV_HANDOFF_FD" // environment variable set in the new process to
+                                             // the handoff socket it inherits
+#define HANDOFF_FD      3    // handoff socket's descriptor in the new process
+#define HANDOFF_MAXFDS  16   // max number of listening sockets handed off
+#define HANDOFF_READY   'R'  // byte the new process sends once it is serving
+#define HANDOFF_TIMEOUT 60   // seconds the new process has to become ready (incl. warmup)
+
+/* prototypes */
+pid_t handoff_spawn(char *const argv[], int *sockp);
+int handoff_send(int sock, const int *fds, size_t nfds);
+int handoff_wait(int sock, int timeout);
+int handoff_inherited(void);
+ssize_t handoff_recv(int sock, int *fds, size_t maxfds);
+int handoff_ready(int sock);
+
+#endif
@@ -0,0 +1,36 @@
+#include <string.h>
+#include <strings.h>
+#include "webserv-hdr.h"
+#include "webserv-hdrhash.h"
+
+static const char *hm_hdr_names[HM_HID_COUNT] = {
+#define HM_HDR_DEF(id, name) name,
+#include "webserv-hdrs.def"
+#undef HM_HDR_DEF
+};
+
+/* hm_hdr_lookup()
+ * DESC: maps header name _key_ of length _len_ (need not be '\0'-terminated) to its
+ *       well-known header ID, ignoring case.
+ * RETV: returns the header's ID (HM_HID_*) if well-known, HM_HID_NONE otherwise.
+ * NOTE: costs one hash and at most one compare (see webserv-hdrhash.h).
+ */
+int hm_hdr_lookup(const char *key, size_t len) {
+   int id;
+   const char *name;
+
+   id = hm_hdrhash_tab[hm_hdr_hash(key, len, HM_HDRHASH_SEED) % HM_HDRHASH_SIZE];
+   if (id == HM_HID_NONE) {
+      return HM_HID_NONE;
+   }
+   name = hm_hdr_names[id];
+   if (strncasecmp(name, key, len) || name[len] != '\0') {
+      return HM_HID_NONE;
+   }
+   return id;
+}
+
+/* hm_hdr_name(): returns the canonical name of well-known header _id_. */
+const char *hm_hdr_name(httpmsg_hdrid_t id) {
+   return (id >= 0 && id < HM_HID_COUNT) ? hm_hdr_names[id] : NULL;
+}
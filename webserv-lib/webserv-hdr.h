@@ -0,0 +1,36 @@
+#ifndef __WEBSERV_HDR_H
+#define __WEBSERV_HDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* well-known request header IDs (HM_HID_*) */
+typedef enum {
+#define HM_HDR_DEF(id, name) HM_HID_##id,
+#include "webserv-hdrs.def"
+#undef HM_HDR_DEF
+   HM_HID_COUNT // number of well-known headers
+} httpmsg_hdrid_t;
+
+#define HM_HID_NONE (-1)
+
+/* hm_hdr_hash()
+ * DESC: case-insensitive FNV-1a hash of the header name _key_ of length _len_, salted with
+ *       _seed_. Shared by the library and the build-time generator (webserv-hdrgen.c).
+ * NOTE: lowercases by setting bit 0x20, which is exact for letters and leaves '-' and
+ *       digits unchanged; other collisions are caught by the final compare.
+ */
+static inline uint32_t hm_hdr_hash(const char *key, size_t len, uint32_t seed) {
+   uint32_t h = 2166136261u ^ seed;
+   for (size_t i = 0; i < len; ++i) {
+      h ^= (unsigned char) (key[i] | 0x20);
+      h *= 16777619u;
+   }
+   return h;
+}
+
+/* prototypes */
+int hm_hdr_lookup(const char *key, size_t len);
+const char *hm_hdr_name(httpmsg_hdrid_t id);
+
+#endif
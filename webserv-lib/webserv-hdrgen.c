@@ -0,0 +1,72 @@
+/* webserv-hdrgen
+ * DESC: build-time generator for the perfect hash of well-known request headers
+ *       (webserv-hdrs.def). Searches for the smallest table size & seed for which
+ *       hm_hdr_hash() is collision-free over all names and prints the resulting
+ *       table as a C header (webserv-hdrhash.h) to stdout.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "webserv-hdr.h"
+
+#define HDRGEN_MAXSEED 0x10000
+
+static const char *hdrgen_names[] = {
+#define HM_HDR_DEF(id, name) name,
+#include "webserv-hdrs.def"
+#undef HM_HDR_DEF
+};
+
+/* hdrgen_try()
+ * DESC: tries to place all header names into a table of size _size_ using seed _seed_.
+ * RETV: returns 1 if there were no collisions (in which case _tab_ is filled out), 0 otherwise.
+ */
+int hdrgen_try(uint32_t size, uint32_t seed, int *tab) {
+   for (uint32_t i = 0; i < size; ++i) {
+      tab[i] = HM_HID_NONE;
+   }
+   for (int id = 0; id < HM_HID_COUNT; ++id) {
+      const char *name = hdrgen_names[id];
+      uint32_t slot = hm_hdr_hash(name, strlen(name), seed) % size;
+      if (tab[slot] != HM_HID_NONE) {
+         return 0;
+      }
+      tab[slot] = id;
+   }
+   return 1;
+}
+
+int main(int argc, char *argv[]) {
+   uint32_t size, seed;
+   int *tab;
+
+   if ((tab = calloc(HM_HID_COUNT * 8, sizeof(*tab))) == NULL) {
+      perror("calloc");
+      exit(1);
+   }
+   
+   /* find smallest collision-free table */
+   for (size = HM_HID_COUNT; size <= HM_HID_COUNT * 8; ++size) {
+      for (seed = 0; seed < HDRGEN_MAXSEED; ++seed) {
+         if (hdrgen_try(size, seed, tab)) {
+            goto found;
+         }
+      }
+   }
+   fprintf(stderr, "%s: no perfect hash found\n", argv[0]);
+   exit(2);
+
+ found:
+   printf("/* GENERATED by webserv-hdrgen from webserv-hdrs.def -- do not edit. */\n");
+   printf("#ifndef __WEBSERV_HDRHASH_H\n#define __WEBSERV_HDRHASH_H\n\n");
+   printf("#define HM_HDRHASH_SIZE %uu\n", size);
+   printf("#define HM_HDRHASH_SEED %uu\n\n", seed);
+   printf("static const signed char hm_hdrhash_tab[HM_HDRHASH_SIZE] = {");
+   for (uint32_t i = 0; i < size; ++i) {
+      printf("%s%d,", (i % 16) ? " " : "\n   ", tab[i]);
+   }
+   printf("\n};\n\n#endif\n");
+
+   free(tab);
+   return 0;
+}
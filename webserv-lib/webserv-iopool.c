@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "webserv-iopool.h"
+
+void *iopool_loop(iopool_thd_t *thd);
+void iopool_stop(iopool_t *pool);
+
+/* iopool_init()
+ * DESC: initializes I/O pool _pool_ and starts its _nthds_ threads (with all signals
+ *       blocked), whose contexts are for a server named _servname_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _nthds_ is 0.
+ *  - see eventfd(2), malloc(3), webserv_ctx_init(), pthread_create(3)
+ */
+int iopool_init(size_t nthds, const char *servname, iopool_t *pool) {
+   sigset_t sigset, sigset_old;
+   int err;
+
+   memset(pool, 0, sizeof(*pool));
+   pool->queue_end = &pool->queue;
+   pool->evfd = -1;
+   if (nthds == 0) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   if ((pool->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+       || (pool->thds = calloc(nthds, sizeof(*pool->thds))) == NULL) {
+      goto cleanup;
+   }
+   if ((err = pthread_mutex_init(&pool->lock, NULL))) {
+      errno = err;
+      goto cleanup;
+   }
+   if ((err = pthread_cond_init(&pool->cond, NULL))) {
+      pthread_mutex_destroy(&pool->lock);
+      errno = err;
+      goto cleanup;
+   }
+
+   /* start threads (signals are for the event loop) */
+   sigfillset(&sigset);
+   pthread_sigmask(SIG_SETMASK, &sigset, &sigset_old);
+   for (; pool->nthds < nthds; ++pool->nthds) {
+      iopool_thd_t *thd = &pool->thds[pool->nthds];
+
+      thd->pool = pool;
+      if (webserv_ctx_init(servname, &thd->ctx) < 0) {
+         break;
+      }
+      if ((err = pthread_create(&thd->thd, NULL, (void *(*)(void *)) iopool_loop, thd))) {
+         errno = err;
+         break;
+      }
+   }
+   pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+   if (pool->nthds < nthds) {
+      err = errno;
+      iopool_stop(pool);
+      pthread_cond_destroy(&pool->cond);
+      pthread_mutex_destroy(&pool->lock);
+      errno = err;
+      goto cleanup;
+   }
+
+   return 0;
+
+ cleanup:
+   err = errno;
+   if (pool->evfd >= 0) {
+      close(pool->evfd);
+   }
+   free(pool->thds);
+   errno = err;
+   return -1;
+}
+
+/* iopool_loop()
+ * DESC: runs the jobs queued in the pool of I/O thread _thd_ until the pool is stopping and
+ *       no jobs are left.
+ * RETV: NULL.
+ */
+void *iopool_loop(iopool_thd_t *thd) {
+   iopool_t *pool;
+   iopool_job_t *job;
+   uint64_t one = 1;
+
+   pool = thd->pool;
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (pool->queue == NULL && !pool->stopping) {
+         pthread_cond_wait(&pool->cond, &pool->lock);
+      }
+      if ((job = pool->queue) == NULL) {
+         break; // stopping
+      }
+      if ((pool->queue = job->next) == NULL) {
+         pool->queue_end = &pool->queue;
+      }
+      pthread_mutex_unlock(&pool->lock);
+
+      job->run(job, &thd->ctx);
+
+      /* hand back completed job */
+      pthread_mutex_lock(&pool->lock);
+      job->next = pool->done;
+      pool->done = job;
+      if (write(pool->evfd, &one, sizeof(one)) < 0) {
+         /* (counter can't overflow: it is reset by every iopool_reap()) */
+      }
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+}
+
+/* iopool_submit()
+ * DESC: queues job _job_ to be run by a thread of I/O pool _pool_. Once it has run, it is
+ *       returned by iopool_reap().
+ */
+void iopool_submit(iopool_job_t *job, iopool_t *pool) {
+   job->next = NULL;
+   pthread_mutex_lock(&pool->lock);
+   *pool->queue_end = job;
+   pool->queue_end = &job->next;
+   pthread_cond_signal(&pool->cond);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/* iopool_reap()
+ * DESC: takes the jobs that have been run by I/O pool _pool_ (call whenever _pool_'s
+ *       eventfd is readable).
+ * RETV: list of jobs (linked by their _next_ member), or NULL if none.
+ */
+iopool_job_t *iopool_reap(iopool_t *pool) {
+   iopool_job_t *jobs;
+   uint64_t cnt;
+
+   if (read(pool->evfd, &cnt, sizeof(cnt)) < 0) {
+      /* EAGAIN: nothing to reap (yet) */
+   }
+   pthread_mutex_lock(&pool->lock);
+   jobs = pool->done;
+   pool->done = NULL;
+   pthread_mutex_unlock(&pool->lock);
+
+   return jobs;
+}
+
+/* iopool_stop()
+ * DESC: lets the threads of I/O pool _pool_ finish the queued jobs and joins them.
+ */
+void iopool_stop(iopool_t *pool) {
+   pthread_mutex_lock(&pool->lock);
+   pool->stopping = 1;
+   pthread_cond_broadcast(&pool->cond);
+   pthread_mutex_unlock(&pool->lock);
+   for (size_t i = 0; i < pool->nthds; ++i) {
+      pthread_join(pool->thds[i].thd, NULL);
+   }
+}
+
+/* iopool_stats()
+ * DESC: adds the statistics of I/O pool _pool_'s threads so far to _stats_ (while they
+ *       keep running; see webserv_stats_add()).
+ */
+void iopool_stats(const iopool_t *pool, webserv_stats_t *stats) {
+   for (size_t i = 0; i < pool->nthds; ++i) {
+      webserv_stats_add(&pool->thds[i].ctx.stats, stats);
+   }
+}
+
+/* iopool_delete()
+ * DESC: stops I/O pool _pool_ once its queued jobs have run, adds the statistics of its
+ *       threads to _stats_ (unless NULL) and frees it.
+ * NOTE: jobs that have run but have not been reaped are left to the caller.
+ */
+void iopool_delete(webserv_stats_t *stats, iopool_t *pool) {
+   iopool_stop(pool);
+   for (size_t i = 0; stats && i < pool->nthds; ++i) {
+      webserv_stats_add(&pool->thds[i].ctx.stats, stats);
+   }
+
+   close(pool->evfd);
+   pthread_cond_destroy(&pool->cond);
+   pthread_mutex_destroy(&pool->lock);
+   free(pool->thds);
+   memset(pool, 0, sizeof(*pool));
+   pool->evfd = -1;
+}
@@ -0,0 +1,44 @@
+#ifndef __WEBSERV_IOPOOL_H
+#define __WEBSERV_IOPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "webserv-ctx.h"
+
+/* types */
+/* job run by an I/O pool thread (embed in the caller's own record, which must stay valid
+ * until the job has been reaped) */
+typedef struct iopool_job {
+   struct iopool_job *next;
+   void (*run)(struct iopool_job *job, webserv_ctx_t *ctx); // runs with the thread's context
+} iopool_job_t;
+
+/* I/O pool thread */
+typedef struct {
+   pthread_t thd;
+   webserv_ctx_t ctx;        // thread's context (statistics are summed when pool is deleted)
+   struct iopool *pool;
+} iopool_thd_t;
+
+/* pool of threads that run jobs that may block on the disk (file lookups, reads) off an
+ * event loop. Completed jobs are handed back through an eventfd the loop can poll(2). */
+typedef struct iopool {
+   iopool_thd_t *thds;
+   size_t nthds;
+   iopool_job_t *queue;      // jobs waiting to be run (FIFO)
+   iopool_job_t **queue_end;
+   iopool_job_t *done;       // jobs run, waiting to be reaped
+   int evfd;                 // readable while there are jobs to reap
+   int stopping;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;      // signaled when a job is queued (or pool is stopping)
+} iopool_t;
+
+/* prototypes */
+int iopool_init(size_t nthds, const char *servname, iopool_t *pool);
+void iopool_submit(iopool_job_t *job, iopool_t *pool);
+iopool_job_t *iopool_reap(iopool_t *pool);
+void iopool_stats(const iopool_t *pool, webserv_stats_t *stats);
+void iopool_delete(webserv_stats_t *stats, iopool_t *pool);
+
+#endif
@@ -3,6 +3,18 @@
 
 #include "webserv-msg.h"
 #include "webserv-req.h"
+#include "webserv-body.h"
+#include "webserv-meta.h"
+#include "webserv-mem.h"
+#include "webserv-codel.h"
+#include "webserv-ratelim.h"
+#include "webserv-handoff.h"
+#include "webserv-affinity.h"
+#include "webserv-ctx.h"
+#include "webserv-rcu.h"
+#include "webserv-iopool.h"
+#include "webserv-warm.h"
+#include "webserv-pack.h"
 #include "webserv-res.h"
 #include "webserv-util.h"
 #include "webserv-serv.h"
@@ -0,0 +1,63 @@
+#include <stdatomic.h>
+#include "webserv-mem.h"
+
+mem_budget_t mem_budget; // no limits until mem_set_limits() is called
+
+/* mem_set_limits()
+ * DESC: sets the soft & hard limits of the memory budget (0 for none). Call before any
+ *       other threads are started.
+ * NOTE: a hard limit below the soft limit makes the soft limit moot.
+ */
+void mem_set_limits(size_t soft, size_t hard) {
+   mem_budget.soft = soft;
+   mem_budget.hard = hard;
+}
+
+/* mem_charge()
+ * DESC: accounts _size_ bytes just allocated against the memory budget.
+ * NOTE: never fails -- allocations in progress are not interrupted; it's up to the callers
+ *       of mem_level() to shed load.
+ */
+void mem_charge(size_t size) {
+   size_t used, peak;
+
+   used = atomic_fetch_add_explicit(&mem_budget.used, size, memory_order_relaxed) + size;
+   peak = atomic_load_explicit(&mem_budget.peak, memory_order_relaxed);
+   while (used > peak
+          && !atomic_compare_exchange_weak_explicit(&mem_budget.peak, &peak, used,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed)) {}
+}
+
+/* mem_uncharge()
+ * DESC: returns _size_ bytes (charged with mem_charge()) that were just freed to the
+ *       memory budget.
+ */
+void mem_uncharge(size_t size) {
+   atomic_fetch_sub_explicit(&mem_budget.used, size, memory_order_relaxed);
+}
+
+/* mem_used(): returns the number of bytes currently charged to the memory budget. */
+size_t mem_used(void) {
+   return atomic_load_explicit(&mem_budget.used, memory_order_relaxed);
+}
+
+/* mem_peak(): returns the highest number of bytes ever charged to the memory budget. */
+size_t mem_peak(void) {
+   return atomic_load_explicit(&mem_budget.peak, memory_order_relaxed);
+}
+
+/* mem_level()
+ * DESC: returns the current memory pressure (see mem_level_t).
+ */
+mem_level_t mem_level(void) {
+   size_t used;
+
+   used = mem_used();
+   if (mem_budget.hard && used >= mem_budget.hard) {
+      return MEM_HARD;
+   } else if (mem_budget.soft && used >= mem_budget.soft) {
+      return MEM_SOFT;
+   }
+   return MEM_OK;
+}
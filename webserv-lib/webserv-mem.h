@@ -0,0 +1,35 @@
+#ifndef __WEBSERV_MEM_H
+#define __WEBSERV_MEM_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* types */
+/* memory pressure, relative to the limits of the memory budget */
+typedef enum {
+   MEM_OK = 0, // below the soft limit
+   MEM_SOFT,   // past the soft limit: caches shrink
+   MEM_HARD    // past the hard limit: new connections are turned away
+} mem_level_t;
+
+/* process-wide memory budget: bytes of request/response buffers, buffer pool slabs,
+ * caches & connection state currently allocated, and the limits they are held to */
+typedef struct {
+   atomic_size_t used;
+   atomic_size_t peak;  // highest _used_ seen
+   size_t soft;         // soft limit (0 for none)
+   size_t hard;         // hard limit (0 for none)
+} mem_budget_t;
+
+/* globals */
+extern mem_budget_t mem_budget;
+
+/* prototypes */
+void mem_set_limits(size_t soft, size_t hard);
+void mem_charge(size_t size);
+void mem_uncharge(size_t size);
+size_t mem_used(void);
+size_t mem_peak(void);
+mem_level_t mem_level(void);
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "webserv-mem.h"
+#include "webserv-meta.h"
+
+/* metacache_init()
+ * DESC: initializes empty document metadata cache _cache_ whose entries are trusted for
+ *       _ttl_ seconds.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see malloc(3), pthread_mutex_init(3)
+ */
+int metacache_init(time_t ttl, metacache_t *cache) {
+   int err;
+
+   cache->ttl = ttl;
+   cache->nents = METACACHE_SIZE;
+   if ((cache->ents = calloc(cache->nents, sizeof(*cache->ents))) == NULL) {
+      return -1;
+   }
+   if ((err = pthread_mutex_init(&cache->lock, NULL))) {
+      free(cache->ents);
+      errno = err;
+      return -1;
+   }
+   mem_charge(cache->nents * sizeof(*cache->ents));
+
+   return 0;
+}
+
+/* metacache_hash()
+ * DESC: FNV-1a hash of string _key_.
+ */
+uint32_t metacache_hash(const char *key) {
+   uint32_t hash;
+
+   for (hash = 2166136261u; *key; ++key) {
+      hash = (hash ^ (unsigned char) *key) * 16777619u;
+   }
+   return hash;
+}
+
+/* metacache_get()
+ * DESC: looks up the metadata cached for _key_. Stale metadata is returned too, so that
+ *       the caller can revalidate it by the document's modification time (as for entries
+ *       put ahead of time by warmup, which are usually stale by the first request).
+ * ARGS:
+ *  - key: cache key (request URI).
+ *  - now: current time.
+ *  - info: where to copy the cached metadata to.
+ *  - cache: cache to look in.
+ * RETV: METACACHE_FRESH or METACACHE_STALE if metadata was found (copied to _info_),
+ *       METACACHE_MISS otherwise.
+ */
+int metacache_get(const char *key, time_t now, metacache_info_t *info, metacache_t *cache) {
+   metacache_ent_t *ent;
+   uint32_t hash;
+   int found;
+
+   hash = metacache_hash(key);
+
+   pthread_mutex_lock(&cache->lock);
+   ent = &cache->ents[hash & (cache->nents - 1)];
+   found = METACACHE_MISS;
+   if (ent->expires && ent->hash == hash && strcmp(ent->key, key) == 0) {
+      found = (ent->expires > now) ? METACACHE_FRESH : METACACHE_STALE;
+      *info = ent->info;
+   }
+   pthread_mutex_unlock(&cache->lock);
+
+   return found;
+}
+
+/* metacache_put()
+ * DESC: caches metadata _info_ for _key_ as of time _now_, evicting whatever entry
+ *       _key_ maps to.
+ * NOTE: keys of METACACHE_KEYMAX bytes or more are not cached.
+ */
+void metacache_put(const char *key, time_t now, const metacache_info_t *info,
+                   metacache_t *cache) {
+   metacache_ent_t *ent;
+   uint32_t hash;
+   size_t keylen;
+
+   if ((keylen = strlen(key)) >= METACACHE_KEYMAX) {
+      return;
+   }
+   hash = metacache_hash(key);
+
+   pthread_mutex_lock(&cache->lock);
+   ent = &cache->ents[hash & (cache->nents - 1)];
+   ent->hash = hash;
+   ent->expires = now + cache->ttl;
+   memcpy(ent->key, key, keylen + 1);
+   ent->info = *info;
+   pthread_mutex_unlock(&cache->lock);
+}
+
+/* metacache_remove()
+ * DESC: invalidates the metadata cached for _key_ (e.g. after the document was changed).
+ */
+void metacache_remove(const char *key, metacache_t *cache) {
+   metacache_ent_t *ent;
+   uint32_t hash;
+
+   hash = metacache_hash(key);
+
+   pthread_mutex_lock(&cache->lock);
+   ent = &cache->ents[hash & (cache->nents - 1)];
+   if (ent->hash == hash && strcmp(ent->key, key) == 0) {
+      ent->expires = 0;
+   }
+   pthread_mutex_unlock(&cache->lock);
+}
+
+/* metacache_clear()
+ * DESC: invalidates all entries of cache _cache_ (e.g. after the content types changed).
+ */
+void metacache_clear(metacache_t *cache) {
+   pthread_mutex_lock(&cache->lock);
+   for (size_t i = 0; i < cache->nents; ++i) {
+      cache->ents[i].expires = 0;
+   }
+   pthread_mutex_unlock(&cache->lock);
+}
+
+/* metacache_resize()
+ * DESC: resizes cache _cache_ to _nents_ entries, dropping all cached metadata (e.g. to
+ *       shrink it under memory pressure; see mem_level()). Does nothing if it already has
+ *       _nents_ entries.
+ * RETV: 0 on success, -1 on error (the cache is left as is).
+ * ERRS:
+ *  - EINVAL: _nents_ is not a power of 2.
+ *  - see malloc(3)
+ */
+int metacache_resize(size_t nents, metacache_t *cache) {
+   metacache_ent_t *ents, *old_ents;
+   size_t old_nents;
+
+   if (nents == 0 || (nents & (nents - 1))) {
+      errno = EINVAL;
+      return -1;
+   }
+   if (nents == cache->nents) {
+      return 0;
+   }
+   if ((ents = calloc(nents, sizeof(*ents))) == NULL) {
+      return -1;
+   }
+   mem_charge(nents * sizeof(*ents));
+
+   pthread_mutex_lock(&cache->lock);
+   old_ents = cache->ents;
+   old_nents = cache->nents;
+   cache->ents = ents;
+   cache->nents = nents;
+   pthread_mutex_unlock(&cache->lock);
+
+   free(old_ents);
+   mem_uncharge(old_nents * sizeof(*old_ents));
+   return 0;
+}
+
+/* metacache_delete()
+ * DESC: frees cache _cache_.
+ */
+void metacache_delete(metacache_t *cache) {
+   mem_uncharge(cache->nents * sizeof(*cache->ents));
+   free(cache->ents);
+   cache->ents = NULL;
+   pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef __WEBSERV_META_H
+#define __WEBSERV_META_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "webserv-util.h"
+
+/* defines */
+#define METACACHE_SIZE   256 // number of entries (power of 2)
+#define METACACHE_MINSIZE 16 // number of entries under memory pressure (power of 2)
+#define METACACHE_KEYMAX 256 // longest key (request URI) that is cached, including '\0'
+#define METACACHE_TTL    1   // default seconds an entry is trusted before the file is re-stat()ed
+
+/* metacache_get() results */
+#define METACACHE_MISS   0   // nothing cached
+#define METACACHE_FRESH  1   // metadata cached less than the TTL ago
+#define METACACHE_STALE  2   // metadata cached longer ago (to revalidate; see mtime)
+
+/* types */
+/* cached result of looking up a document (everything needed to answer HEAD) */
+typedef struct {
+   int code;                    // response status code (C_OK, C_NOTFOUND, C_FORBIDDEN)
+   off_t size;                  // file size (only if code is C_OK)
+   const char *type;            // content type, owned by the site's type table (ditto)
+   char last_mod[HM_DATE_LEN];  // formatted modification time (ditto)
+   struct timespec mtime;       // modification time (ditto), to revalidate a stale entry by
+} metacache_info_t;
+
+typedef struct {
+   uint32_t hash;
+   time_t expires;              // entry is stale at or after this time (0 if empty)
+   char key[METACACHE_KEYMAX];
+   metacache_info_t info;
+} metacache_ent_t;
+
+/* direct-mapped document metadata cache (shared by all connections) */
+typedef struct {
+   metacache_ent_t *ents;
+   size_t nents;                // number of entries (power of 2; see metacache_resize())
+   time_t ttl;
+   pthread_mutex_t lock;
+} metacache_t;
+
+/* prototypes */
+int metacache_init(time_t ttl, metacache_t *cache);
+int metacache_get(const char *key, time_t now, metacache_info_t *info, metacache_t *cache);
+void metacache_put(const char *key, time_t now, const metacache_info_t *info,
+                   metacache_t *cache);
+void metacache_remove(const char *key, metacache_t *cache);
+void metacache_clear(metacache_t *cache);
+int metacache_resize(size_t nents, metacache_t *cache);
+void metacache_delete(metacache_t *cache);
+
+#endif
@@ -12,6 +12,7 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
+#include <strings.h>
 #include "webserv-util.h"
 #include "webserv-dbg.h"
 #include "webserv-msg.h"
@@ -35,6 +36,17 @@ void message_init(httpmsg_t *msg) {
 }
 
 
+/* message_set_pool()
+ * DESC: sets the pool that _msg_'s text buffer and arena chunks are borrowed from.
+ * NOTE: a message's pool may be set after its arena has been used, but must not be changed
+ *       once set.
+ */
+void message_set_pool(bufpool_t *pool, httpmsg_t *msg) {
+   msg->hm_pool = pool;
+   msg->hm_arena.pool = pool;
+}
+
+
 /* message_delete()
  * DESC: deletes _msg_'s members shared by both requests and responses.
  * NOTE: calls to message_init() and ONLY calls to message_init() should
@@ -43,23 +55,19 @@ void message_init(httpmsg_t *msg) {
  */
 void message_delete(httpmsg_t *msg) {
    if (msg) {
-      /* free header members */
-      if (msg->hm_headers) {
-         for (httpmsg_header_t *hdr_it = msg->hm_headers;
-              hdr_it < msg->hm_headers_endp; ++hdr_it) {
-            free(hdr_it->key);
-            free(hdr_it->value);
-         }
+      /* return text to its pool */
+      if (msg->hm_text_pooled) {
+         bufpool_put(msg->hm_text, msg->hm_text_size, msg->hm_pool);
       }
-      
-      /* free headers array */
-      free(msg->hm_headers);
 
-      /* free body */
-      free(msg->hm_body);
+      /* release body referenced in place */
+      if (msg->hm_body_unref) {
+         msg->hm_body_unref(msg->hm_body_ref);
+         msg->hm_body_unref = NULL;
+      }
 
-      /* free text */
-      free(msg->hm_text);
+      /* free headers, body, and (unpooled) text at once */
+      arena_delete(&msg->hm_arena);
    }
 }
 
@@ -71,25 +79,28 @@ void message_delete(httpmsg_t *msg) {
  *  - new_nheaders: new length of header array.
  *  - msg: pointer to HTTP message (request or response).
  * RETV: returns 0 on success, -1 on error.
+ * NOTE: the header array is allocated from _msg_'s arena.
  */
 int message_resize_headers(size_t new_nheaders, httpmsg_t *msg) {
    httpmsg_header_t *newheaders;
-   size_t endp_index;
+   size_t endp_index, oldsize;
 
    /* calculate index of end pointer */
    endp_index = msg->hm_headers_endp - msg->hm_headers;
    
    /* reallocate headers array */
-   newheaders = realloc(msg->hm_headers, (new_nheaders+1) * sizeof(httpmsg_header_t));
+   oldsize = msg->hm_headers ? (msg->hm_nheaders+1) * sizeof(httpmsg_header_t) : 0;
+   newheaders = arena_realloc(msg->hm_headers, oldsize, (new_nheaders+1) * sizeof(httpmsg_header_t),
+                              &msg->hm_arena);
    if (newheaders == NULL) {
       return -1;
    }
    msg->hm_headers = newheaders;
    
    /* zero out uninitialized memory */
-   if (new_nheaders > msg->hm_nheaders) {
-      memset(newheaders + msg->hm_nheaders + 1, 0,
-             sizeof(httpmsg_header_t) * (new_nheaders - msg->hm_nheaders));
+   if (new_nheaders > msg->hm_nheaders || oldsize == 0) {
+      size_t zero_from = oldsize ? msg->hm_nheaders + 1 : 0;
+      memset(newheaders + zero_from, 0, sizeof(httpmsg_header_t) * (new_nheaders + 1 - zero_from));
    } else {
       /* zero out last element */
       memset(newheaders + new_nheaders, 0, sizeof(httpmsg_header_t));
@@ -101,7 +112,7 @@ int message_resize_headers(size_t new_nheaders, httpmsg_t *msg) {
 }
 
 /* message_resize_body()
- * DESC: resize the body of _msg_.
+ * DESC: resize the body of _msg_ (allocated from _msg_'s arena).
  * ARGS:
  *  - newsize: new size of body.
  *  - msg: HTTP message (req. or res.) whose body should be resized.
@@ -110,13 +121,13 @@ int message_resize_headers(size_t new_nheaders, httpmsg_t *msg) {
 int message_resize_body(size_t newsize, httpmsg_t *msg) {
    char *newbody;
 
-   /* reallocate text buffer */
-   newbody = realloc(msg->hm_body, newsize);
+   /* reallocate body buffer */
+   newbody = arena_realloc(msg->hm_body, msg->hm_body_size, newsize, &msg->hm_arena);
    if (newbody == NULL) {
       return -1;
    }
    msg->hm_body_size = newsize;
-   msg->hm_body_ptr += newbody - msg->hm_body;
+   msg->hm_body_ptr = newbody + (msg->hm_body_ptr - msg->hm_body);
    msg->hm_body = newbody;
 
    return 0;
@@ -127,18 +138,57 @@ int message_resize_text(size_t newsize, httpmsg_t *msg) {
    char *newtext;
 
    /* reallocate text buffer */
-   newtext = realloc(msg->hm_text, newsize);
+   if (msg->hm_text_pooled) {
+      errno = EINVAL; // use message_borrow_text()
+      return -1;
+   }
+   newtext = arena_realloc(msg->hm_text, msg->hm_text_size, newsize, &msg->hm_arena);
    if (newtext == NULL) {
       return -1;
    }
    msg->hm_text_size = newsize;
-   msg->hm_text_ptr += newtext - msg->hm_text;
+   msg->hm_text_ptr = newtext + (msg->hm_text_ptr - msg->hm_text);
    msg->hm_text = newtext;
    
    return 0;
 }
 
+/* message_borrow_text()
+ * DESC: replaces _msg_'s text buffer with one of at least _minsize_ bytes borrowed from
+ *       pool _pool_, copying over the text received so far.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EMSGSIZE: _minsize_ exceeds the pool's maximum buffer size.
+ *  - see bufpool_get()
+ * NOTE: if _msg_ has no pool yet, _pool_ becomes its pool (see message_set_pool());
+ *       otherwise, _pool_ must be _msg_'s pool.
+ */
+int message_borrow_text(size_t minsize, bufpool_t *pool, httpmsg_t *msg) {
+   char *newtext;
+   size_t newsize, used;
+
+   if (msg->hm_pool == NULL) {
+      message_set_pool(pool, msg);
+   }
+   
+   if ((newtext = bufpool_get(minsize, &newsize, pool)) == NULL) {
+      return -1;
+   }
+
+   used = msg->hm_text_ptr - msg->hm_text;
+   if (msg->hm_text) {
+      memcpy(newtext, msg->hm_text, used);
+      if (msg->hm_text_pooled) {
+         bufpool_put(msg->hm_text, msg->hm_text_size, pool);
+      }
+   }
+   msg->hm_text = newtext;
+   msg->hm_text_ptr = newtext + used;
+   msg->hm_text_size = newsize;
+   msg->hm_text_pooled = 1;
 
+   return 0;
+}
 
 /* message_error()
  * DESC: classifes error of [ message_* | request_* | response_* ] function
@@ -148,6 +198,7 @@ int message_resize_text(size_t newsize, httpmsg_t *msg) {
  *  - MSG_ESUCCESS if no error occurred
  *  - MSG_EAGAIN if the operation simply needs to be tried again
  *  - MSG_ECONN if the socket/pipe connection was broken
+ *  - MSG_ECLIENT if the client sent a malformed or oversized request (or body)
  *  - MSG_ESERV if an internal error occurred (indicates bug)
  */
 int message_error(int msg_errno) {
@@ -160,15 +211,40 @@ int message_error(int msg_errno) {
    case EWOULDBLOCK:
 #endif
    case EINTR:
-   case ECONNRESET:
       return MSG_EAGAIN;
 
    case EPIPE:
+   case ECONNRESET:
    case ECONNABORTED:
    case ECONNREFUSED:
       return MSG_ECONN;
 
+   case EBADMSG:
+   case EMSGSIZE:
+   case EFBIG:
+   case ENOSYS:
+      return MSG_ECLIENT;
+
    default:
       return MSG_ESERV;
    }
 }
+
+
+/* message_slice()
+ * DESC: returns pointer to the text referred to by slice _slice_ of message _msg_.
+ * NOTE: slices filled out by request_parse() are '\0'-terminated.
+ */
+const char *message_slice(const httpmsg_slice_t *slice, const httpmsg_t *msg) {
+   return msg->hm_text + slice->off;
+}
+
+/* message_slice_casecmp()
+ * DESC: compares slice _slice_ of message _msg_ to string _str_, ignoring case
+ *       and without copying the slice (lengths are compared first, so a slice holding a
+ *       '\0' never reads past the end of _str_).
+ * RETV: returns 0 if they are equal, nonzero otherwise.
+ */
+int message_slice_casecmp(const httpmsg_slice_t *slice, const char *str, const httpmsg_t *msg) {
+   return strlen(str) != slice->len || strncasecmp(message_slice(slice, msg), str, slice->len);
+}
@@ -1,12 +1,16 @@
 #ifndef __WEBSERV_MSG_H
 #define __WEBSERV_MSG_H
 
+#include "webserv-hdr.h"
+#include "webserv-pool.h"
+#include "webserv-arena.h"
 
 /* constants */
 enum {
    MSG_ESUCCESS = 0, // no error
    MSG_EAGAIN,   // interrupt/blocking "errors"
    MSG_ECONN,    // connection errors
+   MSG_ECLIENT,  // client sent a bad request (respond with error status)
    MSG_ESERV     // internal server error
 };
 
@@ -15,7 +19,9 @@ enum {
 #define HM_VERSION_PREFIX "HTTP/"
 
 #define HM_TEXT_INIT   0x1000
+#define HM_MAXHDR_DFL  0x2000 // default max request header size (8 KiB)
 #define HM_NHEADERS_INIT 16
+#define HM_REQHDRS_INIT  24 // request headers stored inline (no allocation)
 #define HM_HDRSTR_INIT 0x0800
 
 #define HM_HDR_CONTENTTYPE  "Content-Type"
@@ -24,19 +30,90 @@ enum {
 #define HM_HDR_DATE         "Date"
 #define HM_HDR_SERVER       "Server"
 #define HM_HDR_CONNECTION   "Connection"
+#define HM_HDR_ALLOW        "Allow"
+#define HM_HDR_RETRYAFTER   "Retry-After"
+
+#define HM_CONTINUE "HTTP/" HM_HTTP_VERSION " 100 Continue" HM_ENT_TERM HM_ENT_TERM
+#define HM_CHUNKED  "chunked"
+#define HM_CLOSE     "close"
+#define HM_KEEPALIVE "keep-alive"
+#define HM_BODYBUF_SIZE 0x4000 // size of request body copy buffer (16 KiB)
 
 #define HM_HTTP_VERSION "1.1"
 
 /* types */
 typedef enum {
    M_NONE = 0,
-   M_GET
+   M_GET,
+   M_PUT,
+   M_POST,
+   M_HEAD,
+   M_OPTIONS,
+   M_NMETHODS // number of methods (not a method)
 } httpreq_method_t;
 
+/* request body framing */
+typedef enum {
+   HB_NONE = 0,  // no body (or body not being received)
+   HB_LENGTH,    // Content-Length
+   HB_CHUNKED    // Transfer-Encoding: chunked
+} httpreq_bodytype_t;
+
+/* chunked decoder states */
+typedef enum {
+   HB_CS_SIZE = 0, // chunk size (hex digits)
+   HB_CS_EXT,      // chunk extension (up to end of line)
+   HB_CS_DATA,     // chunk data
+   HB_CS_DATAEND,  // CRLF following chunk data
+   HB_CS_TRAILER,  // start of trailer line
+   HB_CS_TRLINE,   // rest of trailer line
+   HB_CS_DONE
+} httpreq_chunkstate_t;
+
+/* request body reception state (body is streamed to _fd_, not stored in memory) */
+typedef struct {
+   httpreq_bodytype_t type;
+   httpreq_chunkstate_t cstate;
+   int ndigits;      // number of chunk size digits parsed
+   size_t remaining; // bytes left in body (HB_LENGTH) or current chunk (HB_CHUNKED)
+   size_t received;  // decoded body bytes received so far
+   size_t max;       // maximum body size
+   size_t prefix;    // offset in hm_text of body bytes received along w/ the headers
+   int done;         // whether the entire body has been received
+   int fd;           // destination file
+   int pipefd[2];    // pipe for splice(2)ing socket to file ({-1, -1} if not used)
+   char *buf;        // copy/decode buffer (borrowed from message's pool, or NULL)
+   size_t bufsize;
+   int buf_pooled;
+   char *path;       // final path of body file (arena)
+   char *tmppath;    // path body is written to until complete (arena)
+} httpreq_body_t;
+
+/* slice of a message's text buffer (hm_text)
+ * NOTE: the byte following a parsed slice is overwritten with '\0', so
+ *       message_slice() can be used as a C string. */
+typedef struct {
+   size_t off; // offset from start of hm_text
+   size_t len;
+} httpmsg_slice_t;
+
+/* HTTP request header (not allocated -- refers to request text) */
+typedef struct {
+   httpmsg_slice_t key;
+   httpmsg_slice_t value;
+} httpreq_header_t;
+
 typedef struct {
    httpreq_method_t method;
-   char *uri;
-   char *version; // not including leading HTTP/
+   httpmsg_slice_t uri;
+   httpmsg_slice_t version; // not including leading HTTP/
+   httpreq_header_t hdrs[HM_REQHDRS_INIT]; // first HM_REQHDRS_INIT headers
+   httpreq_header_t *hdrs_ext; // overflow headers (hm_arena)
+   size_t hdrs_ext_len;        // allocated length of hdrs_ext
+   size_t nhdrs;               // total number of headers
+   unsigned short hdr_slots[HM_HID_COUNT]; // 1 + index of first header w/ ID, or 0 if absent
+   size_t hdrs_end; // offset in hm_text following the header-terminating empty line
+   httpreq_body_t body;
 } httpreq_line_t;
 
 /* HTTP response statuses */
@@ -69,18 +146,27 @@ typedef struct {
    char *hm_body;
    char *hm_body_ptr;
    size_t hm_body_size;
+   void (*hm_body_unref)(void *ref); // releases hm_body_ref (NULL if body is in hm_arena)
+   void *hm_body_ref;  // holder of body referenced in place (see response_insert_ref())
    char *hm_text; // full message contents (hdrs + body)
    size_t hm_text_size;
    char *hm_text_ptr;
+   int hm_text_pooled; // whether hm_text was borrowed from hm_pool (else from hm_arena)
+   bufpool_t *hm_pool; // pool buffers & arena chunks are borrowed from (NULL to malloc())
+   arena_t hm_arena;   // all other message allocations (freed at once by message_delete())
 } httpmsg_t;
 
 /* prototypes */
 size_t message_textfree(const httpmsg_t *msg);
 void message_init(httpmsg_t *msg);
+void message_set_pool(bufpool_t *pool, httpmsg_t *msg);
 void message_delete(httpmsg_t *msg);
 int message_resize_headers(size_t new_nheaders, httpmsg_t *msg);
 int message_resize_body(size_t newsize, httpmsg_t *msg);
 int message_resize_text(size_t newsize, httpmsg_t *msg);
+int message_borrow_text(size_t minsize, bufpool_t *pool, httpmsg_t *msg);
 int message_error(int msg_errno);
+const char *message_slice(const httpmsg_slice_t *slice, const httpmsg_t *msg);
+int message_slice_casecmp(const httpmsg_slice_t *slice, const char *str, const httpmsg_t *msg);
 
 #endif
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "webserv-util.h"
+#include "webserv-vec.h"
+#include "webserv-pack.h"
+
+/* document being packed (see pack_build()) */
+typedef struct {
+   char *uri;
+   time_t mtime;
+   pack_ent_t ent;
+} pack_doc_t;
+
+/* documents & string pool of archive being built */
+typedef struct {
+   struct {
+      pack_doc_t *arr;
+      size_t cnt;
+      size_t len;
+   } docs;
+   char *strs;
+   size_t strs_len;
+   size_t strs_size;
+} pack_builder_t;
+
+int pack_walk(const char *docroot, const char *uri, pack_builder_t *pb);
+int pack_pool(const char *str, uint32_t *offp, pack_builder_t *pb);
+int pack_copy(const char *docroot, FILE *file, pack_doc_t *doc, pack_builder_t *pb);
+int pack_doc_uricmp(const pack_doc_t *doc1, const pack_doc_t *doc2);
+int pack_doc_cmp(const pack_doc_t *doc1, const pack_doc_t *doc2);
+int pack_doc_del(pack_doc_t *doc);
+
+/* pack_build()
+ * DESC: packs all documents under document root _docroot_ into archive file _path_, which
+ *       pack_open() maps and serves from in place. Each document's content type (from table
+ *       _ftypes_), ETag and Last-Modified date are computed once, here. A document with
+ *       URI X has a precompressed variant if X.gz is a document too.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EAGAIN: a document changed while it was being packed.
+ *  - EFBIG: string pool would exceed 4 GiB.
+ *  - see opendir(3), stat(2), mkstemp(3), fopen(3), fread(3), fwrite(3), rename(2)
+ * NOTE: the archive is written to a temporary file that is then renamed to _path_, so a
+ *       deploy is a single atomic file swap (see server_site_reload_pack()).
+ */
+int pack_build(const char *docroot, const filetype_table_t *ftypes, const char *path) {
+   pack_builder_t pb;
+   pack_hdr_t hdr;
+   FILE *file;
+   char *tmppath;
+   uint32_t empty;
+   int fd, retv, errsav;
+
+   memset(&pb, 0, sizeof(pb));
+   VECTOR_INIT(&pb.docs);
+   retv = -1;
+   file = NULL;
+   fd = -1;
+   tmppath = NULL;
+
+   /* list documents (in URI order) & fill string pool (offset 0 is the empty string) */
+   if (pack_pool("", &empty, &pb) < 0 || pack_walk(docroot, "", &pb) < 0) {
+      goto cleanup;
+   }
+   VECTOR_QSORT(&pb.docs, pack_doc_uricmp);
+   for (size_t i = 0; i < pb.docs.cnt; ++i) {
+      pack_doc_t *doc = &pb.docs.arr[i];
+      char last_mod[HM_DATE_LEN];
+
+      doc->ent.hash = pack_hash(doc->uri);
+      if (hm_fmtdate(&doc->mtime, last_mod) < 0
+          || pack_pool(doc->uri, &doc->ent.uri, &pb) < 0
+          || pack_pool(content_type_get(doc->uri, ftypes), &doc->ent.type, &pb) < 0
+          || pack_pool(last_mod, &doc->ent.last_mod, &pb) < 0
+          || pack_pool("\"0000000000000000\"", &doc->ent.etag, &pb) < 0) { // (see pack_copy())
+         goto cleanup;
+      }
+   }
+
+   /* create temporary file next to _path_ */
+   if (smprintf(&tmppath, "%s" PACK_TMP_SUFFIX, path) < 0) {
+      goto cleanup;
+   }
+   if ((fd = mkstemp(tmppath)) < 0 || fchmod(fd, 0644) < 0
+       || (file = fdopen(fd, "w")) == NULL) {
+      goto cleanup;
+   }
+
+   /* copy contents (after header, entries & string pool) */
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+   hdr.nents = pb.docs.cnt;
+   hdr.strs_len = pb.strs_len;
+   hdr.size = sizeof(hdr) + hdr.nents * sizeof(pack_ent_t) + hdr.strs_len;
+   if (fseeko(file, hdr.size, SEEK_SET) < 0) {
+      goto cleanup;
+   }
+   for (size_t i = 0; i < pb.docs.cnt; ++i) {
+      pb.docs.arr[i].ent.off = hdr.size;
+      if (pack_copy(docroot, file, &pb.docs.arr[i], &pb) < 0) {
+         goto cleanup;
+      }
+      hdr.size += pb.docs.arr[i].ent.size;
+   }
+
+   /* link precompressed variants */
+   for (size_t i = 0; i < pb.docs.cnt; ++i) {
+      pack_doc_t key, *gz;
+
+      if (smprintf(&key.uri, "%s" PACK_GZ_SUFFIX, pb.docs.arr[i].uri) < 0) {
+         goto cleanup;
+      }
+      gz = bsearch(&key, pb.docs.arr, pb.docs.cnt, sizeof(key),
+                   (int (*)(const void *, const void *)) pack_doc_uricmp);
+      free(key.uri);
+      if (gz) {
+         pb.docs.arr[i].ent.gz_off = gz->ent.off;
+         pb.docs.arr[i].ent.gz_size = gz->ent.size;
+         pb.docs.arr[i].ent.gz_etag = gz->ent.etag;
+      }
+   }
+
+   /* write header, entries (in lookup order) & string pool */
+   VECTOR_QSORT(&pb.docs, pack_doc_cmp);
+   if (fseeko(file, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+      goto cleanup;
+   }
+   for (size_t i = 0; i < pb.docs.cnt; ++i) {
+      if (fwrite(&pb.docs.arr[i].ent, sizeof(pack_ent_t), 1, file) != 1) {
+         goto cleanup;
+      }
+   }
+   if (fwrite(pb.strs, 1, pb.strs_len, file) != pb.strs_len) {
+      goto cleanup;
+   }
+
+   retv = 0;
+
+   /* cleanup */
+ cleanup:
+   errsav = errno;
+   if (file) {
+      if (fclose(file) < 0 && retv >= 0) {
+         errsav = errno;
+         retv = -1;
+      }
+   } else if (fd >= 0) {
+      close(fd);
+   }
+   if (retv >= 0 && rename(tmppath, path) < 0) {
+      errsav = errno;
+      retv = -1;
+   }
+   if (retv < 0 && fd >= 0) {
+      unlink(tmppath);
+   }
+   free(tmppath);
+   free(pb.strs);
+   VECTOR_DELETE(&pb.docs, pack_doc_del);
+
+   errno = errsav;
+   return retv;
+}
+
+/* pack_walk()
+ * DESC: adds the documents under the directory with request URI _uri_ ("" for document
+ *       root _docroot_) to the documents of _pb_, recursively. Symbolic links to
+ *       directories aren't followed; anything that isn't a regular file is skipped.
+ * RETV: 0 on success, -1 on error.
+ */
+int pack_walk(const char *docroot, const char *uri, pack_builder_t *pb) {
+   char *path;
+   DIR *dir;
+   struct dirent *ent;
+   struct stat child_stat;
+   pack_doc_t doc;
+   int retv;
+
+   if (smprintf(&path, "%s%s", docroot, uri) < 0) {
+      return -1;
+   }
+   dir = opendir(path);
+   free(path);
+   if (dir == NULL) {
+      return -1;
+   }
+
+   retv = 0;
+   while (retv >= 0 && (errno = 0, ent = readdir(dir)) != NULL) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+         continue;
+      }
+      memset(&doc, 0, sizeof(doc));
+      if (smprintf(&doc.uri, "%s/%s", uri, ent->d_name) < 0
+          || smprintf(&path, "%s%s", docroot, doc.uri) < 0) {
+         free(doc.uri);
+         retv = -1;
+         break;
+      }
+      if (lstat(path, &child_stat) == 0 && S_ISDIR(child_stat.st_mode)) {
+         retv = pack_walk(docroot, doc.uri, pb);
+         free(doc.uri);
+      } else if (stat(path, &child_stat) == 0 && S_ISREG(child_stat.st_mode)) {
+         doc.mtime = child_stat.st_mtim.tv_sec;
+         doc.ent.size = child_stat.st_size;
+         if (VECTOR_INSERT(&doc, &pb->docs) < 0) {
+            free(doc.uri);
+            retv = -1;
+         }
+      } else {
+         free(doc.uri);
+      }
+      free(path);
+   }
+   if (retv >= 0 && ent == NULL && errno) {
+      retv = -1; // readdir(3) error
+   }
+
+   closedir(dir);
+   return retv;
+}
+
+/* pack_pool()
+ * DESC: appends string _str_ to the string pool of _pb_ and returns its offset in _*offp_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EFBIG: string pool would exceed 4 GiB.
+ *  - see realloc(3)
+ */
+int pack_pool(const char *str, uint32_t *offp, pack_builder_t *pb) {
+   size_t len, new_size;
+   char *new_strs;
+
+   len = strlen(str) + 1;
+   if (pb->strs_len + len > UINT32_MAX) {
+      errno = EFBIG;
+      return -1;
+   }
+
+   /* grow pool if necessary */
+   if (pb->strs_len + len > pb->strs_size) {
+      new_size = smax(PACK_STRS_MIN, pb->strs_size * 2);
+      new_size = smax(new_size, pb->strs_len + len);
+      if ((new_strs = realloc(pb->strs, new_size)) == NULL) {
+         return -1;
+      }
+      pb->strs = new_strs;
+      pb->strs_size = new_size;
+   }
+
+   *offp = pb->strs_len;
+   memcpy(pb->strs + pb->strs_len, str, len);
+   pb->strs_len += len;
+
+   return 0;
+}
+
+/* pack_copy()
+ * DESC: copies the contents of document _doc_ (under _docroot_) to archive _file_ (at its
+ *       current position) and fills in the document's ETag (FNV-1a hash of the contents)
+ *       in the string pool of _pb_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EAGAIN: the document's size changed since it was listed.
+ *  - see fopen(3), fread(3), fwrite(3)
+ */
+int pack_copy(const char *docroot, FILE *file, pack_doc_t *doc, pack_builder_t *pb) {
+   FILE *src;
+   char *path, *buf;
+   size_t nread;
+   uint64_t copied, hash;
+   int retv;
+
+   if (smprintf(&path, "%s%s", docroot, doc->uri) < 0) {
+      return -1;
+   }
+   src = fopen(path, "r");
+   free(path);
+   if (src == NULL) {
+      return -1;
+   }
+   if ((buf = malloc(PACK_COPYBUF)) == NULL) {
+      fclose(src);
+      return -1;
+   }
+
+   retv = 0;
+   copied = 0;
+   hash = 14695981039346656037u;
+   while ((nread = fread(buf, 1, PACK_COPYBUF, src)) > 0) {
+      for (size_t i = 0; i < nread; ++i) {
+         hash = (hash ^ (unsigned char) buf[i]) * 1099511628211u;
+      }
+      if (fwrite(buf, 1, nread, file) != nread) {
+         retv = -1;
+         break;
+      }
+      copied += nread;
+   }
+   if (retv >= 0 && ferror(src)) {
+      retv = -1;
+   } else if (retv >= 0 && copied != doc->ent.size) {
+      errno = EAGAIN;
+      retv = -1;
+   }
+   if (retv >= 0) {
+      /* (same length as the placeholder it overwrites) */
+      sprintf(pb->strs + doc->ent.etag, "\"%016" PRIx64 "\"", hash);
+   }
+
+   free(buf);
+   fclose(src);
+   return retv;
+}
+
+/* pack_doc_uricmp(): orders documents by URI (see qsort(3)). */
+int pack_doc_uricmp(const pack_doc_t *doc1, const pack_doc_t *doc2) {
+   return strcmp(doc1->uri, doc2->uri);
+}
+
+/* pack_doc_cmp(): orders documents by hash of URI, then URI (lookup order of entries). */
+int pack_doc_cmp(const pack_doc_t *doc1, const pack_doc_t *doc2) {
+   if (doc1->ent.hash != doc2->ent.hash) {
+      return (doc1->ent.hash > doc2->ent.hash) ? 1 : -1;
+   }
+   return strcmp(doc1->uri, doc2->uri);
+}
+
+/* pack_doc_del(): frees document being packed (see VECTOR_DELETE()). */
+int pack_doc_del(pack_doc_t *doc) {
+   free(doc->uri);
+   return 0;
+}
+
+/* pack_open()
+ * DESC: maps archive file _path_ (see pack_build()) into memory and uses it in place as
+ *       archive _pack_, without any parsing. The caller holds the only reference.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _path_ is not a valid archive.
+ *  - see open(2), mmap(2)
+ * NOTE: _pack_ must have been malloc()ed; pack_unref() frees it.
+ */
+int pack_open(const char *path, pack_t *pack) {
+   struct stat pack_stat;
+   const pack_hdr_t *hdr;
+   const pack_ent_t *ent;
+   size_t ents_len;
+   void *map;
+   int fd, errsav;
+
+   memset(pack, 0, sizeof(*pack));
+   map = MAP_FAILED;
+
+   /* map archive */
+   if ((fd = open(path, O_RDONLY)) < 0) {
+      return -1;
+   }
+   if (fstat(fd, &pack_stat) == 0 && (size_t) pack_stat.st_size >= sizeof(*hdr)) {
+      map = mmap(NULL, pack_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   } else {
+      errno = EINVAL;
+   }
+   errsav = errno;
+   close(fd);
+   if (map == MAP_FAILED) {
+      errno = errsav;
+      return -1;
+   }
+
+   /* validate archive */
+   hdr = map;
+   ents_len = hdr->nents * sizeof(*ent);
+   if (memcmp(hdr->magic, PACK_MAGIC, sizeof(hdr->magic)) != 0
+       || hdr->size != (uint64_t) pack_stat.st_size
+       || hdr->nents > hdr->size / sizeof(*ent)
+       || hdr->strs_len == 0
+       || sizeof(*hdr) + ents_len + hdr->strs_len > hdr->size
+       || ((char *) (hdr + 1))[ents_len + hdr->strs_len - 1] != '\0') {
+      goto invalid;
+   }
+   for (ent = (const pack_ent_t *) (hdr + 1); ent < (const pack_ent_t *) (hdr + 1) + hdr->nents;
+        ++ent) {
+      if (ent->uri >= hdr->strs_len || ent->type >= hdr->strs_len
+          || ent->etag >= hdr->strs_len || ent->last_mod >= hdr->strs_len
+          || ent->gz_etag >= hdr->strs_len
+          || ent->off > hdr->size || ent->size > hdr->size - ent->off
+          || ent->gz_off > hdr->size || ent->gz_size > hdr->size - ent->gz_off) {
+         goto invalid;
+      }
+   }
+
+   /* use archive in place */
+   pack->ents = (const pack_ent_t *) (hdr + 1);
+   pack->nents = hdr->nents;
+   pack->strs = (const char *) (pack->ents + pack->nents);
+   pack->strs_len = hdr->strs_len;
+   pack->map = map;
+   pack->map_len = pack_stat.st_size;
+   atomic_init(&pack->refs, 1);
+
+   return 0;
+
+ invalid:
+   munmap(map, pack_stat.st_size);
+   errno = EINVAL;
+   return -1;
+}
+
+/* pack_hash()
+ * DESC: FNV-1a hash of request URI _uri_.
+ */
+uint32_t pack_hash(const char *uri) {
+   uint32_t hash;
+
+   for (hash = 2166136261u; *uri; ++uri) {
+      hash = (hash ^ (unsigned char) *uri) * 16777619u;
+   }
+   return hash;
+}
+
+/* pack_lookup()
+ * DESC: finds the document with (normalized) request URI _uri_ in archive _pack_ (binary
+ *       search by hash; no system calls).
+ * RETV: the document's entry, or NULL if there is none.
+ */
+const pack_ent_t *pack_lookup(const char *uri, const pack_t *pack) {
+   size_t lo, hi, mid;
+   uint32_t hash;
+
+   /* find first entry with hash */
+   hash = pack_hash(uri);
+   lo = 0;
+   hi = pack->nents;
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (pack->ents[mid].hash < hash) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   for (; lo < pack->nents && pack->ents[lo].hash == hash; ++lo) {
+      if (strcmp(pack->strs + pack->ents[lo].uri, uri) == 0) {
+         return &pack->ents[lo];
+      }
+   }
+   return NULL;
+}
+
+/* pack_ref()
+ * DESC: takes a reference to archive _pack_ (e.g. for a response whose body is in it).
+ */
+void pack_ref(pack_t *pack) {
+   atomic_fetch_add(&pack->refs, 1);
+}
+
+/* pack_unref()
+ * DESC: drops a reference to archive _pack_; the last one unmaps and frees it.
+ */
+void pack_unref(pack_t *pack) {
+   if (atomic_fetch_sub(&pack->refs, 1) == 1) {
+      munmap(pack->map, pack->map_len);
+      free(pack);
+   }
+}
@@ -0,0 +1,60 @@
+#ifndef __WEBSERV_PACK_H
+#define __WEBSERV_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "webserv-contype.h"
+
+/* defines */
+#define PACK_MAGIC      "WSPACK\001" // archive magic (incl. format version)
+#define PACK_TMP_SUFFIX ".XXXXXX"
+#define PACK_GZ_SUFFIX  ".gz"        // suffix of precompressed (gzip) variant of a document
+#define PACK_STRS_MIN   0x1000       // initial size of string pool
+#define PACK_COPYBUF    0x10000      // size of buffer documents are copied with
+
+/* types */
+/* archive entry (one per document). Entries are sorted by hash, then URI. */
+typedef struct {
+   uint32_t hash;      // pack_hash() of URI
+   uint32_t uri;       // offset of (normalized) request URI in string pool
+   uint32_t type;      // offset of content type in string pool
+   uint32_t etag;      // offset of ETag (quoted) in string pool
+   uint32_t last_mod;  // offset of formatted modification time in string pool
+   uint32_t gz_etag;   // offset of ETag of gzip variant in string pool (0 if none)
+   uint64_t off;       // offset of contents in archive
+   uint64_t size;      // size of contents
+   uint64_t gz_off;    // offset of gzip variant in archive (0 if none)
+   uint64_t gz_size;
+} pack_ent_t;
+
+/* header of archive file (see pack_build()), followed by the entries, the string pool and
+ * then the contents of the documents */
+typedef struct {
+   char magic[8];      // PACK_MAGIC
+   uint64_t nents;
+   uint64_t strs_len;
+   uint64_t size;      // size of archive file
+} pack_hdr_t;
+
+/* mapped archive, used in place. Responses reference its contents directly, so it is
+ * reference-counted: it is unmapped once its last reference is dropped (see pack_unref()). */
+typedef struct {
+   const pack_ent_t *ents;
+   size_t nents;
+   const char *strs;   // string pool
+   size_t strs_len;
+   void *map;
+   size_t map_len;
+   atomic_long refs;
+} pack_t;
+
+/* prototypes */
+int pack_build(const char *docroot, const filetype_table_t *ftypes, const char *path);
+int pack_open(const char *path, pack_t *pack);
+uint32_t pack_hash(const char *uri);
+const pack_ent_t *pack_lookup(const char *uri, const pack_t *pack);
+void pack_ref(pack_t *pack);
+void pack_unref(pack_t *pack);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "webserv-util.h"
+#include "webserv-mem.h"
+#include "webserv-pool.h"
+
+#define BUFPOOL_ROUND(size) (((size) + sizeof(max_align_t) - 1) / sizeof(max_align_t) \
+                             * sizeof(max_align_t))
+#define BUFPOOL_HDRSIZE     BUFPOOL_ROUND(sizeof(bufpool_slab_t))
+#define BUFPOOL_SLAB(buf, cls) ((bufpool_slab_t *) ((uintptr_t) (buf) & ~((cls)->slabsize - 1)))
+
+int bufpool_refill(bufpool_class_t *cls, bufpool_t *pool);
+bufpool_buf_t *bufpool_take(bufpool_class_t *cls, bufpool_t *pool);
+void bufpool_give(bufpool_buf_t *buf, bufpool_class_t *cls);
+bufpool_cache_t *bufpool_cache(bufpool_t *pool);
+void bufpool_cache_fill(size_t c, bufpool_cache_t *cache);
+void bufpool_cache_spill(size_t c, size_t n, bufpool_cache_t *cache);
+void bufpool_cache_flush(bufpool_cache_t *cache);
+void bufpool_cache_exit(void *caches);
+void bufpool_cache_init(void);
+
+static _Thread_local bufpool_cache_t bufpool_thd_caches[BUFPOOL_CACHES]; // thread's caches
+static _Thread_local size_t bufpool_thd_evict; // cache claimed next if all are in use
+static pthread_key_t bufpool_cache_key;        // flushes caches at thread exit
+static pthread_once_t bufpool_cache_once = PTHREAD_ONCE_INIT;
+static int bufpool_cache_ok;                   // whether the key was created
+
+/* bufpool_init()
+ * DESC: initializes buffer pool _pool_ whose largest buffers are _maxsize_ bytes. Buffer
+ *       classes are BUFPOOL_MINSIZE, BUFPOOL_MINSIZE * BUFPOOL_CLASSMULT, ..., _maxsize_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _maxsize_ is 0 or too large.
+ *  - see pthread_mutex_init(3)
+ */
+int bufpool_init(size_t maxsize, bufpool_t *pool) {
+   size_t size, slabsize;
+   int err;
+   
+   memset(pool, 0, sizeof(*pool));
+   if (maxsize == 0) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   /* compute size classes */
+   for (size = smin(BUFPOOL_MINSIZE, maxsize); ; size *= BUFPOOL_CLASSMULT) {
+      if (pool->nclasses == BUFPOOL_MAXCLASSES) {
+         errno = EINVAL;
+         return -1;
+      }
+      pool->classes[pool->nclasses].size = smin(size, maxsize);
+      for (slabsize = BUFPOOL_SLABSIZE;
+           slabsize < BUFPOOL_HDRSIZE + BUFPOOL_ROUND(smin(size, maxsize)); slabsize *= 2) {}
+      pool->classes[pool->nclasses++].slabsize = slabsize;
+      if (size >= maxsize) {
+         break;
+      }
+   }
+   pool->maxsize = maxsize;
+
+   if ((err = pthread_mutex_init(&pool->lock, NULL))) {
+      errno = err;
+      return -1;
+   }
+   
+   return 0;
+}
+
+/* bufpool_refill()
+ * DESC: allocates a new slab of buffers for class _cls_ and adds them to its free list.
+ * RETV: 0 on success, -1 on error.
+ * NOTE: pool must be locked.
+ */
+int bufpool_refill(bufpool_class_t *cls, bufpool_t *pool) {
+   bufpool_slab_t *slab;
+   size_t bufsize;
+   char *buf;
+
+   /* keep buffers aligned for any use */
+   bufsize = BUFPOOL_ROUND(cls->size);
+
+   if ((slab = aligned_alloc(cls->slabsize, cls->slabsize)) == NULL) {
+      return -1;
+   }
+   mem_charge(cls->slabsize);
+   slab->size = cls->slabsize;
+   slab->nbufs = (cls->slabsize - BUFPOOL_HDRSIZE) / bufsize;
+   slab->nfree = slab->nbufs;
+   slab->next = pool->slabs;
+   pool->slabs = slab;
+   
+   buf = (char *) slab + BUFPOOL_HDRSIZE;
+   for (size_t i = 0; i < slab->nbufs; ++i, buf += bufsize) {
+      bufpool_buf_t *node = (bufpool_buf_t *) buf;
+      node->next = cls->free;
+      cls->free = node;
+      ++cls->nfree;
+   }
+
+   return 0;
+}
+
+/* bufpool_take()
+ * DESC: takes a buffer of class _cls_ off pool _pool_'s free list (refilling it if empty).
+ * RETV: the buffer, NULL on error.
+ * NOTE: pool must be locked.
+ */
+bufpool_buf_t *bufpool_take(bufpool_class_t *cls, bufpool_t *pool) {
+   bufpool_buf_t *buf;
+
+   if (cls->free == NULL && bufpool_refill(cls, pool) < 0) {
+      return NULL;
+   }
+   buf = cls->free;
+   cls->free = buf->next;
+   --cls->nfree;
+   ++cls->nused;
+   --BUFPOOL_SLAB(buf, cls)->nfree;
+
+   return buf;
+}
+
+/* bufpool_give()
+ * DESC: puts buffer _buf_ of class _cls_ back on its pool's free list.
+ * NOTE: pool must be locked.
+ */
+void bufpool_give(bufpool_buf_t *buf, bufpool_class_t *cls) {
+   buf->next = cls->free;
+   cls->free = buf;
+   ++cls->nfree;
+   --cls->nused;
+   ++BUFPOOL_SLAB(buf, cls)->nfree;
+}
+
+/* bufpool_get()
+ * DESC: borrows a buffer of at least _minsize_ bytes from pool _pool_ (from the calling
+ *       thread's cache, if it has one for _pool_; see bufpool_cache()).
+ * ARGS:
+ *  - minsize: minimum size of buffer.
+ *  - sizep: pointer to where actual size of buffer is returned.
+ *  - pool: buffer pool.
+ * RETV: returns the buffer on success, NULL on error.
+ * ERRS:
+ *  - EMSGSIZE: _minsize_ exceeds the pool's maximum buffer size.
+ *  - see malloc(3)
+ * NOTE: thread-safe. Return buffer with bufpool_put().
+ */
+void *bufpool_get(size_t minsize, size_t *sizep, bufpool_t *pool) {
+   bufpool_class_t *cls;
+   bufpool_cache_t *cache;
+   bufpool_buf_t *buf;
+   size_t c;
+
+   /* find smallest class that fits */
+   for (cls = pool->classes; cls < pool->classes + pool->nclasses && cls->size < minsize; ++cls) {}
+   if (cls == pool->classes + pool->nclasses) {
+      errno = EMSGSIZE;
+      return NULL;
+   }
+
+   c = cls - pool->classes;
+   if ((cache = bufpool_cache(pool))) {
+      if (cache->free[c] == NULL) {
+         bufpool_cache_fill(c, cache);
+      }
+      if ((buf = cache->free[c]) == NULL) {
+         return NULL;
+      }
+      cache->free[c] = buf->next;
+      --cache->nfree[c];
+   } else {
+      pthread_mutex_lock(&pool->lock);
+      buf = bufpool_take(cls, pool);
+      pthread_mutex_unlock(&pool->lock);
+      if (buf == NULL) {
+         return NULL;
+      }
+   }
+
+   *sizep = cls->size;
+   return buf;
+}
+
+/* bufpool_put()
+ * DESC: returns buffer _buf_ of size _size_ (as returned by bufpool_get()) to pool _pool_
+ *       (to the calling thread's cache, if it has one for _pool_, which gives a batch back
+ *       to the pool once it holds 2 * BUFPOOL_BATCH of a class).
+ * NOTE: thread-safe. Any thread may return a buffer, not just the one that borrowed it.
+ */
+void bufpool_put(void *buf, size_t size, bufpool_t *pool) {
+   bufpool_class_t *cls;
+   bufpool_cache_t *cache;
+   bufpool_buf_t *node;
+   size_t c;
+
+   if (buf == NULL) {
+      return;
+   }
+   
+   for (cls = pool->classes; cls->size != size; ++cls) {}
+
+   node = buf;
+   c = cls - pool->classes;
+   if ((cache = bufpool_cache(pool))) {
+      node->next = cache->free[c];
+      cache->free[c] = node;
+      if (++cache->nfree[c] >= 2 * BUFPOOL_BATCH) {
+         bufpool_cache_spill(c, BUFPOOL_BATCH, cache);
+      }
+      return;
+   }
+   pthread_mutex_lock(&pool->lock);
+   bufpool_give(node, cls);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/* bufpool_cache()
+ * DESC: returns the calling thread's cache for pool _pool_. A thread has BUFPOOL_CACHES
+ *       caches, so one that uses a few pools (e.g. its NUMA node's and a shared one) keeps
+ *       a cache for each; if all are claimed by other pools, one of them is flushed (in
+ *       turn) and claimed for _pool_. Caches are flushed when the thread exits.
+ * RETV: the cache, NULL if it can't be set up, in which case _pool_ is used directly.
+ */
+bufpool_cache_t *bufpool_cache(bufpool_t *pool) {
+   bufpool_cache_t *cache, *unused;
+
+   unused = NULL;
+   for (cache = bufpool_thd_caches; cache < bufpool_thd_caches + BUFPOOL_CACHES; ++cache) {
+      if (cache->pool == pool) {
+         return cache;
+      }
+      if (cache->pool == NULL && unused == NULL) {
+         unused = cache;
+      }
+   }
+   if ((cache = unused) == NULL) {
+      cache = &bufpool_thd_caches[bufpool_thd_evict];
+      bufpool_thd_evict = (bufpool_thd_evict + 1) % BUFPOOL_CACHES;
+      bufpool_cache_flush(cache);
+   }
+   if (pthread_once(&bufpool_cache_once, bufpool_cache_init) || !bufpool_cache_ok
+       || pthread_setspecific(bufpool_cache_key, bufpool_thd_caches)) {
+      return NULL;
+   }
+   memset(cache, 0, sizeof(*cache));
+   cache->pool = pool;
+
+   return cache;
+}
+
+/* bufpool_cache_init(): creates the key whose destructor flushes caches at thread exit. */
+void bufpool_cache_init(void) {
+   bufpool_cache_ok = !pthread_key_create(&bufpool_cache_key, bufpool_cache_exit);
+}
+
+/* bufpool_cache_exit(): flushes all of a thread's caches _caches_ (at thread exit). */
+void bufpool_cache_exit(void *caches) {
+   for (size_t i = 0; i < BUFPOOL_CACHES; ++i) {
+      bufpool_cache_flush((bufpool_cache_t *) caches + i);
+   }
+}
+
+/* bufpool_cache_fill()
+ * DESC: takes a batch of buffers of class _c_ from cache _cache_'s pool (fewer if the
+ *       pool can't grow).
+ */
+void bufpool_cache_fill(size_t c, bufpool_cache_t *cache) {
+   bufpool_t *pool = cache->pool;
+   bufpool_class_t *cls = &pool->classes[c];
+   bufpool_buf_t *buf;
+   size_t n;
+
+   n = cache->batch[c] ? cache->batch[c] : 1;
+   cache->batch[c] = smin(2 * n, BUFPOOL_BATCH);
+   pthread_mutex_lock(&pool->lock);
+   while (n-- > 0 && (buf = bufpool_take(cls, pool))) {
+      buf->next = cache->free[c];
+      cache->free[c] = buf;
+      ++cache->nfree[c];
+   }
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/* bufpool_cache_spill()
+ * DESC: gives (up to) _n_ cached buffers of class _c_ back to cache _cache_'s pool.
+ */
+void bufpool_cache_spill(size_t c, size_t n, bufpool_cache_t *cache) {
+   bufpool_t *pool = cache->pool;
+   bufpool_buf_t *buf;
+
+   pthread_mutex_lock(&pool->lock);
+   for (; n > 0 && (buf = cache->free[c]); --n) {
+      cache->free[c] = buf->next;
+      --cache->nfree[c];
+      bufpool_give(buf, &pool->classes[c]);
+   }
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/* bufpool_cache_flush()
+ * DESC: gives all of cache _cache_'s buffers back to its pool, releasing the cache.
+ * NOTE: runs at thread exit (see bufpool_cache()), so the pool must outlive the threads
+ *       that use it.
+ */
+void bufpool_cache_flush(bufpool_cache_t *cache) {
+   if (cache->pool == NULL) {
+      return;
+   }
+   for (size_t c = 0; c < cache->pool->nclasses; ++c) {
+      bufpool_cache_spill(c, cache->nfree[c], cache);
+   }
+   cache->pool = NULL;
+}
+
+/* bufpool_trim()
+ * DESC: frees the slabs of _pool_ none of whose buffers are borrowed, shrinking the pool
+ *       (e.g. under memory pressure; see mem_level()).
+ * RETV: the number of bytes freed.
+ * NOTE: thread-safe. Takes time linear in the number of free buffers. Buffers in other
+ *       threads' caches count as borrowed (the calling thread's are given back first).
+ */
+size_t bufpool_trim(bufpool_t *pool) {
+   bufpool_class_t *cls;
+   bufpool_buf_t **bufp;
+   bufpool_slab_t **slabp, *slab;
+   size_t freed;
+
+   for (size_t i = 0; i < BUFPOOL_CACHES; ++i) {
+      if (bufpool_thd_caches[i].pool == pool) {
+         bufpool_cache_flush(&bufpool_thd_caches[i]);
+      }
+   }
+   pthread_mutex_lock(&pool->lock);
+
+   /* unlink buffers of wholly free slabs from the free lists */
+   for (cls = pool->classes; cls < pool->classes + pool->nclasses; ++cls) {
+      for (bufp = &cls->free; *bufp; ) {
+         slab = BUFPOOL_SLAB(*bufp, cls);
+         if (slab->nfree == slab->nbufs) {
+            *bufp = (*bufp)->next;
+            --cls->nfree;
+         } else {
+            bufp = &(*bufp)->next;
+         }
+      }
+   }
+
+   /* free those slabs */
+   freed = 0;
+   for (slabp = &pool->slabs; *slabp; ) {
+      slab = *slabp;
+      if (slab->nfree == slab->nbufs) {
+         *slabp = slab->next;
+         freed += slab->size;
+         free(slab);
+      } else {
+         slabp = &slab->next;
+      }
+   }
+   
+   pthread_mutex_unlock(&pool->lock);
+
+   mem_uncharge(freed);
+   return freed;
+}
+
+/* bufpool_delete()
+ * DESC: frees all of _pool_'s slabs. All buffers must have been returned, and all other
+ *       threads that used the pool must have exited (flushing their caches).
+ */
+void bufpool_delete(bufpool_t *pool) {
+   bufpool_slab_t *slab, *next;
+
+   for (size_t i = 0; i < BUFPOOL_CACHES; ++i) {
+      if (bufpool_thd_caches[i].pool == pool) {
+         bufpool_thd_caches[i].pool = NULL; // (its buffers are in the slabs freed below)
+      }
+   }
+   for (slab = pool->slabs; slab; slab = next) {
+      next = slab->next;
+      mem_uncharge(slab->size);
+      free(slab);
+   }
+   pthread_mutex_destroy(&pool->lock);
+   memset(pool, 0, sizeof(*pool));
+}
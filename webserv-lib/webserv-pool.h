@@ -0,0 +1,67 @@
+#ifndef __WEBSERV_POOL_H
+#define __WEBSERV_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* defines */
+#define BUFPOOL_MINSIZE   0x0400 // size of smallest buffer class (1 KiB)
+#define BUFPOOL_CLASSMULT 4      // ratio between successive buffer class sizes
+#define BUFPOOL_MAXCLASSES 8
+#define BUFPOOL_SLABSIZE  0x10000 // bytes of buffers allocated at once per class (64 KiB;
+                                  // power of 2, slabs are aligned to it)
+#define BUFPOOL_BATCH     8       // max buffers a thread's cache moves to/from its pool at once
+#define BUFPOOL_CACHES    4       // pools a thread caches buffers of at once
+
+/* types */
+/* free buffer (intrusive free list node stored in the buffer itself) */
+typedef struct bufpool_buf {
+   struct bufpool_buf *next;
+} bufpool_buf_t;
+
+/* slab of buffers (allocated as a unit; freed by bufpool_trim() once all of its buffers
+ * are free, or when pool is deleted). Slabs are aligned to their size class's _slabsize_,
+ * so a buffer's slab header is found by masking the buffer's address. */
+typedef struct bufpool_slab {
+   struct bufpool_slab *next;
+   size_t size;          // bytes allocated (charged to the memory budget)
+   size_t nbufs;         // number of buffers in slab
+   size_t nfree;         // number of those in their class's free list
+} bufpool_slab_t;
+
+/* buffer size class */
+typedef struct {
+   size_t size;          // size of buffers in this class
+   size_t slabsize;      // size (& alignment) of this class's slabs (power of 2)
+   bufpool_buf_t *free;  // free list
+   size_t nfree;         // number of buffers in free list
+   size_t nused;         // number of buffers borrowed
+} bufpool_class_t;
+
+/* a thread's cache of free buffers of one pool (see bufpool_cache()): buffers are taken
+ * from the pool in batches (growing from 1 to BUFPOOL_BATCH, so short-lived threads don't
+ * hoard) and given back in batches, so threads sharing a pool rarely contend on its lock */
+typedef struct {
+   struct bufpool *pool;                    // pool cached (NULL if none)
+   bufpool_buf_t *free[BUFPOOL_MAXCLASSES]; // free lists (buffers count as borrowed)
+   size_t nfree[BUFPOOL_MAXCLASSES];
+   size_t batch[BUFPOOL_MAXCLASSES];        // buffers to take at the next refill
+} bufpool_cache_t;
+
+/* pool of fixed-size buffers */
+typedef struct bufpool {
+   bufpool_class_t classes[BUFPOOL_MAXCLASSES];
+   size_t nclasses;
+   size_t maxsize;       // size of largest class
+   bufpool_slab_t *slabs;
+   pthread_mutex_t lock;
+} bufpool_t;
+
+/* prototypes */
+int bufpool_init(size_t maxsize, bufpool_t *pool);
+void *bufpool_get(size_t minsize, size_t *sizep, bufpool_t *pool);
+void bufpool_put(void *buf, size_t size, bufpool_t *pool);
+size_t bufpool_trim(bufpool_t *pool);
+void bufpool_delete(bufpool_t *pool);
+
+#endif
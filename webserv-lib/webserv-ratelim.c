@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "webserv-mem.h"
+#include "webserv-ratelim.h"
+
+uint64_t ratelim_clock(void);
+ratelim_ent_t *ratelim_lookup(ratelim_key_t key, uint64_t now, ratelim_t *rl,
+                              ratelim_shard_t **shardp);
+int ratelim_allowed(const ratelim_ent_t *ent, const ratelim_t *rl);
+
+/* ratelim_init()
+ * DESC: initializes per-client rate limits _rl_ with no clients.
+ * ARGS:
+ *  - req_rate: requests per second each client may make (0 for no limit).
+ *  - req_burst: requests a client may make at once (at least 1).
+ *  - byte_rate: response bytes per second each client may be sent (0 for no limit).
+ *  - byte_burst: response bytes a client may be sent at once.
+ *  - rl: rate limits to initialize.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: a rate or burst is negative, or _req_burst_ is less than 1.
+ *  - see malloc(3), pthread_mutex_init(3)
+ */
+int ratelim_init(double req_rate, double req_burst, double byte_rate, double byte_burst,
+                 ratelim_t *rl) {
+   size_t i;
+   int err;
+
+   memset(rl, 0, sizeof(*rl));
+   if (req_rate < 0 || req_burst < 1 || byte_rate < 0 || byte_burst < 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   rl->req_rate = req_rate;
+   rl->req_burst = req_burst;
+   rl->byte_rate = byte_rate;
+   rl->byte_burst = byte_burst;
+
+   if ((rl->shards = calloc(RATELIM_NSHARDS, sizeof(*rl->shards))) == NULL) {
+      return -1;
+   }
+   for (i = 0; i < RATELIM_NSHARDS; ++i) {
+      if ((err = pthread_mutex_init(&rl->shards[i].lock, NULL))) {
+         while (i > 0) {
+            pthread_mutex_destroy(&rl->shards[--i].lock);
+         }
+         free(rl->shards);
+         errno = err;
+         return -1;
+      }
+   }
+   mem_charge(RATELIM_NSHARDS * sizeof(*rl->shards));
+
+   return 0;
+}
+
+/* ratelim_key()
+ * DESC: returns the key of the client with address _sa_: its IPv4 address (IPv4-mapped
+ *       IPv6 addresses included), or its IPv6 /64 prefix folded to 32 bits (the usual
+ *       allocation to one subscriber, so hopping addresses within it doesn't help); 0 for
+ *       other address families, which are never limited.
+ */
+ratelim_key_t ratelim_key(const struct sockaddr *sa) {
+   const uint8_t *addr6;
+   uint32_t hi, lo;
+
+   switch (sa->sa_family) {
+   case AF_INET:
+      return ((const struct sockaddr_in *) sa)->sin_addr.s_addr;
+   case AF_INET6:
+      addr6 = ((const struct sockaddr_in6 *) sa)->sin6_addr.s6_addr;
+      if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr *) addr6)) {
+         memcpy(&lo, addr6 + 12, sizeof(lo));
+         return lo;
+      }
+      memcpy(&hi, addr6, sizeof(hi));
+      memcpy(&lo, addr6 + 4, sizeof(lo));
+      return (hi ^ lo) ? (hi ^ lo) : 1;
+   default:
+      return 0;
+   }
+}
+
+/* ratelim_clock()
+ * DESC: returns the current time (coarse CLOCK_MONOTONIC, in nanoseconds).
+ */
+uint64_t ratelim_clock(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ratelim_lookup()
+ * DESC: finds the entry of client _key_ (creating it with full buckets, in place of a
+ *       free or else the least recently used entry, if there is none) and refills its
+ *       buckets up to time _now_.
+ * RETV: the entry, whose shard (returned in _*shardp_) is locked.
+ */
+ratelim_ent_t *ratelim_lookup(ratelim_key_t key, uint64_t now, ratelim_t *rl,
+                              ratelim_shard_t **shardp) {
+   ratelim_shard_t *shard;
+   ratelim_ent_t *ent, *victim;
+   uint32_t hash;
+   double elapsed;
+
+   hash = key * 2654435761u; // (Knuth's multiplicative hash)
+   shard = &rl->shards[(hash >> 16) & (RATELIM_NSHARDS - 1)];
+   *shardp = shard;
+
+   pthread_mutex_lock(&shard->lock);
+   victim = NULL;
+   for (size_t i = 0; i < RATELIM_PROBE; ++i) {
+      ent = &shard->ents[(hash + i) & (RATELIM_SHARDSIZE - 1)];
+      if (ent->key == key) {
+         /* refill buckets (another thread may have done so with a later time) */
+         if (now <= ent->stamp) {
+            return ent;
+         }
+         elapsed = (now - ent->stamp) / 1e9;
+         ent->reqs = (ent->reqs + elapsed * rl->req_rate < rl->req_burst)
+            ? ent->reqs + elapsed * rl->req_rate : rl->req_burst;
+         ent->bytes = (ent->bytes + elapsed * rl->byte_rate < rl->byte_burst)
+            ? ent->bytes + elapsed * rl->byte_rate : rl->byte_burst;
+         ent->stamp = now;
+         return ent;
+      }
+      if (victim == NULL || (victim->key && (ent->key == 0 || ent->stamp < victim->stamp))) {
+         victim = ent;
+      }
+   }
+
+   /* new client */
+   victim->key = key;
+   victim->reqs = rl->req_burst;
+   victim->bytes = rl->byte_burst;
+   victim->stamp = now;
+   return victim;
+}
+
+/* ratelim_allowed(): returns whether the client of entry _ent_ is within its limits. */
+int ratelim_allowed(const ratelim_ent_t *ent, const ratelim_t *rl) {
+   return (rl->req_rate == 0 || ent->reqs >= 1) && (rl->byte_rate == 0 || ent->bytes >= 0);
+}
+
+/* ratelim_admit()
+ * DESC: decides whether to admit a new connection of client _key_ (without using up any
+ *       of its tokens).
+ * RETV: 1 if the client is within its limits, 0 if it is to be turned away.
+ * NOTE: thread-safe.
+ */
+int ratelim_admit(ratelim_key_t key, ratelim_t *rl) {
+   ratelim_shard_t *shard;
+   int admit;
+
+   if (key == 0) {
+      return 1;
+   }
+   admit = ratelim_allowed(ratelim_lookup(key, ratelim_clock(), rl, &shard), rl);
+   pthread_mutex_unlock(&shard->lock);
+
+   return admit;
+}
+
+/* ratelim_take()
+ * DESC: decides whether to serve a request of client _key_, taking a request token if so.
+ * RETV: 1 if the request is to be served, 0 if the client is over its limits.
+ * NOTE: thread-safe.
+ */
+int ratelim_take(ratelim_key_t key, ratelim_t *rl) {
+   ratelim_shard_t *shard;
+   ratelim_ent_t *ent;
+   int allowed;
+
+   if (key == 0) {
+      return 1;
+   }
+   ent = ratelim_lookup(key, ratelim_clock(), rl, &shard);
+   if ((allowed = ratelim_allowed(ent, rl)) && rl->req_rate) {
+      ent->reqs -= 1;
+   }
+   pthread_mutex_unlock(&shard->lock);
+
+   return allowed;
+}
+
+/* ratelim_charge()
+ * DESC: charges client _key_ for _nbytes_ response bytes (possibly putting it in debt).
+ * NOTE: thread-safe.
+ */
+void ratelim_charge(ratelim_key_t key, size_t nbytes, ratelim_t *rl) {
+   ratelim_shard_t *shard;
+
+   if (key == 0 || rl->byte_rate == 0) {
+      return;
+   }
+   ratelim_lookup(key, ratelim_clock(), rl, &shard)->bytes -= nbytes;
+   pthread_mutex_unlock(&shard->lock);
+}
+
+/* ratelim_expire()
+ * DESC: frees the entries of clients that have been idle for RATELIM_IDLE seconds (whose
+ *       buckets have refilled, so nothing is lost). Does nothing if it already swept
+ *       during the current second, so it can be called often.
+ * RETV: the number of entries freed.
+ * NOTE: must not be called by two threads at once (other ratelim_* calls are fine).
+ */
+size_t ratelim_expire(ratelim_t *rl) {
+   ratelim_shard_t *shard;
+   ratelim_ent_t *ent;
+   uint64_t now;
+   size_t nfreed;
+
+   now = ratelim_clock();
+   if ((time_t) (now / 1000000000ull) == rl->swept) {
+      return 0;
+   }
+   rl->swept = now / 1000000000ull;
+
+   nfreed = 0;
+   for (shard = rl->shards; shard < rl->shards + RATELIM_NSHARDS; ++shard) {
+      pthread_mutex_lock(&shard->lock);
+      for (ent = shard->ents; ent < shard->ents + RATELIM_SHARDSIZE; ++ent) {
+         if (ent->key && now > ent->stamp
+             && now - ent->stamp >= RATELIM_IDLE * 1000000000ull) {
+            ent->key = 0;
+            ++nfreed;
+         }
+      }
+      pthread_mutex_unlock(&shard->lock);
+   }
+
+   return nfreed;
+}
+
+/* ratelim_delete()
+ * DESC: frees rate limits _rl_.
+ */
+void ratelim_delete(ratelim_t *rl) {
+   for (size_t i = 0; i < RATELIM_NSHARDS; ++i) {
+      pthread_mutex_destroy(&rl->shards[i].lock);
+   }
+   free(rl->shards);
+   mem_uncharge(RATELIM_NSHARDS * sizeof(*rl->shards));
+   rl->shards = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef __WEBSERV_RATELIM_H
+#define __WEBSERV_RATELIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/* defines */
+#define RATELIM_NSHARDS    16   // number of shards (power of 2), each with its own lock
+#define RATELIM_SHARDSIZE  256  // entries per shard (power of 2)
+#define RATELIM_PROBE      8    // entries probed per lookup (the least recently used of
+                                // them is evicted if none is free)
+#define RATELIM_IDLE       60   // seconds after which an idle client's entry is freed
+#define RATELIM_BURST      2    // default burst: this many seconds' worth of the rate
+#define RATELIM_RETRY_AFTER 1   // seconds clients over their limit are asked to wait
+
+/* types */
+/* client key: IPv4 address (network byte order) or folded IPv6 /64 prefix; 0 for clients
+ * that aren't limited (see ratelim_key()) */
+typedef uint32_t ratelim_key_t;
+
+/* token buckets of one client */
+typedef struct {
+   ratelim_key_t key;  // 0 if entry is free
+   double reqs;        // request tokens
+   double bytes;       // response byte tokens (negative while in debt)
+   uint64_t stamp;     // time buckets were last refilled (ns)
+} ratelim_ent_t;
+
+typedef struct {
+   ratelim_ent_t ents[RATELIM_SHARDSIZE];
+   pthread_mutex_t lock;
+} ratelim_shard_t;
+
+/* per-client rate limits: a fixed-size, sharded hash table of token buckets (one for
+ * requests, one for response bytes) keyed by client address. Buckets refill continuously
+ * at the configured rates, up to their bursts; response bytes are charged after the fact,
+ * so a client that goes into debt is held off until it is paid off. */
+typedef struct {
+   ratelim_shard_t *shards;  // RATELIM_NSHARDS shards
+   double req_rate;          // requests per second (0 for no limit)
+   double req_burst;
+   double byte_rate;         // response bytes per second (0 for no limit)
+   double byte_burst;
+   time_t swept;             // time of last ratelim_expire() sweep (seconds)
+} ratelim_t;
+
+/* prototypes */
+int ratelim_init(double req_rate, double req_burst, double byte_rate, double byte_burst,
+                 ratelim_t *rl);
+ratelim_key_t ratelim_key(const struct sockaddr *sa);
+int ratelim_admit(ratelim_key_t key, ratelim_t *rl);
+int ratelim_take(ratelim_key_t key, ratelim_t *rl);
+void ratelim_charge(ratelim_key_t key, size_t nbytes, ratelim_t *rl);
+size_t ratelim_expire(ratelim_t *rl);
+void ratelim_delete(ratelim_t *rl);
+
+#endif
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "webserv-rcu.h"
+
+/* rcu_init()
+ * DESC: initializes RCU pointer _rcu_ with initial version _ptr_.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see pthread_mutex_init(3)
+ */
+int rcu_init(void *ptr, rcu_t *rcu) {
+   int err;
+
+   atomic_init(&rcu->ptr, ptr);
+   atomic_init(&rcu->epoch, 0);
+   atomic_init(&rcu->readers[0], 0);
+   atomic_init(&rcu->readers[1], 0);
+   if ((err = pthread_mutex_init(&rcu->lock, NULL))) {
+      errno = err;
+      return -1;
+   }
+
+   return 0;
+}
+
+/* rcu_read_lock()
+ * DESC: enters a read-side critical section of _rcu_. The returned version stays valid
+ *       until the matching rcu_read_unlock() (lock-free; never blocks).
+ * ARGS:
+ *  - tokp: where to store token to pass to rcu_read_unlock().
+ *  - rcu: RCU pointer to read.
+ * RETV: the current version.
+ */
+void *rcu_read_lock(unsigned *tokp, rcu_t *rcu) {
+   unsigned idx;
+
+   idx = atomic_load(&rcu->epoch) & 1;
+   atomic_fetch_add(&rcu->readers[idx], 1);
+   *tokp = idx;
+
+   /* (loaded after being counted, so a writer either waits for us or we see its version) */
+   return atomic_load(&rcu->ptr);
+}
+
+/* rcu_read_unlock()
+ * DESC: leaves the read-side critical section entered by the rcu_read_lock() that
+ *       returned token _tok_.
+ */
+void rcu_read_unlock(unsigned tok, rcu_t *rcu) {
+   atomic_fetch_sub(&rcu->readers[tok], 1);
+}
+
+/* rcu_wait()
+ * DESC: flips the epoch of _rcu_ and waits until all readers that entered before the flip
+ *       have left. Writer lock must be held.
+ */
+void rcu_wait(rcu_t *rcu) {
+   unsigned idx;
+   struct timespec ts = {0, RCU_WAIT_NSEC};
+
+   idx = atomic_fetch_add(&rcu->epoch, 1) & 1;
+   while (atomic_load(&rcu->readers[idx]) != 0) {
+      nanosleep(&ts, NULL);
+   }
+}
+
+/* rcu_synchronize()
+ * DESC: waits for a grace period of _rcu_: until all read-side critical sections that
+ *       were entered before the call have been left.
+ * NOTE: never call from a read-side critical section.
+ */
+void rcu_synchronize(rcu_t *rcu) {
+   pthread_mutex_lock(&rcu->lock);
+
+   /* flip twice, so the parity ends up where it started: a reader that sampled the epoch
+    * before the first flip but was only counted after we checked its counter already
+    * holds the current version, and the next writer's first flip waits for it. */
+   rcu_wait(rcu);
+   rcu_wait(rcu);
+   pthread_mutex_unlock(&rcu->lock);
+}
+
+/* rcu_swap()
+ * DESC: publishes new version _ptr_ of _rcu_ and waits for the grace period to end.
+ * RETV: the previous version, which no reader references any longer (and can be freed).
+ * NOTE: blocks while readers of the previous version remain; never call from a read-side
+ *       critical section.
+ */
+void *rcu_swap(void *ptr, rcu_t *rcu) {
+   void *old;
+
+   old = atomic_exchange(&rcu->ptr, ptr);
+   rcu_synchronize(rcu);
+
+   return old;
+}
+
+/* rcu_delete()
+ * DESC: deletes RCU pointer _rcu_ (there must be no readers left).
+ * RETV: the current version (to be freed by the caller).
+ */
+void *rcu_delete(rcu_t *rcu) {
+   pthread_mutex_destroy(&rcu->lock);
+   return atomic_load(&rcu->ptr);
+}
@@ -0,0 +1,30 @@
+#ifndef __WEBSERV_RCU_H
+#define __WEBSERV_RCU_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* defines */
+#define RCU_WAIT_NSEC 1000000 // how long writer sleeps between checks for readers (1 ms)
+
+/* types */
+/* read-copy-update pointer: readers get the current version without locking; writers
+ * publish a new version and wait for a grace period (until no reader can still be using
+ * the old version) before the old version may be freed. Readers are counted in one of
+ * two counters, selected by the parity of the epoch when they entered. */
+typedef struct {
+   _Atomic(void *) ptr;        // current version
+   atomic_uint epoch;          // low bit selects reader counter for new readers
+   atomic_long readers[2];     // number of readers in each epoch parity
+   pthread_mutex_t lock;       // serializes writers
+} rcu_t;
+
+/* prototypes */
+int rcu_init(void *ptr, rcu_t *rcu);
+void *rcu_read_lock(unsigned *tokp, rcu_t *rcu);
+void rcu_read_unlock(unsigned tok, rcu_t *rcu);
+void rcu_synchronize(rcu_t *rcu);
+void *rcu_swap(void *ptr, rcu_t *rcu);
+void *rcu_delete(rcu_t *rcu);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netdb.h>
@@ -12,10 +13,12 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
+#include <limits.h>
 #include "webserv-util.h"
 #include "webserv-dbg.h"
 #include "webserv-res.h"
 #include "webserv-req.h"
+#include "webserv-body.h"
 
 
 /* request_init(): initialize request. */
@@ -23,30 +26,38 @@ void request_init(httpmsg_t *req) {
    message_init(req);
 }
 
+const char *request_find_end(const char *pos, const char *end);
+
 /* request_read()
  * DESC: receive request (NONBLOCKING/ASYNCHRONOUS).
  * ARGS:
  *  - conn_fd: client socket.
  *  - req: request being received.
+ *  - pool: pool to borrow the request's text buffer from. Its largest buffer size is the
+ *          maximum request header size.
  * RETV: returns 0 once the entire request has been read, or
  *       returns -1 if an error occurred OR reading would block.
+ * ERRS:
+ *  - EAGAIN: more data to come.
+ *  - EMSGSIZE: request headers exceed the pool's maximum buffer size.
+ *  - ECONNABORTED: client closed the connection before sending a full request.
+ *  - see recv(2), message_borrow_text()
  * NOTE:
- *  - prints errors.
  *  - request_read() will likely need to be called multiple
  *    times on the same request _req_ 
+ *  - use message_error() to determine the cause of the error.
  */
-int request_read(int conn_fd, httpmsg_t *req) {
+int request_read(int conn_fd, httpmsg_t *req, bufpool_t *pool) {
    ssize_t bytes_received;
-   size_t bytes_free, newsize;
+   size_t bytes_free;
+   char *scan;
 
-   /* read until block, EOF, or \r\n */
+   /* read until block, EOF, or empty line */
 
-   /* resize text buffer if necessary */
+   /* borrow (larger) text buffer if necessary */
    bytes_free = message_textfree(req);
    if (bytes_free == 0) {
-      newsize = smax(HM_TEXT_INIT, req->hm_text_size * 2);
-      if (message_resize_text(newsize, req) < 0) {
-         perror("message_resize_text");
+      if (message_borrow_text(req->hm_text_size + 1, pool, req) < 0) {
          return -1;
       }
       bytes_free = message_textfree(req);
@@ -56,13 +67,17 @@ int request_read(int conn_fd, httpmsg_t *req) {
    bytes_received = recv(conn_fd, req->hm_text_ptr, bytes_free, MSG_DONTWAIT);
    if (bytes_received < 0) {
       return -1;
+   } else if (bytes_received == 0) {
+      errno = ECONNABORTED; // EOF before end of request
+      return -1;
    }
 
    /* update text buffer fields */
+   scan = req->hm_text_ptr - smin(2, req->hm_text_ptr - req->hm_text);
    req->hm_text_ptr += bytes_received;
    
-   /* check for terminating line */
-   if (req->hm_text_ptr - req->hm_text < 4 || memcmp("\r\n\r\n", req->hm_text_ptr - 4, 4)) {
+   /* check for terminating line (in newly received bytes) */
+   if (request_find_end(scan, req->hm_text_ptr) == NULL) {
       errno = EAGAIN; // more to come
       return -1;
    }
@@ -70,6 +85,113 @@ int request_read(int conn_fd, httpmsg_t *req) {
    return 0; // success; request fully received
 }
 
+/* request_buffered()
+ * DESC: returns whether the text buffer of request _req_ already holds a complete request
+ *       header (e.g. one carried over by request_next()), so it can be parsed without
+ *       calling request_read().
+ */
+int request_buffered(const httpmsg_t *req) {
+   return req->hm_text && request_find_end(req->hm_text, req->hm_text_ptr);
+}
+
+/* request_find_end()
+ * DESC: finds the empty line ending a request header between _pos_ and _end_. Like
+ *       request_parse_line(), it accepts lines ending in a bare "\n" as well as "\r\n",
+ *       so the terminator is "\n\n" or "\n\r\n" (the latter ending "\r\n\r\n").
+ * RETV: returns the end of the empty line, or NULL if there is none.
+ */
+const char *request_find_end(const char *pos, const char *end) {
+   const char *nl;
+
+   while ((nl = memchr(pos, '\n', end - pos)) != NULL) {
+      pos = nl + 1;
+      if (pos < end && *pos == '\r') {
+         ++pos;
+      }
+      if (pos < end && *pos == '\n') {
+         return pos + 1;
+      }
+   }
+
+   return NULL;
+}
+
+/* request_next()
+ * DESC: prepares request _req_, whose response has been sent, for the next request on the
+ *       same (persistent) connection. Bytes received after the end of _req_ (the start of a
+ *       pipelined request) are carried over; all other memory of _req_ is released.
+ * RETV: the number of bytes carried over (if 0, _req_ holds no memory), or -1 on error.
+ * ERRS:
+ *  - see message_borrow_text()
+ * NOTE: _req_ must have been parsed and must not have had a body.
+ */
+ssize_t request_next(httpmsg_t *req) {
+   httpmsg_t next;
+   size_t off, len;
+
+   off = req->hm_line.reql.hdrs_end;
+   len = (req->hm_text_ptr - req->hm_text) - off;
+
+   request_init(&next);
+   if (len > 0) {
+      if (message_borrow_text(len, req->hm_pool, &next) < 0) {
+         return -1;
+      }
+      memcpy(next.hm_text, req->hm_text + off, len);
+      next.hm_text_ptr += len;
+   }
+   request_delete(req);
+   *req = next;
+
+   return len;
+}
+
+/* request_keepalive()
+ * DESC: returns whether the connection that parsed request _req_ arrived on may be kept
+ *       open after the response: HTTP/1.1 requests unless they ask to close it, HTTP/1.0
+ *       requests only if they ask to keep it alive ("Connection: keep-alive").
+ * NOTE: requests with a body (Content-Length or Transfer-Encoding) are never kept alive,
+ *       since their body may be left unread (e.g. if the request is rejected).
+ */
+int request_keepalive(const httpmsg_t *req) {
+   const char *conn;
+
+   if (request_header_known(HM_HID_CONTENTLENGTH, req)
+       || request_header_known(HM_HID_TRANSFERENCODING, req)) {
+      return 0;
+   }
+
+   conn = request_header_known(HM_HID_CONNECTION, req);
+   if (strcmp(request_version(req), "1.0") == 0) {
+      return conn && request_hastoken(conn, HM_KEEPALIVE);
+   } else {
+      return !(conn && request_hastoken(conn, HM_CLOSE));
+   }
+}
+
+/* request_hastoken()
+ * DESC: returns whether comma-separated header value _list_ contains _token_ (compared
+ *       case-insensitively).
+ */
+int request_hastoken(const char *list, const char *token) {
+   size_t toklen, len;
+
+   toklen = strlen(token);
+   while (*list) {
+      list += strspn(list, " \t,");
+      len = strcspn(list, ",");
+      while (len > 0 && (list[len - 1] == ' ' || list[len - 1] == '\t')) {
+         --len;
+      }
+      if (len == toklen && strncasecmp(list, token, len) == 0) {
+         return 1;
+      }
+      list += strcspn(list, ",");
+   }
+
+   return 0;
+}
+
 /* request_parse()
  * DESC: parses request that has been fully reeceived (using request_read()). Parsed info
  *       is stored internally in _req_.
@@ -77,114 +199,262 @@ int request_read(int conn_fd, httpmsg_t *req) {
  *  - req: request to parse.
  * ERRS:
  *  - EBADMSG: request syntax error (not a valid request)
- *  - see strdup(3)
- *  - see message_resize_headers()
+ *  - ENOSYS: request method is unknown
+ *  - see hr_uri_normalize()
+ *  - see request_insert_header()
+ * NOTE: parsing is done in place: the request line and headers are stored as slices
+ *       into _req_'s text buffer (whose delimiters are overwritten with '\0'). Nothing
+ *       is allocated unless the request has more than HM_REQHDRS_INIT headers. The URI
+ *       is normalized in place (see hr_uri_normalize()).
  */
-int request_parse_headers(httpmsg_t *req, char **saveptr_text);
+char *request_parse_line(char *pos, char *end, char **line_endp);
+int request_parse_headers(char *pos, char *end, httpmsg_t *req);
 int request_parse(httpmsg_t *req) {
-   char *saveptr_text;
-   char *req_line, *req_method_str, *req_version_str, *req_uri_str;
-   req_line = strtok_r(req->hm_text, "\n", &saveptr_text); // has trailing '\r'
+   httpreq_line_t *reql;
+   char *text, *pos, *end, *line_end, *tok_end;
+   int method;
 
-   /* parse request line method */
-   if ((req_method_str = strtok(req_line, " "))) {
-      req->hm_line.reql.method = hr_str2meth(req_method_str);
+   reql = &req->hm_line.reql;
+   text = req->hm_text;
+   end = req->hm_text_ptr;
+
+   /* find end of request line */
+   if (text == NULL || (pos = request_parse_line(text, end, &line_end)) == NULL) {
+      errno = EBADMSG;
+      return -1;
    }
-   if (req_method_str == NULL || req->hm_line.reql.method < 0) {
+   
+   /* parse request line method */
+   if ((tok_end = memchr(text, ' ', line_end - text)) == NULL) {
       errno = EBADMSG;
       return -1;
    }
+   *tok_end = '\0';
+   if ((method = hr_str2meth(text)) < 0) {
+      errno = ENOSYS; // unknown method (501)
+      return -1;
+   }
+   reql->method = method;
 
    /* parse request line URI */
-   req_uri_str = strtok(NULL, " ");
-   if (req_uri_str == NULL) {
+   reql->uri.off = tok_end + 1 - text;
+   if ((tok_end = memchr(tok_end + 1, ' ', line_end - tok_end - 1)) == NULL) {
       errno = EBADMSG;
       return -1;
    }
-   if ((req->hm_line.reql.uri = strdup(req_uri_str)) == NULL) {
+   reql->uri.len = tok_end - text - reql->uri.off;
+   if (hr_uri_normalize(text + reql->uri.off, &reql->uri.len, method == M_OPTIONS) < 0) {
       return -1;
    }
-      
-   /* parse request line HTTP version */
-   req_version_str = strtok(NULL, "\r"); // last item in line
-   req_version_str = strskip(HM_VERSION_PREFIX, req_version_str);
-   if (req_version_str == NULL) {
+   text[reql->uri.off + reql->uri.len] = '\0';
+
+   /* parse request line HTTP version (last item in line) */
+   *line_end = '\0';
+   if (strskip(HM_VERSION_PREFIX, tok_end + 1) == NULL) {
       errno = EBADMSG;
       return -1;
    }
-   if ((req->hm_line.reql.version = strdup(req_version_str)) == NULL) {
-      return -1;
-   }
+   reql->version.off = tok_end + 1 + strlen(HM_VERSION_PREFIX) - text;
+   reql->version.len = line_end - text - reql->version.off;
    
    /* parse request headers */
-   if (request_parse_headers(req, &saveptr_text) < 0) {
+   if (request_parse_headers(pos, end, req) < 0) {
       return -1;
    }
    
    return 0;
 }
 
-int request_parse_headers(httpmsg_t *req, char **saveptr_text) {
-   httpmsg_header_t *header_it;
-   char *header_str, *val_str, *key_str;
-   for (header_it = req->hm_headers;
-        (header_str = strtok_r(NULL, "\n", saveptr_text))
-           && strcmp(header_str, "\r");
-        ++header_it) {
-      
-      /* check if array full */
-      if (header_it == req->hm_headers + req->hm_nheaders) {
-         size_t header_i = header_it - req->hm_headers; // current index
-         size_t new_nheaders = smax(HM_NHEADERS_INIT, req->hm_nheaders * 2);
+/* request_parse_line()
+ * DESC: finds the end of the line beginning at _pos_ (and ending before _end_).
+ * ARGS:
+ *  - pos: start of line.
+ *  - end: end of text.
+ *  - line_endp: pointer to where the end of the line's contents (i.e. the position of
+ *               the terminating "\r\n" or "\n") is returned.
+ * RETV: returns the start of the next line, or NULL if the line is unterminated.
+ */
+char *request_parse_line(char *pos, char *end, char **line_endp) {
+   char *nl;
 
-         /* expand header size */
-         if (message_resize_headers(new_nheaders, req) < 0) {
-            return -1;
-         }
+   if ((nl = memchr(pos, '\n', end - pos)) == NULL) {
+      return NULL;
+   }
+   *line_endp = (nl > pos && nl[-1] == '\r') ? nl - 1 : nl;
+   
+   return nl + 1;
+}
 
-         header_it = req->hm_headers + header_i; // update header iterator         
-      }
-      
-      /* parse single request header */
+/* request_parse_headers()
+ * DESC: parses the request headers beginning at _pos_, up to the first empty line.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EBADMSG: header syntax error.
+ *  - see request_insert_header()
+ */
+int request_parse_headers(char *pos, char *end, httpmsg_t *req) {
+   char *text, *line_end, *next, *sep, *val, *val_end;
+   httpreq_header_t hdr;
 
+   text = req->hm_text;
+   while ((next = request_parse_line(pos, end, &line_end)) && line_end > pos) {
       /* get key */
-      if ((key_str = strtok(header_str, ":")) == NULL) {
-         errno = EBADMSG;
-         return -1;
-      }
-      /* get value */
-      if ((val_str = strtok(NULL, "\r")) == NULL) {
+      if ((sep = memchr(pos, ':', line_end - pos)) == NULL || sep == pos) {
          errno = EBADMSG;
          return -1;
-      } else {
-         /* strip leading whitespace */
-         val_str = strstrip(val_str, " ");
       }
+      *sep = '\0';
+      hdr.key.off = pos - text;
+      hdr.key.len = sep - pos;
+
+      /* get value (without leading or trailing whitespace) */
+      for (val = sep + 1; val < line_end && (*val == ' ' || *val == '\t'); ++val) {}
+      for (val_end = line_end; val_end > val && (val_end[-1] == ' ' || val_end[-1] == '\t');
+           --val_end) {}
+      *val_end = '\0';
+      hdr.value.off = val - text;
+      hdr.value.len = val_end - val;
+
       /* set key & value */
-      if ((header_it->key = strdup(key_str)) == NULL) {
+      if (request_insert_header(&hdr, req) < 0) {
          return -1;
       }
-      if ((header_it->value = strdup(val_str)) == NULL) {
+
+      pos = next;
+   }
+   
+   /* check for terminating empty line */
+   if (next == NULL) {
+      errno = EBADMSG;
+      return -1;
+   }
+   req->hm_line.reql.hdrs_end = next - text;
+
+   return 0;
+}
+
+/* request_insert_header()
+ * DESC: appends parsed header _hdr_ to the header list of request _req_. If the header is
+ *       well-known (see webserv-hdrs.def), its index is also recorded in the request's
+ *       header slot array.
+ * RETV: 0 on success, -1 on error.
+ * NOTE: only allocates (from _req_'s arena) once the inline header array (of length
+ *       HM_REQHDRS_INIT) is full.
+ */
+int request_insert_header(const httpreq_header_t *hdr, httpmsg_t *req) {
+   httpreq_line_t *reql;
+   size_t ext_i;
+   int id;
+
+   reql = &req->hm_line.reql;
+
+   /* record slot of well-known header (first occurrence only) */
+   id = hm_hdr_lookup(message_slice(&hdr->key, req), hdr->key.len);
+   if (id != HM_HID_NONE && reql->hdr_slots[id] == 0 && reql->nhdrs < USHRT_MAX) {
+      reql->hdr_slots[id] = reql->nhdrs + 1;
+   }
+   
+   if (reql->nhdrs < HM_REQHDRS_INIT) {
+      reql->hdrs[reql->nhdrs++] = *hdr;
+      return 0;
+   }
+
+   /* expand overflow array if full */
+   ext_i = reql->nhdrs - HM_REQHDRS_INIT;
+   if (ext_i == reql->hdrs_ext_len) {
+      size_t new_len;
+      httpreq_header_t *new_ext;
+      
+      new_len = smax(HM_REQHDRS_INIT, reql->hdrs_ext_len * 2);
+      new_ext = arena_realloc(reql->hdrs_ext, reql->hdrs_ext_len * sizeof(*new_ext),
+                              new_len * sizeof(*new_ext), &req->hm_arena);
+      if (new_ext == NULL) {
          return -1;
       }
+      reql->hdrs_ext = new_ext;
+      reql->hdrs_ext_len = new_len;
    }
 
-   req->hm_headers_endp = header_it;
+   reql->hdrs_ext[ext_i] = *hdr;
+   ++reql->nhdrs;
 
    return 0;
 }
 
+/* request_uri(): returns the ('\0'-terminated) normalized URI of parsed request _req_
+ * (the canonical path of the resource, see hr_uri_normalize()). */
+const char *request_uri(const httpmsg_t *req) {
+   return message_slice(&req->hm_line.reql.uri, req);
+}
+
+/* request_version(): returns the HTTP version (w/o HTTP/ prefix) of parsed request _req_. */
+const char *request_version(const httpmsg_t *req) {
+   return message_slice(&req->hm_line.reql.version, req);
+}
+
+/* request_nheaders(): returns the number of headers in parsed request _req_. */
+size_t request_nheaders(const httpmsg_t *req) {
+   return req->hm_line.reql.nhdrs;
+}
+
+/* request_header_at()
+ * DESC: returns the _index_-th header of parsed request _req_, or NULL if out of range.
+ */
+const httpreq_header_t *request_header_at(size_t index, const httpmsg_t *req) {
+   const httpreq_line_t *reql;
+
+   reql = &req->hm_line.reql;
+   if (index >= reql->nhdrs) {
+      return NULL;
+   }
+   return (index < HM_REQHDRS_INIT) ? &reql->hdrs[index] : &reql->hdrs_ext[index - HM_REQHDRS_INIT];
+}
+
+/* request_header_known()
+ * DESC: finds the value of the first header with well-known ID _id_ in parsed request
+ *       _req_ (an O(1) lookup).
+ * RETV: returns the ('\0'-terminated) value if found; otherwise, returns NULL.
+ */
+const char *request_header_known(httpmsg_hdrid_t id, const httpmsg_t *req) {
+   unsigned short slot;
+
+   if ((slot = req->hm_line.reql.hdr_slots[id]) == 0) {
+      return NULL;
+   }
+   return message_slice(&request_header_at(slot - 1, req)->value, req);
+}
+
+/* request_header_get()
+ * DESC: finds the value of the first header with key _key_ (compared case-insensitively)
+ *       in parsed request _req_.
+ * RETV: returns the ('\0'-terminated) value if found; otherwise, returns NULL.
+ * NOTE: well-known headers are looked up via request_header_known(); others require a
+ *       scan of the header list.
+ */
+const char *request_header_get(const char *key, const httpmsg_t *req) {
+   const httpreq_header_t *hdr;
+   int id;
+
+   if ((id = hm_hdr_lookup(key, strlen(key))) != HM_HID_NONE) {
+      return request_header_known(id, req);
+   }
+   
+   for (size_t i = 0; (hdr = request_header_at(i, req)); ++i) {
+      if (message_slice_casecmp(&hdr->key, key, req) == 0) {
+         return message_slice(&hdr->value, req);
+      }
+   }
+   return NULL;
+}
+
 /* request_delete(): delete request. */
 void request_delete(httpmsg_t *req) {
-   /* delete message members */
+   /* abort body reception (if any) */
+   request_body_delete(req);
+   
+   /* delete message members (incl. overflow headers in arena) */
    message_delete(req);
 
-   /* delete request members */
-   if (req) {
-      free(req->hm_line.reql.uri);
-      free(req->hm_line.reql.version);
-   }
-
    /* zero out record */
    memset(req, 0, sizeof(httpmsg_t));
 }
@@ -194,29 +464,30 @@ void request_delete(httpmsg_t *req) {
  * ARGS:
  *  - docroot: the root directory in which to look for the resource.
  *  - pathp: pointer to path string in which the full path will be returned.
+ *  - statp: pointer to file status in which the resource's status will be returned.
  *  - req: request.
  * RETV: returns the HTTP response status code (C_*) for the request upon success,
  *       -1 on error.
  * NOTE:
- *  - only upon return value C_OK is the path allocated and stored at *pathp.
- *    In this case, *pathp must be freed after use. Otherwise, *pathp is undefined.
+ *  - only upon return value C_OK are the path & status stored at *pathp & *statp. The
+ *    path is allocated from _req_'s arena (freed by request_delete()). Otherwise, *pathp
+ *    and *statp are undefined.
  */
-int request_document_find(const char *docroot, char **pathp, httpmsg_t *req) {
+int request_document_find(const char *docroot, char **pathp, struct stat *statp,
+                          httpmsg_t *req) {
    const char *rsrc;
-   struct stat rsrc_stat;
    int st_mode;
 
    /* locate resource in request line */
-   rsrc = req->hm_line.reql.uri;
+   rsrc = request_uri(req);
 
    /* get entire path */
-   if (smprintf(pathp, "%s%s", docroot, rsrc) < 0) {
+   if (arena_sprintf(pathp, &req->hm_arena, "%s%s", docroot, rsrc) < 0) {
       return -1;
    }
 
    /* stat resource */
-   if (stat(*pathp, &rsrc_stat) < 0) {
-      free(*pathp);
+   if (stat(*pathp, statp) < 0) {
       switch (errno) {
       case EACCES:
          return C_FORBIDDEN;
@@ -228,14 +499,12 @@ int request_document_find(const char *docroot, char **pathp, httpmsg_t *req) {
       }
    }
 
-   st_mode = rsrc_stat.st_mode;
+   st_mode = statp->st_mode;
 
    /* check if resource exists & have read permissions */
    if (!(S_ISREG(st_mode) && (st_mode | S_IROTH))) {
-      free(*pathp);
       return C_FORBIDDEN;
    }
 
-   /* only here does pathp remain allocated */
    return C_OK;
 }
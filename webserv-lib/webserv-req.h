@@ -2,6 +2,8 @@
 #define __WEBSERV_REQ_H
 
 /* required headers */
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "webserv-msg.h"
 
 /* constants */
@@ -14,9 +16,21 @@ enum {
 
 /* prototypes */
 void request_init(httpmsg_t *req);
-int request_read(int conn_fd, httpmsg_t *req);
+int request_read(int conn_fd, httpmsg_t *req, bufpool_t *pool);
 int request_parse(httpmsg_t *req);
+int request_buffered(const httpmsg_t *req);
+ssize_t request_next(httpmsg_t *req);
+int request_keepalive(const httpmsg_t *req);
+int request_hastoken(const char *list, const char *token);
+int request_insert_header(const httpreq_header_t *hdr, httpmsg_t *req);
+const char *request_uri(const httpmsg_t *req);
+const char *request_version(const httpmsg_t *req);
+size_t request_nheaders(const httpmsg_t *req);
+const httpreq_header_t *request_header_at(size_t index, const httpmsg_t *req);
+const char *request_header_known(httpmsg_hdrid_t id, const httpmsg_t *req);
+const char *request_header_get(const char *key, const httpmsg_t *req);
 void request_delete(httpmsg_t *req);
-int request_document_find(const char *docroot, char **pathp, httpmsg_t *req);
+int request_document_find(const char *docroot, char **pathp, struct stat *statp,
+                          httpmsg_t *req);
 
 #endif
@@ -11,7 +11,9 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <fcntl.h>
-#include <sys/utsname.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "webserv-util.h"
 #include "webserv-dbg.h"
 #include "webserv-res.h"
@@ -21,30 +23,40 @@ void response_init(httpmsg_t *res) {
    message_init(res);
 }
 
-/* response_delete(): delete response. */
+/* response_delete(): delete response (all of its members are in its arena). */
 void response_delete(httpmsg_t *res) {
    message_delete(res);
-
-   /* delete response members */
-   if (res) {
-      free(res->hm_line.resl.version);
-   }
 }
 
 /* response_send()
  * DESC: send response (NONBLOCKING/ASYNCHRONOUS).
  * ARGS:
  *  - conn_fd: client socket to send response over.
+ *  - quantum: maximum number of bytes to send in this call (0 for no limit), so other
+ *             connections get their turn.
+ *  - flags: RES_CORK to cork the socket (TCP_CORK) from the first byte of the response
+ *           until the last, so the header and body go out in full segments whichever
+ *           calls they are sent in; 0 otherwise.
  *  - res: response to send.
- * RETV: 0 if response finished sending; -1 if sending would block OR error occurred.
+ * RETV: 0 if response finished sending; -1 if sending would block, the quantum was used up,
+ *       OR an error occurred.
+ * ERRS:
+ *  - EAGAIN: sending would block or the quantum was used up.
+ *  - see sendmsg(2), setsockopt(2), response_format()
  * NOTE:
  *  - use message_error() to determine the cause of the error.
  *  - to send a response, response_send() will likely need to be called multiple times
- *    on the same response _res_.
+ *    on the same response _res_ (with the same _flags_).
+ *  - uncorking flushes the last, partial segment at once, so a corked response never
+ *    waits for Nagle's algorithm (or the 200 ms cork timeout) at its end.
  */
 int response_format(httpmsg_t *res);
-int response_send(int conn_fd, httpmsg_t *res) {
-   ssize_t bytes_sent, bytes_left;
+int response_send(int conn_fd, size_t quantum, int flags, httpmsg_t *res) {
+   ssize_t bytes_sent;
+   size_t text_left, body_left, allowed;
+   struct iovec iov[2];
+   struct msghdr mh = {0};
+   int cork;
 
    /* format response if necessary */
    if (res->hm_text == NULL) {
@@ -53,21 +65,82 @@ int response_send(int conn_fd, httpmsg_t *res) {
       }
    }
 
-   /* send response (nonblocking) */
-   bytes_left = message_textfree(res);
-   while (bytes_left > 0) {
-      bytes_sent = send(conn_fd, res->hm_text_ptr, bytes_left, MSG_DONTWAIT);
-      if (bytes_sent < 0) {
+   /* cork socket before the first byte goes out */
+   if ((flags & RES_CORK) && res->hm_text_ptr == res->hm_text
+       && res->hm_body_ptr == res->hm_body) {
+      cork = 1;
+      if (setsockopt(conn_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) < 0) {
+         return -1;
+      }
+   }
+
+   /* send response head & body (nonblocking) */
+   text_left = message_textfree(res);
+   body_left = res->hm_body_size - (res->hm_body_ptr - res->hm_body);
+   mh.msg_iov = iov;
+   mh.msg_iovlen = 2;
+   allowed = quantum ? quantum : SIZE_MAX;
+   while (text_left + body_left > 0) {
+      if (allowed == 0) {
+         errno = EAGAIN; // quantum used up
          return -1;
       }
-      res->hm_text_ptr += bytes_sent;
-      bytes_left -= bytes_sent;
+      iov[0].iov_base = res->hm_text_ptr;
+      iov[0].iov_len = smin(text_left, allowed);
+      iov[1].iov_base = res->hm_body_ptr;
+      iov[1].iov_len = smin(body_left, allowed - iov[0].iov_len);
+      if ((bytes_sent = sendmsg(conn_fd, &mh, MSG_DONTWAIT)) < 0) {
+         return -1;
+      }
+      allowed -= bytes_sent;
+
+      /* advance past sent text, then body */
+      if ((size_t) bytes_sent <= text_left) {
+         res->hm_text_ptr += bytes_sent;
+         text_left -= bytes_sent;
+      } else {
+         res->hm_text_ptr += text_left;
+         res->hm_body_ptr += bytes_sent - text_left;
+         body_left -= bytes_sent - text_left;
+         text_left = 0;
+      }
    };
+
+   /* uncork socket to flush the last segment */
+   if (flags & RES_CORK) {
+      cork = 0;
+      if (setsockopt(conn_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) < 0) {
+         return -1;
+      }
+   }
                          
    return 0;
 }
 
 
+/* response_remaining()
+ * DESC: returns the number of bytes of response _res_ that remain to be sent by
+ *       response_send() (only the body, if the response has not been formatted yet).
+ */
+size_t response_remaining(const httpmsg_t *res) {
+   size_t body_left;
+
+   body_left = res->hm_body_size - (res->hm_body_ptr - res->hm_body);
+   return res->hm_text ? message_textfree(res) + body_left : body_left;
+}
+
+/* response_sent()
+ * DESC: returns the number of bytes of response _res_ that response_send() has sent so far
+ *       (head & body).
+ */
+size_t response_sent(const httpmsg_t *res) {
+   size_t text_sent;
+
+   text_sent = res->hm_text ? res->hm_text_ptr - res->hm_text : 0;
+   return text_sent + (res->hm_body_ptr - res->hm_body);
+}
+
+
 /* response_find_status()
  * DESC: convert status code to status phrase.
  * ARGS:
@@ -76,14 +149,26 @@ int response_send(int conn_fd, httpmsg_t *res) {
  * ERRS:
  *  - EINVAL: _code_ is not a valid status code.
  */
-static httpres_stat_t hr_stats[] = {
+static const httpres_stat_t hr_stats[] = {
    {C_OK, "OK"},
+   {C_CREATED, "Created"},
+   {C_NOCONTENT, "No Content"},
+   {C_NOTMODIFIED, "Not Modified"},
+   {C_BADREQUEST, "Bad Request"},
    {C_NOTFOUND, "Not found"},
    {C_FORBIDDEN, "Forbidden"},
+   {C_NOTALLOWED, "Method Not Allowed"},
+   {C_LENGTHREQ, "Length Required"},
+   {C_TOOLARGE, "Content Too Large"},
+   {C_TOOMANY, "Too Many Requests"},
+   {C_HDRTOOLARGE, "Request Header Fields Too Large"},
+   {C_SERVERERROR, "Internal Server Error"},
+   {C_NOTIMPLEMENTED, "Not Implemented"},
+   {C_UNAVAILABLE, "Service Unavailable"},
    {0, 0}
 };
-httpres_stat_t *response_find_status(int code) {
-   httpres_stat_t *stat_it;
+const httpres_stat_t *response_find_status(int code) {
+   const httpres_stat_t *stat_it;
 
    /* find response status with matching code
     * (note: stat_it->phrase will be NULL at end of list)
@@ -104,7 +189,7 @@ httpres_stat_t *response_find_status(int code) {
  *  - value: header value (the part that follows the colon, w/o leading space).
  *  - res: response to which the header shall be added.
  * RETV: returns 0 upon success, -1 upon error.
- * NOTE: prints errors.
+ * NOTE: prints errors. _key_ and _val_ are copied into _res_'s arena.
  */
 int response_insert_header(const char *key, const char *val, httpmsg_t *res) {
    httpmsg_header_t *hdr;
@@ -123,12 +208,9 @@ int response_insert_header(const char *key, const char *val, httpmsg_t *res) {
    hdr = res->hm_headers_endp++;
    
    /* dup strings & insert into header */
-   if ((hdr->key = strdup(key)) == NULL) {
-      perror("strdup");
-      return -1;
-   }
-   if ((hdr->value = strdup(val)) == NULL) {
-      perror("strdup");
+   if ((hdr->key = arena_strdup(key, &res->hm_arena)) == NULL
+       || (hdr->value = arena_strdup(val, &res->hm_arena)) == NULL) {
+      perror("arena_strdup");
       return -1;
    }
   
@@ -145,9 +227,8 @@ int response_insert_header(const char *key, const char *val, httpmsg_t *res) {
  *  - res: pointer to HTTP response
  * RETV: 0 on success, -1 on error.
  */
+int response_insert_bodyhdrs(size_t bodylen, const char *type, httpmsg_t *res);
 int response_insert_body(const void *body, size_t bodylen, const char *type, httpmsg_t *res) {
-   char *bodylen_str;
-
    /* resize response's text */
    if (message_resize_body(bodylen, res) < 0) {
       return -1;
@@ -161,24 +242,58 @@ int response_insert_body(const void *body, size_t bodylen, const char *type, htt
    //   res->hm_body_rwp = res->hm_body + bodylen;
    res->hm_body_ptr = res->hm_body;
 
+   return response_insert_bodyhdrs(bodylen, type, res);
+}
+
+/* response_insert_ref()
+ * DESC: like response_insert_body(), but the body is sent from where it is (it is not
+ *       copied). The holder _ref_ of the body is released by calling _unref(ref)_ once the
+ *       response is deleted; the body must stay valid until then.
+ * RETV: 0 on success, -1 on error (_ref_ is released by response_delete() either way).
+ */
+int response_insert_ref(const void *body, size_t bodylen, const char *type,
+                        void (*unref)(void *), void *ref, httpmsg_t *res) {
+   res->hm_body_unref = unref;
+   res->hm_body_ref = ref;
+   res->hm_body = res->hm_body_ptr = (char *) body;
+   res->hm_body_size = bodylen;
+
+   return response_insert_bodyhdrs(bodylen, type, res);
+}
+
+/* response_insert_bodyhdrs()
+ * DESC: inserts the Content-Type (_type_) & Content-Length (_bodylen_) headers of a body
+ *       into response _res_.
+ * RETV: 0 on success, -1 on error.
+ */
+int response_insert_bodyhdrs(size_t bodylen, const char *type, httpmsg_t *res) {
+   char *bodylen_str;
+
    /* add Content-Type header */
    if (response_insert_header(HM_HDR_CONTENTTYPE, type, res) < 0) {
       return -1;
    }
 
    /* add Content-Length header */
-   if (smprintf(&bodylen_str, "%zu", bodylen) < 0) {
+   if (arena_sprintf(&bodylen_str, &res->hm_arena, "%zu", bodylen) < 0) {
       return -1;
    }
    if (response_insert_header(HM_HDR_CONTENTLEN, bodylen_str, res) < 0) {
-      free(bodylen_str);
       return -1;
    }
 
-   free(bodylen_str);
    return 0;
 }
 
+/* response_omit_body()
+ * DESC: drops the body of response _res_ but keeps its headers (including Content-Length),
+ *       e.g. to answer a HEAD request.
+ */
+void response_omit_body(httpmsg_t *res) {
+   res->hm_body_size = 0;
+   res->hm_body_ptr = res->hm_body;
+}
+
 
 /* response_insert_line()
  * DESC: create and add HTTP response line into response _res_.
@@ -189,7 +304,7 @@ int response_insert_body(const void *body, size_t bodylen, const char *type, htt
  * RETV: 0 on success, -1 on error.
  */
 int response_insert_line(int code, const char *version, httpmsg_t *res) {
-   httpres_stat_t *status;
+   const httpres_stat_t *status;
    
    /* match code to response status */
    if ((status = response_find_status(code)) == NULL) {
@@ -198,130 +313,62 @@ int response_insert_line(int code, const char *version, httpmsg_t *res) {
    res->hm_line.resl.status = status;
 
    /* copy version into response */
-   if ((res->hm_line.resl.version = strdup(version)) == NULL) {
+   if ((res->hm_line.resl.version = arena_strdup(version, &res->hm_arena)) == NULL) {
       return -1;
    }
 
    return 0;
 }
 
-/* response_format_headers()
- * DESC: format HTTP response _res_'s headers as sendable string.
- * RETV: pointer to malloc'ed string on success; NULL on error.
- * NOTE: caller needs to free(3) returned non-NULL pointer after use.
- */
-char *response_format_headers(httpmsg_t *res) {
-   char *hdrs_str, *hdrs_str_it;
-   size_t hdrs_str_len, hdrs_str_rem;
-   httpmsg_header_t *hdr_it;
-   
-   if ((hdrs_str = strdup("")) == NULL) {
-      return NULL;
-   }
-   hdrs_str_len = 0;
-   hdrs_str_rem = 0;
-   
-   for (hdr_it = res->hm_headers, hdrs_str_it = hdrs_str;
-        hdr_it != res->hm_headers_endp;
-        ++hdr_it, hdrs_str_it = strchr(hdrs_str_it, '\0')) {
-      
-      size_t chars;
-      
-      /* calculate remaining free bytes in header string buffer */
-      hdrs_str_rem = hdrs_str_len - (hdrs_str_it - hdrs_str);
-      
-      /* try to print header to buffer */
-      chars = snprintf(hdrs_str_it, hdrs_str_rem + 1, "%s"HM_HDR_SEP"%s"HM_ENT_TERM,
-                       hdr_it->key, hdr_it->value);
-         
-         /* if snprintf failed due to not enough space, reallocate buffer & repeat */
-         while (chars > hdrs_str_rem) {
-            char *hdrs_newstr;
-            
-            /* resize headers string */
-            hdrs_str_len = smax(HM_HDRSTR_INIT, hdrs_str_len * 2);
-            hdrs_newstr = realloc(hdrs_str, hdrs_str_len + 1); // +1 for '\0'
-            if (hdrs_newstr == NULL) {
-               free(hdrs_str);
-               return NULL;
-            }
-            
-            /* recompute buffer iterator & assign new buffer */
-            hdrs_str_it = hdrs_newstr + (hdrs_str_it - hdrs_str);
-            hdrs_str = hdrs_newstr;
-            hdrs_str_rem = hdrs_str_len - (hdrs_str_it - hdrs_str);
-            
-            /* try printing again */
-            chars = snprintf(hdrs_str_it, hdrs_str_rem + 1, "%s"HM_HDR_SEP"%s"HM_ENT_TERM,
-                             hdr_it->key, hdr_it->value);
-         }
-      }
-
-   return hdrs_str;
-}
-
 /* response_format()
- * DESC: format response (formatted buffer is stored internally in response).
+ * DESC: format response line & headers (formatted buffer is stored internally in response,
+ *       allocated from its arena). The body is sent from its own buffer by response_send().
  * RETV: 0 on success, -1 on error.
  * NOTE: prints errors.
  */
 int response_format(httpmsg_t *res) {
-   const char *res_fmt;
-   char *hdrs_str, *version;
+   const char *line_fmt;
+   char *text_it;
    const httpres_line_t *line;
    const httpres_stat_t *status;
+   httpmsg_header_t *hdr_it;
+   int line_len;
+   size_t text_len;
 
-   /* format headers string */
-   if ((hdrs_str = response_format_headers(res)) == NULL) {
-      return -1;
-   }
-   
-   /* format & send message */
-   res_fmt =
-      HM_VERSION_PREFIX"%s %d %s"HM_ENT_TERM   // response line
-      "%s"HM_ENT_TERM;                         // response headers
-   
+   line_fmt = HM_VERSION_PREFIX"%s %d %s"HM_ENT_TERM;
    line = &res->hm_line.resl;
    status = line->status;
-   version = line->version;
    
-   /* calculate total length of message */
-   int base_len;
-   size_t msg_len;
-   base_len = snprintf(NULL, 0, res_fmt, version, status->code, status->phrase, hdrs_str);
-   if (base_len < 0) {
+   /* calculate total length of response line & headers */
+   line_len = snprintf(NULL, 0, line_fmt, line->version, status->code, status->phrase);
+   if (line_len < 0) {
       perror("snprintf");
-      free(hdrs_str);
       return -1;
    }
+   text_len = line_len + strlen(HM_ENT_TERM);
+   for (hdr_it = res->hm_headers; hdr_it != res->hm_headers_endp; ++hdr_it) {
+      text_len += strlen(hdr_it->key) + strlen(HM_HDR_SEP) + strlen(hdr_it->value)
+         + strlen(HM_ENT_TERM);
+   }
    
-   /* allocate message */
-   msg_len = base_len + res->hm_body_size;
-   if ((res->hm_text = malloc(msg_len + 1)) == NULL) { // +1 if no body & need to write '\0'
-      perror("malloc");
-      free(hdrs_str);
-      return -1;
-   };
-   
-   /* copy data into message */
-   if (sprintf(res->hm_text, res_fmt, version, status->code, status->phrase, hdrs_str) < 0) {
-      perror("sprintf");
-      free(hdrs_str);
+   /* allocate text (+1 for '\0' written by sprintf(3)) */
+   if ((res->hm_text = arena_alloc(text_len + 1, &res->hm_arena)) == NULL) {
+      perror("arena_alloc");
       return -1;
    }
-   if (res->hm_body) {
-      memcpy(res->hm_text + base_len, res->hm_body, res->hm_body_size);
+   
+   /* copy line & headers into text */
+   text_it = res->hm_text;
+   text_it += sprintf(text_it, line_fmt, line->version, status->code, status->phrase);
+   for (hdr_it = res->hm_headers; hdr_it != res->hm_headers_endp; ++hdr_it) {
+      text_it += sprintf(text_it, "%s"HM_HDR_SEP"%s"HM_ENT_TERM, hdr_it->key, hdr_it->value);
    }
+   strcpy(text_it, HM_ENT_TERM);
    
    /* update response fields */
    res->hm_text_ptr = res->hm_text;
-   res->hm_text_size = msg_len;
-
-   if (DEBUG) {
-      fprintf(stderr, "formatted response (showing headers only):\n%s", hdrs_str);
-   }
-   
-   free(hdrs_str);
+   res->hm_text_size = text_len;
+   res->hm_body_ptr = res->hm_body;
    
    return 0;
 }
@@ -340,14 +387,13 @@ int response_insert_file(const char *path, httpmsg_t *res, const filetype_table_
    int fd;
    struct stat fd_info;
    off_t fd_size;
-   char *last_mod;
+   char last_mod[HM_DATE_LEN];
    char *body;
    const char *content_type;
    int retv;
 
    /* initialize variables (checked at cleanup) */
    fd = -1;
-   last_mod = NULL;
    body = MAP_FAILED;
    retv = -1; // error by default
    
@@ -362,19 +408,20 @@ int response_insert_file(const char *path, httpmsg_t *res, const filetype_table_
    }
    fd_size = fd_info.st_size;
 
-   /* map file into memory */
-   if ((body = mmap(NULL, fd_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+   /* map file into memory (an empty file can't be mapped, & needn't be) */
+   if (fd_size > 0
+       && (body = mmap(NULL, fd_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
       goto cleanup;
    }
 
    /* insert into response as body */
    content_type = content_type_get(path, ftypes);
-   if (response_insert_body(body, fd_size, content_type, res) < 0) {
+   if (response_insert_body(fd_size > 0 ? body : "", fd_size, content_type, res) < 0) {
       goto cleanup;
    }
    
    /* insert Last-Modified header */
-   if (hm_fmtdate(&fd_info.st_mtim.tv_sec, &last_mod) < 0) {
+   if (hm_fmtdate(&fd_info.st_mtim.tv_sec, last_mod) < 0) {
       goto cleanup;
    }
    if (response_insert_header(HM_HDR_LASTMODIFIED, last_mod, res) < 0) {
@@ -395,34 +442,26 @@ int response_insert_file(const char *path, httpmsg_t *res, const filetype_table_
          retv = -1;
       }
    }
-   if (last_mod) {
-      free(last_mod);
-   }
    
    return retv;
 }
 
 
 /* response_insert_genhdrs()
- * DESC: insert general headers into response.
+ * DESC: insert general headers into response (the date is taken from worker context _ctx_'s
+ *       clock cache).
  * RETV: 0 on success, -1 on error.
  */
-int response_insert_genhdrs(httpmsg_t *res) {
-   time_t curtime;
-   char *date;
+int response_insert_genhdrs(webserv_ctx_t *ctx, httpmsg_t *res) {
+   const char *date;
 
    /* Date */
-   curtime = time(NULL);
-   if (hm_fmtdate(&curtime, &date) < 0) {
+   if ((date = webserv_ctx_date(ctx)) == NULL) {
       return -1;
    }
    if (response_insert_header(HM_HDR_DATE, date, res) < 0) {
-      free(date);
       return -1;
    }
-
-   /* cleanup */
-   free(date);
    
    return 0;
 }
@@ -431,25 +470,15 @@ int response_insert_genhdrs(httpmsg_t *res) {
  * DESC: insert server-specific headers into response (HM_HDR_SERVER, HM_HDR_CONNECTION).
  * RETV: 0 on success, -1 on error.
  */
-int response_insert_servhdrs(const char *servname, httpmsg_t *res) {
-   struct utsname sysinfo;
-   char *serv;
-   
+int response_insert_servhdrs(const webserv_ctx_t *ctx, httpmsg_t *res) {
    /* Server */
-   if (uname(&sysinfo) < 0) {
-      return -1;
-   }
-   if (smprintf(&serv, "%s/%s %s", sysinfo.sysname, sysinfo.release, servname) < 0) {
-      return -1;
-   }
-   if (response_insert_header(HM_HDR_SERVER, serv, res) < 0) {
-      free(serv);
+   if (response_insert_header(HM_HDR_SERVER, ctx->servhdr, res) < 0) {
       return -1;
    }
-   free(serv);
 
    /* Connection */
-   if (response_insert_header(HM_HDR_CONNECTION, "close", res) < 0) {
+   if (response_insert_header(HM_HDR_CONNECTION, ctx->keepalive ? HM_KEEPALIVE : HM_CLOSE,
+                              res) < 0) {
       return -1;
    }
    
@@ -4,13 +4,29 @@
 /* required headers */
 #include "webserv-msg.h"
 #include "webserv-contype.h"
+#include "webserv-ctx.h"
 
 /* macros/defines */
 
 /* HTTP response codes */
-#define C_OK        200
-#define C_NOTFOUND  404
-#define C_FORBIDDEN 403
+#define C_OK            200
+#define C_CREATED       201
+#define C_NOCONTENT     204
+#define C_NOTMODIFIED   304
+#define C_BADREQUEST    400
+#define C_FORBIDDEN     403
+#define C_NOTFOUND      404
+#define C_NOTALLOWED    405
+#define C_LENGTHREQ     411
+#define C_TOOLARGE      413
+#define C_TOOMANY       429
+#define C_HDRTOOLARGE   431
+#define C_SERVERERROR   500
+#define C_NOTIMPLEMENTED 501
+#define C_UNAVAILABLE   503
+
+/* response_send() flags */
+#define RES_CORK 0x1 // cork the socket while the response is being sent
 
 #define C_NOTFOUND_BODY  "Not Found"
 #define C_FORBIDDEN_BODY "Forbidden"
@@ -21,10 +37,15 @@ void response_delete(httpmsg_t *res);
 int response_insert_line(int code, const char *version, httpmsg_t *res);
 int response_insert_header(const char *key, const char *val, httpmsg_t *res);
 int response_insert_body(const void *body, size_t bodylen, const char *type, httpmsg_t *res);
+int response_insert_ref(const void *body, size_t bodylen, const char *type,
+                        void (*unref)(void *), void *ref, httpmsg_t *res);
+void response_omit_body(httpmsg_t *res);
 int response_insert_file(const char *path, httpmsg_t *res, const filetype_table_t *ftypes);
-int response_insert_genhdrs(httpmsg_t *res);
-int response_insert_servhdrs(const char *servname, httpmsg_t *res);
-httpres_stat_t *response_find_status(int code);
-int response_send(int conn_fd, httpmsg_t *res);
+int response_insert_genhdrs(webserv_ctx_t *ctx, httpmsg_t *res);
+int response_insert_servhdrs(const webserv_ctx_t *ctx, httpmsg_t *res);
+const httpres_stat_t *response_find_status(int code);
+int response_send(int conn_fd, size_t quantum, int flags, httpmsg_t *res);
+size_t response_remaining(const httpmsg_t *res);
+size_t response_sent(const httpmsg_t *res);
 
 #endif
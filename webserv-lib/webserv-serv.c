@@ -12,19 +12,28 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
+#include <strings.h>
+#include <stdint.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <stddef.h>
 //#include "webserv-lib.h"
 #include "webserv-util.h"
 #include "webserv-dbg.h"
 #include "webserv-serv.h"
 #include "webserv-req.h"
 #include "webserv-res.h"
+#include "webserv-body.h"
 
 /* server_start()
- * DESC: start the web server on port _port_ with backlog _backlog_.
+ * DESC: start the web server on port _port_ with listening socket options _opts_.
  * RETV: the server socket on success, -1 on error.
+ * NOTE: SO_REUSEADDR is always set, so the server can be restarted while connections
+ *       of its last run linger in TIME_WAIT.
  */
-int server_start(const char *port, int backlog) {
+int server_setopt(int fd, int level, int name, int val, const char *what);
+int server_start(const char *port, const server_listen_t *opts) {
    int servsock_fd;
    struct addrinfo *res;
    int gai_stat;
@@ -35,16 +44,9 @@ int server_start(const char *port, int backlog) {
    res = NULL;
    error = 0; // error=1 if error occurred
    
-   /* obtain socket */
-   if ((servsock_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-      perror("socket");
-      error = 1;
-      goto cleanup;
-   }
-
    /* get address info */
    struct addrinfo hints = {0};
-   hints.ai_family = AF_INET;
+   hints.ai_family = opts->ipv6 ? AF_INET6 : AF_INET;
    hints.ai_socktype = SOCK_STREAM;
    hints.ai_flags = AI_PASSIVE;
    if ((gai_stat = getaddrinfo(NULL, port, &hints, &res))) {
@@ -53,6 +55,26 @@ int server_start(const char *port, int backlog) {
       error = 1;
       goto cleanup;
    }
+
+   /* obtain socket */
+   if ((servsock_fd = socket(res->ai_family, SOCK_STREAM, 0)) < 0) {
+      perror("socket");
+      error = 1;
+      goto cleanup;
+   }
+
+   /* set options that must precede bind(2) */
+   if (server_setopt(servsock_fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") < 0
+       || (opts->ipv6
+           && server_setopt(servsock_fd, IPPROTO_IPV6, IPV6_V6ONLY, 0, "IPV6_V6ONLY") < 0)
+       || (opts->reuseport
+           && server_setopt(servsock_fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT") < 0)
+       || (opts->busy_poll
+           && server_setopt(servsock_fd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll,
+                            "SO_BUSY_POLL") < 0)) {
+      error = 1;
+      goto cleanup;
+   }
    
    /* bind socket to port */
    if (bind(servsock_fd, res->ai_addr, res->ai_addrlen) < 0) {
@@ -61,8 +83,19 @@ int server_start(const char *port, int backlog) {
       goto cleanup;
    }
 
+   /* set options that apply to the connections being accepted */
+   if ((opts->defer_accept
+        && server_setopt(servsock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept,
+                         "TCP_DEFER_ACCEPT") < 0)
+       || (opts->fastopen
+           && server_setopt(servsock_fd, IPPROTO_TCP, TCP_FASTOPEN, opts->fastopen,
+                            "TCP_FASTOPEN") < 0)) {
+      error = 1;
+      goto cleanup;
+   }
+
    /* listen for connections */
-   if (listen(servsock_fd, backlog) < 0) {
+   if (listen(servsock_fd, opts->backlog) < 0) {
       perror("listen");
       error = 1;
       goto cleanup;
@@ -83,82 +116,388 @@ int server_start(const char *port, int backlog) {
    return error ? -1 : servsock_fd;
 }
 
+/* server_start_unix()
+ * DESC: start the web server on Unix domain stream socket _path_ with backlog _backlog_,
+ *       for clients on the same host (e.g. a reverse proxy), which skip the TCP/IP stack.
+ * ARGS:
+ *  - path: filesystem path of the socket, or its name in the abstract namespace (which
+ *          leaves nothing behind) if it starts with SERVER_UNIX_ABSTRACT.
+ *  - mode: permissions of the socket file, which clients need write permission on (0 to
+ *          leave them as created; ignored for abstract sockets).
+ *  - backlog: see listen(2).
+ * RETV: the server socket on success, -1 on error.
+ * NOTE: a stale socket file (one nothing is listening on) is replaced; if a server is still
+ *       listening on it, bind(2) fails with EADDRINUSE.
+ */
+int server_unix_addr(const char *path, struct sockaddr_un *addr, socklen_t *addrlenp);
+int server_unix_stale(const struct sockaddr_un *addr, socklen_t addrlen);
+int server_start_unix(const char *path, mode_t mode, int backlog) {
+   int servsock_fd;
+   struct sockaddr_un addr;
+   socklen_t addrlen;
+   int abstract;
+   int error;
+
+   /* initialize variables */
+   servsock_fd = -1;
+   error = 0; // error=1 if error occurred
+   abstract = (path[0] == SERVER_UNIX_ABSTRACT);
+   if (server_unix_addr(path, &addr, &addrlen) < 0) {
+      perror("server_unix_addr");
+      return -1;
+   }
+
+   /* obtain socket */
+   if ((servsock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      perror("socket");
+      error = 1;
+      goto cleanup;
+   }
+
+   /* bind socket to path (replacing a stale socket file) */
+   if (bind(servsock_fd, (struct sockaddr *) &addr, addrlen) < 0
+       && (errno != EADDRINUSE || abstract || server_unix_stale(&addr, addrlen) <= 0
+           || unlink(path) < 0 || bind(servsock_fd, (struct sockaddr *) &addr, addrlen) < 0)) {
+      perror("bind");
+      error = 1;
+      goto cleanup;
+   }
+
+   /* set permissions (no client can connect until listen(2), so there is no window) */
+   if (mode && !abstract && chmod(path, mode) < 0) {
+      perror("chmod");
+      error = 1;
+      goto cleanup;
+   }
+
+   /* listen for connections */
+   if (listen(servsock_fd, backlog) < 0) {
+      perror("listen");
+      error = 1;
+      goto cleanup;
+   }
+
+ cleanup:
+   /* close server socket (if error occurred) */
+   if (error && servsock_fd >= 0 && close(servsock_fd) < 0) {
+      perror("close");
+   }
+
+   /* return -1 on error, server socket on success */
+   return error ? -1 : servsock_fd;
+}
+
+/* server_unix_addr()
+ * DESC: fills in Unix domain socket address _addr_ (and its length, _*addrlenp_) for
+ *       _path_ (see server_start_unix()).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - ENAMETOOLONG: _path_ doesn't fit in sun_path.
+ */
+int server_unix_addr(const char *path, struct sockaddr_un *addr, socklen_t *addrlenp) {
+   size_t len;
+
+   memset(addr, 0, sizeof(*addr));
+   addr->sun_family = AF_UNIX;
+   len = strlen(path);
+   if (len >= sizeof(addr->sun_path)) {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+   memcpy(addr->sun_path, path, len);
+   if (path[0] == SERVER_UNIX_ABSTRACT) {
+      /* abstract name: leading NUL, not NUL-terminated */
+      addr->sun_path[0] = '\0';
+      *addrlenp = offsetof(struct sockaddr_un, sun_path) + len;
+   } else {
+      *addrlenp = sizeof(*addr);
+   }
+   
+   return 0;
+}
+
+/* server_unix_stale()
+ * DESC: checks whether the socket file at address _addr_ is stale, i.e. nothing is
+ *       listening on it.
+ * RETV: 1 if it is stale, 0 if not (errno is set to EADDRINUSE), -1 on error.
+ */
+int server_unix_stale(const struct sockaddr_un *addr, socklen_t addrlen) {
+   int probe_fd;
+   int stale;
+
+   if ((probe_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      return -1;
+   }
+   stale = (connect(probe_fd, (const struct sockaddr *) addr, addrlen) < 0
+            && errno == ECONNREFUSED);
+   close(probe_fd);
+   if (!stale) {
+      errno = EADDRINUSE;
+   }
+
+   return stale;
+}
+
+/* server_setopt()
+ * DESC: sets integer socket option _name_ at level _level_ of socket _fd_ to _val_,
+ *       printing an error naming the option (_what_) if that fails.
+ * RETV: see setsockopt(2).
+ */
+int server_setopt(int fd, int level, int name, int val, const char *what) {
+   if (setsockopt(fd, level, name, &val, sizeof(val)) < 0) {
+      fprintf(stderr, "setsockopt(%s): %s\n", what, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
 
 /* server_accept
  * DESC: accept client connection.
  * ARGS:
  *  - servfd: server socket listening for connections.
+ *  - peer: where to return the client's address (e.g. for ratelim_key()).
  * RETV: see accept(2).
  * NOTE: blocks.
  */
-int server_accept(int servfd) {
+int server_accept(int servfd, struct sockaddr_storage *peer) {
    socklen_t addrlen;
-   struct sockaddr_in client_sa;
    int client_fd;
 
    /* accept socket */
-   addrlen = sizeof(client_sa);
-   client_fd = accept(servfd, (struct sockaddr *) &client_sa, &addrlen);
+   addrlen = sizeof(*peer);
+   client_fd = accept(servfd, (struct sockaddr *) peer, &addrlen);
 
    return client_fd;
 }
 
+/* server_conn_tcp()
+ * DESC: applies TCP write policy _tcp_ to newly accepted client connection _conn_fd_,
+ *       whose peer's address family is _family_ (the policy doesn't apply to AF_UNIX
+ *       connections, which have no segments).
+ * RETV: the flags to send the connection's responses with (see response_send()), or -1
+ *       on error.
+ * ERRS:
+ *  - see setsockopt(2)
+ * NOTE: SERVER_TCP_CORK leaves Nagle's algorithm on between responses, which doesn't
+ *       matter: every response is uncorked (and so flushed) once it has been sent.
+ */
+int server_conn_tcp(int conn_fd, sa_family_t family, server_tcp_t tcp) {
+   int one = 1;
+
+   if (family != AF_INET && family != AF_INET6) {
+      return 0;
+   }
+   switch (tcp) {
+   case SERVER_TCP_NODELAY:
+      if (setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+         return -1;
+      }
+      return 0;
+   case SERVER_TCP_CORK:
+      return RES_CORK;
+   default:
+      return 0;
+   }
+}
+
+/* server_reject()
+ * DESC: turns away a newly accepted connection without reading its request: sends it a
+ *       canned response with status _code_ (and no body), then closes it. Nothing is
+ *       allocated, so this is safe to do when the server is out of memory.
+ * ARGS:
+ *  - conn_fd: client socket (closed upon return).
+ *  - code: response status code (e.g. C_UNAVAILABLE).
+ *  - retry_after: seconds after which the client may retry (Retry-After header; 0 for
+ *                 none).
+ *  - stats: statistics to count the response in (NULL for none).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _code_ is not a valid status code.
+ *  - see close(2)
+ * NOTE: the response is sent without blocking; if it doesn't fit in the socket's send
+ *       buffer, it is cut off.
+ */
+int server_reject(int conn_fd, int code, unsigned retry_after, webserv_stats_t *stats) {
+   char text[SERVER_REJECT_MAX];
+   const httpres_stat_t *status;
+   int len;
+
+   if ((status = response_find_status(code)) == NULL) {
+      close(conn_fd);
+      return -1;
+   }
+   len = snprintf(text, sizeof(text), HM_VERSION_PREFIX HM_HTTP_VERSION " %d %s" HM_ENT_TERM,
+                  status->code, status->phrase);
+   if (retry_after) {
+      len += snprintf(text + len, sizeof(text) - len, HM_HDR_RETRYAFTER HM_HDR_SEP "%u"
+                      HM_ENT_TERM, retry_after);
+   }
+   len += snprintf(text + len, sizeof(text) - len,
+                   HM_HDR_CONTENTLEN HM_HDR_SEP "0" HM_ENT_TERM
+                   HM_HDR_CONNECTION HM_HDR_SEP HM_CLOSE HM_ENT_TERM HM_ENT_TERM);
+   send(conn_fd, text, smin(len, sizeof(text) - 1), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+   /* discard whatever the client has sent already, so closing doesn't reset the
+    * connection (and the response with it) */
+   shutdown(conn_fd, SHUT_WR);
+   while (recv(conn_fd, text, sizeof(text), MSG_DONTWAIT) > 0) {}
+   
+   if (stats) {
+      webserv_stats_count(code, stats);
+   }
+
+   return close(conn_fd);
+}
+
+
+/* method handlers, indexed by method (NULL if the method is not implemented) */
+static const server_handler_t server_handlers[M_NMETHODS] = {
+   [M_GET]     = server_handle_get,
+   [M_HEAD]    = server_handle_head,
+   [M_OPTIONS] = server_handle_options,
+   [M_PUT]     = server_handle_put,
+   [M_POST]    = server_handle_notallowed,
+};
 
 /* server_handle_req()
- * DESC: given HTTP request that has been fully read & parsed, create HTTP response.
+ * DESC: given HTTP request that has been fully read & parsed, create HTTP response by
+ *       dispatching to the request method's handler.
  * ARGS:
  *  - conn_fd: client socket to send response to.
- *  - docroot: the root directory to prepend resource requests to.
- *  - servname: name of server version.
+ *  - site: site being served (document root, server name, content types, limits).
+ *  - ctx: calling worker's context (clock cache, statistics).
  *  - req: pointer to request.
  *  - res: pointer to response to be created.
  * RETV: 0 on success, -1 on error.
  * ERRS:
  *  - EBADRQC: bad HTTP method in request.
- *  - see server_handle_get()
+ *  - see server_handle_get(), server_handle_put()
+ * NOTE:
+ *  - if request_body_pending(req) is true upon return, no response has been created
+ *    yet; call server_handle_body() until it has been.
+ *  - the handler runs in a read-side critical section of the site's content type table,
+ *    which it can access (lock-free) as ctx->ftypes.
+ *  - upon return, ctx->keepalive tells whether the connection is to be kept open after
+ *    the response (only if ctx->persist is set, see request_keepalive()).
  */
-int server_handle_req(int conn_fd, const char *docroot, const char *servname,
-                      httpmsg_t *req, httpmsg_t *res, const filetype_table_t *ftypes) {
-   switch (req->hm_line.reql.method) {
-   case M_GET:
-      return server_handle_get(conn_fd, docroot, servname, req, res, ftypes);
-   default:
+int server_handle_req(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res) {
+   httpreq_method_t method;
+   unsigned rcu_tok;
+   int retv;
+
+   method = req->hm_line.reql.method;
+   if (method <= M_NONE || method >= M_NMETHODS || server_handlers[method] == NULL) {
       errno = EBADRQC;
       return -1;
    }
+   WEBSERV_STATS_INC(ctx->stats.nreqs);
+   ctx->keepalive = ctx->persist && request_keepalive(req);
+
+   ctx->ftypes = rcu_read_lock(&rcu_tok, site->ftypes);
+   retv = server_handlers[method](conn_fd, site, ctx, req, res);
+   rcu_read_unlock(rcu_tok, site->ftypes);
+   ctx->ftypes = NULL;
+   
+   return retv;
+}
+
+/* server_site_reload()
+ * DESC: reloads the content type table of site _site_ (see content_types_open()) and
+ *       replaces the table in use once no request is using it any longer.
+ * ARGS:
+ *  - tabpath: path to types file.
+ *  - snappath: path to snapshot of types file (NULL for none).
+ *  - site: site to reload.
+ * RETV: 0 on success, -1 on error (the current table remains in use).
+ * NOTE: blocks for the grace period; call from a dedicated thread, never from a request
+ *       handler.
+ */
+int server_site_reload(const char *tabpath, const char *snappath, server_site_t *site) {
+   filetype_table_t *ftypes, *old;
+
+   if ((ftypes = malloc(sizeof(*ftypes))) == NULL) {
+      return -1;
+   }
+   if (content_types_open(tabpath, snappath, ftypes) < 0) {
+      free(ftypes);
+      return -1;
+   }
+
+   /* publish new table & wait for grace period */
+   old = rcu_swap(ftypes, site->ftypes);
+
+   /* cached metadata may refer to the old table's strings: drop it, then wait for
+    * requests that may have copied it before it was dropped */
+   if (site->meta) {
+      metacache_clear(site->meta);
+      rcu_synchronize(site->ftypes);
+   }
+   
+   content_types_delete(old);
+   free(old);
+
+   return 0;
+}
+
+/* server_site_reload_pack()
+ * DESC: maps archive _packpath_ (see pack_open()) and replaces the archive site _site_ is
+ *       served from once no request is looking in it any longer. Responses still being
+ *       sent from the old archive keep it mapped until they are done.
+ * RETV: 0 on success, -1 on error (the current archive remains in use).
+ * NOTE: blocks for the grace period (see server_site_reload()).
+ */
+int server_site_reload_pack(const char *packpath, server_site_t *site) {
+   pack_t *pack;
+
+   if ((pack = malloc(sizeof(*pack))) == NULL) {
+      return -1;
+   }
+   if (pack_open(packpath, pack) < 0) {
+      free(pack);
+      return -1;
+   }
+
+   /* publish new archive & drop the site's reference to the old one */
+   pack_unref(rcu_swap(pack, site->pack));
+
+   return 0;
 }
 
 
-// handle GET request
-// TODO: make case statement table-driven, not switch case
 /* server_handle_get()
  * DESC: given HTTP request with method "GET", create HTTP response.
  * ARGS: (see server_handle_req())
  * RETV: 0 on success, -1 on error.
  * ERRS: (see server_handle_req())
  */
-int server_handle_get(int conn_fd, const char *docroot, const char *servname, httpmsg_t *req,
-                      httpmsg_t *res, const filetype_table_t *ftypes) {
+int server_handle_get(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res) {
    char *path;
+   struct stat path_stat;
    int code;
 
-   /* create response */
+   if (site->pack) {
+      return server_handle_pack(0, site, ctx, req, res);
+   }
+
+   /* create response (allocating from the same pool as the request) */
    response_init(res);
+   message_set_pool(req->hm_pool, res);
    
    /* get response code & full path */
-   if ((code = request_document_find(docroot, &path, req)) < 0) {
+   if ((code = request_document_find(site->docroot, &path, &path_stat, req)) < 0) {
       response_delete(res);
       return -1;
    }
       
    /* insert file */
    if (code == C_OK) {
-      if (response_insert_file(path, res, ftypes) < 0) {
+      if (response_insert_file(path, res, ctx->ftypes) < 0) {
          response_delete(res);
-         free(path);
          return -1;
       }
-      free(path);
    } else {
       const char *body;
       switch (code) {
@@ -180,23 +519,459 @@ int server_handle_get(int conn_fd, const char *docroot, const char *servname, ht
       }
    }
 
-   /* insert general headers */
-   if (response_insert_genhdrs(res) < 0) {
+   /* finish response */
+   if (server_finish_res(code, ctx, res) < 0) {
       response_delete(res);
       return -1;
    }
+   
+   return 0;
+}
 
-   /* insert server headers */
-   if (response_insert_servhdrs(servname, res) < 0) {
+/* server_doc_info()
+ * DESC: looks up the document requested in _req_ and fills in its metadata _info_. If the
+ *       document hasn't changed (same size & modification time) since its stale metadata
+ *       _stale_ was cached, that is revalidated instead of worked out again.
+ * ARGS:
+ *  - stale: metadata cached for the document before (NULL if none).
+ *  - (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ */
+int server_doc_info(const server_site_t *site, webserv_ctx_t *ctx,
+                    const metacache_info_t *stale, metacache_info_t *info, httpmsg_t *req) {
+   char *path;
+   struct stat path_stat;
+   int code;
+
+   if ((code = request_document_find(site->docroot, &path, &path_stat, req)) < 0) {
+      return -1;
+   }
+   if (stale && code == C_OK && stale->code == C_OK && stale->size == path_stat.st_size
+       && stale->mtime.tv_sec == path_stat.st_mtim.tv_sec
+       && stale->mtime.tv_nsec == path_stat.st_mtim.tv_nsec) {
+      *info = *stale;
+      return 0;
+   }
+
+   memset(info, 0, sizeof(*info));
+   info->code = code;
+   if (info->code == C_OK) {
+      info->size = path_stat.st_size;
+      info->type = content_type_get(path, ctx->ftypes);
+      info->mtime = path_stat.st_mtim;
+      if (hm_fmtdate(&path_stat.st_mtim.tv_sec, info->last_mod) < 0) {
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+/* server_handle_head()
+ * DESC: given HTTP request with method "HEAD", create HTTP response (the headers of the
+ *       corresponding GET response, without body). The document's metadata is taken from
+ *       the site's metadata cache when fresh, so the document is never opened or read
+ *       (when stale, it is revalidated by the document's modification time).
+ * ARGS: (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ */
+int server_handle_head(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res) {
+   metacache_info_t info, stale;
+   const char *uri;
+   char *size_str;
+   time_t now;
+   int cached;
+
+   if (site->pack) {
+      return server_handle_pack(1, site, ctx, req, res);
+   }
+
+   /* get document metadata */
+   uri = request_uri(req);
+   now = webserv_ctx_now(ctx);
+   cached = site->meta ? metacache_get(uri, now, &info, site->meta) : METACACHE_MISS;
+   if (cached != METACACHE_FRESH) {
+      /* (info is only set if stale) */
+      if (cached == METACACHE_STALE) {
+         stale = info;
+      } else {
+         memset(&stale, 0, sizeof(stale));
+      }
+      if (server_doc_info(site, ctx, cached == METACACHE_STALE ? &stale : NULL, &info,
+                          req) < 0) {
+         return -1;
+      }
+      if (site->meta) {
+         metacache_put(uri, now, &info, site->meta);
+      }
+   }
+
+   if (info.code != C_OK) {
+      if (server_create_err(info.code, ctx, res) < 0) {
+         return -1;
+      }
+      response_omit_body(res);
+      return 0;
+   }
+
+   /* create response */
+   response_init(res);
+   message_set_pool(req->hm_pool, res);
+   if (arena_sprintf(&size_str, &res->hm_arena, "%jd", (intmax_t) info.size) < 0
+       || response_insert_header(HM_HDR_CONTENTTYPE, info.type, res) < 0
+       || response_insert_header(HM_HDR_CONTENTLEN, size_str, res) < 0
+       || response_insert_header(HM_HDR_LASTMODIFIED, info.last_mod, res) < 0
+       || server_finish_res(C_OK, ctx, res) < 0) {
       response_delete(res);
       return -1;
    }
    
+   return 0;
+}
+
+/* server_handle_pack()
+ * DESC: given HTTP request with method "GET" (or "HEAD", if _head_ is set), create HTTP
+ *       response from the site's archive: the document is looked up without any system
+ *       calls, and its body is sent straight from the mapped archive (see pack_lookup()).
+ *       The precompressed variant is sent if there is one and the client accepts gzip;
+ *       304 (Not Modified) is sent if the client already has the current version.
+ * ARGS: (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ */
+int server_accepts_gzip(const httpmsg_t *req);
+int server_handle_pack(int head, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res) {
+   pack_t *pack;
+   const pack_ent_t *ent;
+   const char *etag, *inm;
+   unsigned rcu_tok;
+   int gzip, retv;
+
+   /* find document */
+   pack = rcu_read_lock(&rcu_tok, site->pack);
+   if ((ent = pack_lookup(request_uri(req), pack)) == NULL) {
+      rcu_read_unlock(rcu_tok, site->pack);
+      if (server_create_err(C_NOTFOUND, ctx, res) < 0) {
+         return -1;
+      }
+      if (head) {
+         response_omit_body(res);
+      }
+      return 0;
+   }
+
+   /* select representation */
+   response_init(res);
+   message_set_pool(req->hm_pool, res);
+   gzip = (ent->gz_off && server_accepts_gzip(req));
+   etag = pack->strs + (gzip ? ent->gz_etag : ent->etag);
+   inm = request_header_known(HM_HID_IFNONEMATCH, req);
+   if (inm && (request_hastoken(inm, etag) || request_hastoken(inm, "*"))) {
+      /* client's copy is current */
+      retv = (response_insert_header(SERVER_HDR_ETAG, etag, res) < 0
+              || (ent->gz_off && response_insert_header(SERVER_HDR_VARY, "Accept-Encoding",
+                                                        res) < 0)
+              || server_finish_res(C_NOTMODIFIED, ctx, res) < 0) ? -1 : 0;
+   } else {
+      /* body stays in archive, which the response keeps mapped */
+      pack_ref(pack);
+      retv = (response_insert_ref((char *) pack->map + (gzip ? ent->gz_off : ent->off),
+                                  gzip ? ent->gz_size : ent->size, pack->strs + ent->type,
+                                  (void (*)(void *)) pack_unref, pack, res) < 0
+              || response_insert_header(SERVER_HDR_ETAG, etag, res) < 0
+              || response_insert_header(HM_HDR_LASTMODIFIED, pack->strs + ent->last_mod,
+                                        res) < 0
+              || (gzip && response_insert_header(SERVER_HDR_ENCODING, SERVER_GZIP, res) < 0)
+              || (ent->gz_off && response_insert_header(SERVER_HDR_VARY, "Accept-Encoding",
+                                                        res) < 0)
+              || server_finish_res(C_OK, ctx, res) < 0) ? -1 : 0;
+      if (head) {
+         response_omit_body(res);
+      }
+   }
+   rcu_read_unlock(rcu_tok, site->pack);
+
+   if (retv < 0) {
+      response_delete(res);
+   }
+   return retv;
+}
+
+/* server_accepts_gzip()
+ * DESC: returns whether request _req_ accepts gzip content coding (Accept-Encoding lists
+ *       "gzip" or "*", without q=0).
+ */
+int server_accepts_gzip(const httpmsg_t *req) {
+   const char *list, *params;
+   size_t len;
+
+   if ((list = request_header_known(HM_HID_ACCEPTENCODING, req)) == NULL) {
+      return 0;
+   }
+   while (*list) {
+      list += strspn(list, " \t,");
+      len = strcspn(list, ",; \t");
+      if ((len == strlen(SERVER_GZIP) && strncasecmp(list, SERVER_GZIP, len) == 0)
+          || (len == 1 && *list == '*')) {
+         /* check quality value (params up to next element) */
+         params = list + len;
+         while (*params && *params != ',') {
+            params += strspn(params, " \t;");
+            if (strncasecmp(params, "q=", 2) == 0) {
+               return strtod(params + 2, NULL) > 0;
+            }
+            params += strcspn(params, ";,");
+         }
+         return 1;
+      }
+      list += strcspn(list, ",");
+   }
+
+   return 0;
+}
+
+/* server_handle_options()
+ * DESC: given HTTP request with method "OPTIONS", create HTTP response listing the
+ *       methods supported by the site.
+ * ARGS: (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ */
+int server_handle_options(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                          httpmsg_t *req, httpmsg_t *res) {
+   response_init(res);
+   message_set_pool(req->hm_pool, res);
+   if (response_insert_header(HM_HDR_ALLOW, site->maxbody ? SERVER_ALLOW_PUT : SERVER_ALLOW,
+                              res) < 0
+       || response_insert_header(HM_HDR_CONTENTLEN, "0", res) < 0
+       || server_finish_res(C_OK, ctx, res) < 0) {
+      response_delete(res);
+      return -1;
+   }
+
+   return 0;
+}
+
+/* server_handle_notallowed()
+ * DESC: create 405 (Method Not Allowed) response to request _req_, listing the methods
+ *       supported by the site.
+ * ARGS: (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ */
+int server_handle_notallowed(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                             httpmsg_t *req, httpmsg_t *res) {
+   if (server_create_err(C_NOTALLOWED, ctx, res) < 0) {
+      return -1;
+   }
+   return response_insert_header(HM_HDR_ALLOW, site->maxbody ? SERVER_ALLOW_PUT : SERVER_ALLOW,
+                                 res);
+}
+
+/* server_handle_put()
+ * DESC: given HTTP request with method "PUT", prepare to receive its body into the
+ *       requested file under the document root (see server_handle_body()). If the upload
+ *       is rejected, an error response is created instead; if the body is empty, it is
+ *       stored and the response created at once.
+ * ARGS: (see server_handle_req())
+ * RETV: 0 on success, -1 on error.
+ * NOTE: uploads are disabled (405) if the site's maximum body size is 0.
+ */
+int server_handle_put(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res) {
+   const char *uri, *expect;
+   char *path;
+   struct stat path_stat;
+   int code;
+
+   uri = request_uri(req);
+   if (site->maxbody == 0) {
+      return server_handle_notallowed(conn_fd, site, ctx, req, res);
+   } else if (*uri != '/') {
+      code = C_FORBIDDEN; // "*"
+   } else {
+      if (arena_sprintf(&path, &req->hm_arena, "%s%s", site->docroot, uri) < 0) {
+         return -1;
+      }
+      if (stat(path, &path_stat) == 0 && !S_ISREG(path_stat.st_mode)) {
+         code = C_FORBIDDEN;
+      } else if ((code = request_body_open(path, site->maxbody, req)) < 0) {
+         return -1;
+      }
+   }
+
+   if (code != C_OK) {
+      return server_create_err(code, ctx, res);
+   }
+
+   /* an empty body is complete already: store it & respond right away */
+   if (!request_body_pending(req)) {
+      return server_handle_body(conn_fd, site, ctx, req, res);
+   }
+
+   /* tell client to go ahead & send body */
+   expect = request_header_known(HM_HID_EXPECT, req);
+   if (expect && strcasecmp(expect, "100-continue") == 0) {
+      send(conn_fd, HM_CONTINUE, strlen(HM_CONTINUE), MSG_DONTWAIT | MSG_NOSIGNAL);
+   }
+
+   return 0;
+}
+
+/* server_handle_body()
+ * DESC: receive (more of) the body of a request accepted by server_handle_put()
+ *       (NONBLOCKING/ASYNCHRONOUS). Once the body is complete (or is rejected), create the
+ *       HTTP response.
+ * ARGS: (see server_handle_req())
+ * RETV: 0 once the response has been created, -1 if an error occurred OR reading would block.
+ * ERRS:
+ *  - see request_body_read() (use message_error() to determine the cause of the error)
+ * NOTE:
+ *  - client errors (MSG_ECLIENT) and file errors result in an error response, not -1.
+ *  - the response always closes the connection (ctx->keepalive is cleared).
+ */
+int server_handle_body(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res) {
+   struct stat path_stat;
+   int code;
+
+   ctx->keepalive = 0;
+   if (request_body_read(conn_fd, req) < 0) {
+      switch (message_error(errno)) {
+      case MSG_EAGAIN:
+      case MSG_ECONN:
+         return -1;
+      case MSG_ECLIENT:
+         code = server_err2code(errno);
+         break;
+      default:
+         perror("request_body_read");
+         code = C_SERVERERROR;
+         break;
+      }
+   } else {
+      /* move body into place */
+      code = (stat(req->hm_line.reql.body.path, &path_stat) == 0) ? C_NOCONTENT : C_CREATED;
+      if (request_body_commit(req) < 0) {
+         perror("request_body_commit");
+         code = C_SERVERERROR;
+      }
+      if (site->meta) {
+         metacache_remove(request_uri(req), site->meta);
+      }
+   }
+   request_body_delete(req);
+   
+   if (code != C_CREATED && code != C_NOCONTENT) {
+      return server_handle_err(code, ctx, res);
+   }
+   
+   /* create response */
+   response_init(res);
+   message_set_pool(req->hm_pool, res);
+   if ((code == C_CREATED && response_insert_header(HM_HDR_CONTENTLEN, "0", res) < 0)
+       || server_finish_res(code, ctx, res) < 0) {
+      response_delete(res);
+      return -1;
+   }
+   
+   return 0;
+}
+
+/* server_handle_err()
+ * DESC: create HTTP response with error status _code_ (and its status phrase as body), e.g.
+ *       for requests that could not be read or parsed. The response closes the connection.
+ * ARGS:
+ *  - code: HTTP status code (C_*).
+ *  - ctx: calling worker's context.
+ *  - res: pointer to response to be created.
+ * RETV: 0 on success, -1 on error.
+ */
+int server_handle_err(int code, webserv_ctx_t *ctx, httpmsg_t *res) {
+   ctx->keepalive = 0;
+   return server_create_err(code, ctx, res);
+}
+
+/* server_handle_limited()
+ * DESC: creates the response to a request of a client that is over its rate limits (see
+ *       ratelim_take()): 429 with Retry-After, after which the connection is closed.
+ * RETV: 0 on success, -1 on error.
+ */
+int server_handle_limited(webserv_ctx_t *ctx, httpmsg_t *res) {
+   char retry_after[16];
+
+   if (server_handle_err(C_TOOMANY, ctx, res) < 0) {
+      return -1;
+   }
+   snprintf(retry_after, sizeof(retry_after), "%u", RATELIM_RETRY_AFTER);
+   if (response_insert_header(HM_HDR_RETRYAFTER, retry_after, res) < 0) {
+      response_delete(res);
+      return -1;
+   }
+
+   return 0;
+}
+
+/* server_create_err()
+ * DESC: like server_handle_err(), but for method handlers: whether the connection is kept
+ *       open is left as decided by server_handle_req().
+ */
+int server_create_err(int code, webserv_ctx_t *ctx, httpmsg_t *res) {
+   const httpres_stat_t *status;
+
+   /* create response */
+   response_init(res);
+
+   if ((status = response_find_status(code)) == NULL) {
+      return -1;
+   }
+   if (response_insert_body(status->phrase, strlen(status->phrase), CONTENT_TYPE_PLAIN, res) < 0
+       || server_finish_res(code, ctx, res) < 0) {
+      response_delete(res);
+      return -1;
+   }
+
+   return 0;
+}
+
+/* server_err2code()
+ * DESC: maps error _err_ of request_read()/request_parse() that message_error() classifies
+ *       as MSG_ECLIENT to the HTTP status code to respond with.
+ */
+int server_err2code(int err) {
+   switch (err) {
+   case EMSGSIZE:
+      return C_HDRTOOLARGE;
+   case EFBIG:
+      return C_TOOLARGE;
+   case ENOSYS:
+      return C_NOTIMPLEMENTED;
+   default:
+      return C_BADREQUEST;
+   }
+}
+
+/* server_finish_res()
+ * DESC: inserts the general & server headers and the response line (with status _code_)
+ *       into response _res_, and counts the response in worker context _ctx_'s statistics.
+ * RETV: 0 on success, -1 on error.
+ */
+int server_finish_res(int code, webserv_ctx_t *ctx, httpmsg_t *res) {
+   /* insert general headers */
+   if (response_insert_genhdrs(ctx, res) < 0) {
+      return -1;
+   }
+
+   /* insert server headers */
+   if (response_insert_servhdrs(ctx, res) < 0) {
+      return -1;
+   }
+   
    /* set response line */
    if (response_insert_line(code, HM_HTTP_VERSION, res) < 0) {
-      response_delete(res);
       return -1;
    }
+
+   webserv_stats_count(code, &ctx->stats);
    
    return 0;
 }
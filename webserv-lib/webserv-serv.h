@@ -2,18 +2,103 @@
 #define __WEBSERV_SERV_H
 
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include "webserv-contype.h"
+#include "webserv-msg.h"
+#include "webserv-meta.h"
+#include "webserv-ctx.h"
+#include "webserv-rcu.h"
+#include "webserv-pack.h"
+#include "webserv-ratelim.h"
 
 #ifndef EBADRQC
 #define EBADRQC EINVAL
 #endif
 
-int server_start(const char *port, int backlog);
-int server_accept(int servfd);
-int server_handle_req(int conn_fd, const char *docroot, const char *servname,
-                      httpmsg_t *req, httpmsg_t *res, const filetype_table_t *ftypes);
-int server_handle_get(int conn_fd, const char *docroot, const char *servname, httpmsg_t *req,
-                      httpmsg_t *res, const filetype_table_t *ftypes);
+/* methods listed in Allow headers (with uploads enabled or disabled) */
+#define SERVER_ALLOW_PUT "GET, HEAD, OPTIONS, PUT"
+#define SERVER_ALLOW     "GET, HEAD, OPTIONS"
+
+/* headers of responses served from an archive */
+#define SERVER_HDR_ETAG     "ETag"
+#define SERVER_HDR_ENCODING "Content-Encoding"
+#define SERVER_HDR_VARY     "Vary"
+#define SERVER_GZIP         "gzip"
+
+/* canned responses of connections turned away (see server_reject()) */
+#define SERVER_REJECT_MAX   0x100 // max length of canned response
+#define SERVER_RETRY_AFTER  5     // seconds clients shed for lack of memory are asked to wait
+
+/* Unix domain socket paths starting with this are in the abstract namespace */
+#define SERVER_UNIX_ABSTRACT '@'
+
+/* types */
+/* listening socket options (see server_start()) */
+typedef struct {
+   int backlog;      // maximum length of the queue of connections awaiting accept(2)
+   int ipv6;         // whether to listen on a dual-stack IPv6 socket (IPv4 clients show up
+                     // as IPv4-mapped addresses); IPv4 only otherwise
+   int reuseport;    // SO_REUSEPORT: let other processes listen on the same port
+   int defer_accept; // TCP_DEFER_ACCEPT: seconds to hold connections back from accept(2)
+                     // until their request arrives (0: off)
+   int fastopen;     // TCP_FASTOPEN: max number of pending Fast Open requests (0: off)
+   int busy_poll;    // SO_BUSY_POLL: microseconds to busy-poll the device queue on empty
+                     // reads (inherited by accepted connections; 0: off)
+} server_listen_t;
+
+/* TCP write policy of client connections (see server_conn_tcp()) */
+typedef enum {
+   SERVER_TCP_NAGLE = 0, // kernel default: Nagle's algorithm holds back small segments
+   SERVER_TCP_NODELAY,   // TCP_NODELAY: every write goes out at once
+   SERVER_TCP_CORK,      // TCP_CORK while a response is being sent (see RES_CORK)
+} server_tcp_t;
+
+/* site served by server_handle_req() (shared, read-only, by all connections) */
+typedef struct {
+   const char *docroot;            // root directory to prepend resource requests to
+   const char *servname;           // name of server version
+   rcu_t *ftypes;                  // content type table (filetype_table_t, replaced on reload)
+   size_t maxbody;                 // maximum request body size (0 disables uploads)
+   metacache_t *meta;              // document metadata cache for HEAD (NULL for none)
+   rcu_t *pack;                    // archive documents are served from instead of the
+                                   // document root (pack_t, replaced on reload; NULL for none)
+   ratelim_t *ratelim;             // per-client rate limits (NULL for none)
+} server_site_t;
+
+/* request handler for one method (see server_handle_req()) */
+typedef int (*server_handler_t)(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                                httpmsg_t *req, httpmsg_t *res);
+
+/* prototypes */
+int server_start(const char *port, const server_listen_t *opts);
+int server_start_unix(const char *path, mode_t mode, int backlog);
+int server_accept(int servfd, struct sockaddr_storage *peer);
+int server_conn_tcp(int conn_fd, sa_family_t family, server_tcp_t tcp);
+int server_reject(int conn_fd, int code, unsigned retry_after, webserv_stats_t *stats);
+int server_handle_req(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res);
+int server_handle_get(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res);
+int server_handle_head(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res);
+int server_handle_options(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                          httpmsg_t *req, httpmsg_t *res);
+int server_handle_notallowed(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                             httpmsg_t *req, httpmsg_t *res);
+int server_handle_put(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                      httpmsg_t *req, httpmsg_t *res);
+int server_handle_body(int conn_fd, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res);
+int server_handle_pack(int head, const server_site_t *site, webserv_ctx_t *ctx,
+                       httpmsg_t *req, httpmsg_t *res);
+int server_site_reload(const char *tabpath, const char *snappath, server_site_t *site);
+int server_site_reload_pack(const char *packpath, server_site_t *site);
+int server_handle_err(int code, webserv_ctx_t *ctx, httpmsg_t *res);
+int server_handle_limited(webserv_ctx_t *ctx, httpmsg_t *res);
+int server_create_err(int code, webserv_ctx_t *ctx, httpmsg_t *res);
+int server_err2code(int err);
+int server_finish_res(int code, webserv_ctx_t *ctx, httpmsg_t *res);
 
 #endif
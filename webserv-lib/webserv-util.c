@@ -128,23 +128,20 @@ const char *tm_mon2str(int mon) {
  * DESC: formats date in HTTP date format given time in seconds, _sec_ptr_.
  * ARGS:
  *  - sec_ptr: pointer to time_t value to format.
- *  - time_str: pointer to where the dynamically-allocated formatted string should be placed.
- * RETV: returns 0 upon success; returns -1 upon error. Upon error, no string is allocated.
- * NOTE: Since this function dynamically allocates a string on success, the programmer must 
- *       delete it after use.
+ *  - time_str: buffer of at least HM_DATE_LEN bytes in which to store the formatted string.
+ * RETV: returns 0 upon success; returns -1 upon error.
  */
-int hm_fmtdate(const time_t *sec_ptr, char **time_str) {
-   struct tm *time_info;
+int hm_fmtdate(const time_t *sec_ptr, char *time_str) {
+   struct tm time_info;
    
-   if ((time_info = gmtime(sec_ptr)) == NULL) {
+   if (gmtime_r(sec_ptr, &time_info) == NULL) {
       return -1;
    }
 
-   if (smprintf(time_str,
-                "%3.3s, %02d %3.3s %04d %02d:%02d:%02d GMT",
-                tm_wday2str(time_info->tm_wday),       time_info->tm_mday,
-                tm_mon2str(time_info->tm_mon),         time_info->tm_year + 1900,
-                time_info->tm_hour, time_info->tm_min, time_info->tm_sec)
+   if (snprintf(time_str, HM_DATE_LEN, HM_FMTDATE_FMT,
+                tm_wday2str(time_info.tm_wday),      time_info.tm_mday,
+                tm_mon2str(time_info.tm_mon),        time_info.tm_year + 1900,
+                time_info.tm_hour, time_info.tm_min, time_info.tm_sec)
        < 0) {
       return -1;
    }
@@ -152,6 +149,96 @@ int hm_fmtdate(const time_t *sec_ptr, char **time_str) {
    return 0;
 }
 
+/* hr_hexval()
+ * DESC: value of hexadecimal digit _c_, or -1 if _c_ is not one.
+ */
+int hr_hexval(int c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      return (c | 0x20) - 'a' + 10;
+   }
+   return -1;
+}
+
+/* hr_uri_normalize()
+ * DESC: normalizes request URI _uri_ of length _*lenp_ in place, in a single pass:
+ *       percent-escapes are decoded, the query & fragment are stripped, empty and "."
+ *       segments are removed and ".." segments remove the preceding segment. The result
+ *       is the canonical path of the requested resource (also used as cache key).
+ * ARGS:
+ *  - uri: URI to normalize (need not be null-terminated).
+ *  - lenp: pointer to length of _uri_; set to the length of the normalized URI.
+ *  - asterisk: whether _uri_ may be "*" (asterisk-form, only valid for OPTIONS).
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EBADMSG: _uri_ is not an absolute path (or "*", if allowed), contains a malformed
+ *             or null escape, or a ".." segment would escape the root.
+ * NOTE: the result is never longer than _uri_ and always begins with '/' (unless _uri_
+ *       is "*"). It is not null-terminated.
+ */
+int hr_uri_normalize(char *uri, size_t *lenp, int asterisk) {
+   const unsigned char *in, *end;
+   char *out, *seg;
+   int c, hi, lo, last;
+
+   in = (const unsigned char *) uri;
+   end = in + *lenp;
+   if (*lenp == 1 && *uri == '*' && asterisk) {
+      return 0;
+   }
+   if (in == end || *in != '/') {
+      errno = EBADMSG;
+      return -1;
+   }
+
+   /* seg: start of current segment in output (just after its '/') */
+   out = seg = uri + 1;
+   for (++in; ; ) {
+      /* get next (decoded) character, or note the end of the path (any byte value,
+       * 0xff included, is a character) */
+      if ((last = (in == end || *in == '?' || *in == '#'))) {
+         c = '/'; // (ends the last segment, but isn't appended)
+      } else if (*in == '%') {
+         if (end - in < 3 || (hi = hr_hexval(in[1])) < 0 || (lo = hr_hexval(in[2])) < 0
+             || (c = hi << 4 | lo) == '\0') {
+            errno = EBADMSG;
+            return -1;
+         }
+         in += 3;
+      } else {
+         c = *in++;
+      }
+
+      if (c != '/') {
+         *out++ = c;
+         continue;
+      }
+
+      /* end of segment */
+      if (out - seg == 1 && seg[0] == '.') {
+         out = seg;           // drop "."
+      } else if (out - seg == 2 && seg[0] == '.' && seg[1] == '.') {
+         if (seg == uri + 1) {
+            errno = EBADMSG;  // would escape root
+            return -1;
+         }
+         /* drop ".." and the preceding segment */
+         for (out = seg - 1; out[-1] != '/'; --out) {}
+      } else if (out != seg && !last) {
+         *out++ = '/';
+      }
+      seg = out;
+
+      if (last) {
+         break;
+      }
+   }
+
+   *lenp = out - uri;
+   return 0;
+}
+
 /* smax()
  * DESC: return the maximum of two size_t values.
  */
@@ -179,13 +266,17 @@ typedef struct {
    httpreq_method_t meth;
 } hr_str2meth_t;
 
-static hr_str2meth_t hr_str2meth_v[] = {
+static const hr_str2meth_t hr_str2meth_v[] = {
    {"GET", M_GET},
+   {"PUT", M_PUT},
+   {"POST", M_POST},
+   {"HEAD", M_HEAD},
+   {"OPTIONS", M_OPTIONS},
    {0,            0}
 };
 
 httpreq_method_t hr_str2meth(const char *str) {
-   for (hr_str2meth_t *it = hr_str2meth_v; it->str; ++it) {
+   for (const hr_str2meth_t *it = hr_str2meth_v; it->str; ++it) {
       if (strcmp(it->str, str) == 0) {
          return it->meth;
       }
@@ -203,7 +294,7 @@ httpreq_method_t hr_str2meth(const char *str) {
  *  - EINVAL: _meth_ does not represent a valid HTTP mode or is not supported.
  */
 const char *hr_meth2str(httpreq_method_t meth) {
-   for (hr_str2meth_t *it = hr_str2meth_v; it->str; ++it) {
+   for (const hr_str2meth_t *it = hr_str2meth_v; it->str; ++it) {
       if (meth == it->meth) {
          return it->str;
       }
@@ -21,14 +21,15 @@ const char *tm_mon2str(int mon);
 
 
 #define HM_FMTDATE_EX  "Thu, 06 Dec 2018 19:57:08 GMT"
-#define HM_DATE_LEN    (strlen(HM_FMTDATE_EX)+1)
+#define HM_DATE_LEN    sizeof(HM_FMTDATE_EX)
 #define HM_FMTDATE_FMT "%3.3s, %02d %3.3s %04d %02d:%02d:%02d GMT"
 
-int hm_fmtdate(const time_t *sec_ptr, char **time_str);
+int hm_fmtdate(const time_t *sec_ptr, char *time_str);
 
 size_t smin(size_t s1, size_t s2);
 size_t smax(size_t s1, size_t s2);
 
+int hr_uri_normalize(char *uri, size_t *lenp, int asterisk);
 httpreq_method_t hr_str2meth(const char *str);
 const char *hr_meth2str(httpreq_method_t meth);
 
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "webserv-util.h"
+#include "webserv-vec.h"
+#include "webserv-res.h"
+#include "webserv-warm.h"
+
+void warmup_list(warmup_t *warm);
+int warmup_list_add(const char *uri, off_t budget, warmup_t *warm);
+int warmup_list_manifest(FILE *manifest, off_t budget, warmup_t *warm);
+int warmup_list_walk(const char *uri, off_t budget, warmup_t *warm);
+void *warmup_loop(warmup_t *warm);
+void warmup_doc(const char *uri, warmup_t *warm);
+int warmup_uri_del(char **urip);
+
+/* warmup_start()
+ * DESC: starts _nthds_ threads (with all signals blocked) that warm the documents of site
+ *       _site_ in parallel: one of them lists the documents while the others warm those
+ *       listed so far; each document is looked up (and its metadata put in the site's
+ *       metadata cache, if any, to be revalidated on first use; see metacache_get()) and
+ *       read ahead into the page cache (see posix_fadvise(2)).
+ * ARGS:
+ *  - manifest: path of file listing the request URIs of the documents to warm, one per
+ *              line (blank lines & lines starting with '#' are ignored), or NULL to
+ *              walk the site's document root instead.
+ *  - budget: maximum total size of the documents warmed (0 for no limit; required when
+ *            walking the document root).
+ *  - nthds: number of threads.
+ *  - site: site to warm (must outlive _warm_).
+ *  - warm: warmup to initialize.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - EINVAL: _nthds_ is 0, or neither _manifest_ nor _budget_ is given.
+ *  - see fopen(3), malloc(3), pthread_mutex_init(3), pthread_create(3)
+ * NOTE: documents that don't exist (or aren't regular files) are skipped. Documents are
+ *       warmed in the order listed until the budget is used up. Listing (which stat(2)s
+ *       every document, or walks the whole tree) happens in the background too, so that
+ *       warmup_wait()'s deadline bounds it as well.
+ */
+int warmup_start(const char *manifest, off_t budget, size_t nthds, const server_site_t *site,
+                 warmup_t *warm) {
+   sigset_t sigset, sigset_old;
+   int err;
+
+   memset(warm, 0, sizeof(*warm));
+   warm->site = site;
+   warm->budget = budget;
+   VECTOR_INIT(&warm->uris);
+   if (nthds == 0 || (manifest == NULL && budget == 0)) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   if (manifest && (warm->manifest = fopen(manifest, "r")) == NULL) {
+      return -1;
+   }
+   if ((warm->thds = calloc(nthds, sizeof(*warm->thds))) == NULL) {
+      goto cleanup;
+   }
+   if ((err = pthread_mutex_init(&warm->lock, NULL))) {
+      errno = err;
+      goto cleanup;
+   }
+   if ((err = pthread_cond_init(&warm->cond, NULL))) {
+      pthread_mutex_destroy(&warm->lock);
+      errno = err;
+      goto cleanup;
+   }
+
+   /* start threads (signals are for the main thread) */
+   sigfillset(&sigset);
+   pthread_sigmask(SIG_SETMASK, &sigset, &sigset_old);
+   pthread_mutex_lock(&warm->lock);
+   for (; warm->nthds < nthds; ++warm->nthds) {
+      if ((err = pthread_create(&warm->thds[warm->nthds], NULL,
+                                (void *(*)(void *)) warmup_loop, warm))) {
+         errno = err;
+         break;
+      }
+      ++warm->nrunning;
+   }
+   pthread_mutex_unlock(&warm->lock);
+   pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+   if (warm->nthds < nthds) {
+      err = errno;
+      warmup_delete(warm);
+      errno = err;
+      return -1;
+   }
+
+   return 0;
+
+ cleanup:
+   err = errno;
+   free(warm->thds);
+   if (warm->manifest) {
+      fclose(warm->manifest);
+   }
+   errno = err;
+   return -1;
+}
+
+/* warmup_list()
+ * DESC: lists the documents of _warm_ (from its manifest, or by walking the document root),
+ *       recording any error in _warm->err_, and marks the listing done.
+ */
+void warmup_list(warmup_t *warm) {
+   int retv;
+
+   retv = warm->manifest ? warmup_list_manifest(warm->manifest, warm->budget, warm)
+      : warmup_list_walk("", warm->budget, warm);
+
+   pthread_mutex_lock(&warm->lock);
+   if (retv < 0 && !warm->stopping) {
+      warm->err = errno;
+   }
+   warm->listed = 1;
+   pthread_cond_broadcast(&warm->cond);
+   pthread_mutex_unlock(&warm->lock);
+}
+
+/* warmup_list_add()
+ * DESC: adds the document with (normalized) request URI _uri_ to the documents of _warm_,
+ *       unless it doesn't exist, isn't a regular file or doesn't fit in _budget_, and wakes
+ *       the threads waiting for documents to warm.
+ * RETV: 0 on success (whether or not it was added), -1 on error.
+ * ERRS:
+ *  - ECANCELED: warmup is stopping.
+ *  - see malloc(3)
+ */
+int warmup_list_add(const char *uri, off_t budget, warmup_t *warm) {
+   char *path, *uri_dup;
+   struct stat path_stat;
+   int retv;
+
+   if (smprintf(&path, "%s%s", warm->site->docroot, uri) < 0) {
+      return -1;
+   }
+   retv = stat(path, &path_stat);
+   free(path);
+   if (retv < 0 || !S_ISREG(path_stat.st_mode)
+       || (budget && warm->nbytes + path_stat.st_size > budget)) {
+      return 0;
+   }
+
+   if ((uri_dup = strdup(uri)) == NULL) {
+      return -1;
+   }
+   pthread_mutex_lock(&warm->lock);
+   if (warm->stopping) {
+      errno = ECANCELED;
+      retv = -1;
+   } else if ((retv = VECTOR_INSERT(&uri_dup, &warm->uris)) >= 0) {
+      warm->nbytes += path_stat.st_size;
+      pthread_cond_broadcast(&warm->cond);
+   }
+   pthread_mutex_unlock(&warm->lock);
+   if (retv < 0) {
+      free(uri_dup);
+      return -1;
+   }
+
+   return 0;
+}
+
+/* warmup_list_manifest()
+ * DESC: adds the documents listed in manifest file _f_ to the documents of _warm_ (see
+ *       warmup_start()). Lines that aren't valid request URIs are skipped.
+ * RETV: 0 on success, -1 on error.
+ */
+int warmup_list_manifest(FILE *f, off_t budget, warmup_t *warm) {
+   char *line;
+   size_t line_size, len;
+   ssize_t line_len;
+   int retv;
+
+   retv = 0;
+   line = NULL;
+   line_size = 0;
+   while (retv >= 0 && (line_len = getline(&line, &line_size, f)) >= 0) {
+      /* strip trailing whitespace */
+      for (len = line_len; len > 0 && strchr(" \t\r\n", line[len - 1]); --len) {}
+      if (len == 0 || line[0] == '#' || hr_uri_normalize(line, &len, 0) < 0) {
+         continue;
+      }
+      line[len] = '\0';
+      retv = warmup_list_add(line, budget, warm);
+   }
+   if (retv >= 0 && ferror(f)) {
+      retv = -1;
+   }
+
+   free(line);
+   return retv;
+}
+
+/* warmup_list_walk()
+ * DESC: adds the documents under the directory with request URI _uri_ ("" for the document
+ *       root) to the documents of _warm_, recursively, until _budget_ is used up. Symbolic
+ *       links to directories aren't followed; unreadable directories are skipped.
+ * RETV: 0 on success, -1 on error.
+ */
+int warmup_list_walk(const char *uri, off_t budget, warmup_t *warm) {
+   char *path, *child;
+   DIR *dir;
+   struct dirent *ent;
+   struct stat child_stat;
+   int retv;
+
+   if (smprintf(&path, "%s%s", warm->site->docroot, uri) < 0) {
+      return -1;
+   }
+   dir = opendir(path);
+   free(path);
+   if (dir == NULL) {
+      return 0;
+   }
+
+   retv = 0;
+   while (retv >= 0 && warm->nbytes < budget && (ent = readdir(dir)) != NULL) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+         continue;
+      }
+      if (smprintf(&child, "%s/%s", uri, ent->d_name) < 0) {
+         retv = -1;
+         break;
+      }
+      if (smprintf(&path, "%s%s", warm->site->docroot, child) < 0) {
+         free(child);
+         retv = -1;
+         break;
+      }
+      if (lstat(path, &child_stat) == 0) {
+         retv = S_ISDIR(child_stat.st_mode) ? warmup_list_walk(child, budget, warm)
+            : warmup_list_add(child, budget, warm);
+      }
+      free(path);
+      free(child);
+   }
+
+   closedir(dir);
+   return retv;
+}
+
+/* warmup_loop()
+ * DESC: lists the documents of _warm_ (if no other thread has taken that on), then warms
+ *       documents as they are listed until none are left (or it is stopping).
+ * RETV: NULL.
+ */
+void *warmup_loop(warmup_t *warm) {
+   const char *uri;
+
+   pthread_mutex_lock(&warm->lock);
+   if (!warm->listing) {
+      warm->listing = 1;
+      pthread_mutex_unlock(&warm->lock);
+      warmup_list(warm);
+      pthread_mutex_lock(&warm->lock);
+   }
+   while (!warm->stopping) {
+      if (warm->next < warm->uris.cnt) {
+         uri = warm->uris.arr[warm->next++];
+         pthread_mutex_unlock(&warm->lock);
+
+         warmup_doc(uri, warm);
+
+         pthread_mutex_lock(&warm->lock);
+         ++warm->ndone;
+      } else if (warm->listed) {
+         break;
+      } else {
+         pthread_cond_wait(&warm->cond, &warm->lock);
+      }
+   }
+   if (--warm->nrunning == 0) {
+      pthread_cond_broadcast(&warm->cond);
+   }
+   pthread_mutex_unlock(&warm->lock);
+
+   return NULL;
+}
+
+/* warmup_doc()
+ * DESC: warms the document with request URI _uri_: puts its metadata in the site's
+ *       metadata cache (as server_handle_head() would; it will most likely be stale by
+ *       the first request, which then only has to check the modification time) and
+ *       starts reading it into the page cache. Errors are ignored (warmup is best-effort).
+ */
+void warmup_doc(const char *uri, warmup_t *warm) {
+   const server_site_t *site;
+   metacache_info_t info;
+   struct stat path_stat;
+   char *path;
+   unsigned rcu_tok;
+   int fd;
+
+   site = warm->site;
+   if (smprintf(&path, "%s%s", site->docroot, uri) < 0) {
+      return;
+   }
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+      free(path);
+      return;
+   }
+
+   if (fstat(fd, &path_stat) == 0 && S_ISREG(path_stat.st_mode)) {
+      /* cache metadata (in a read-side critical section of the type table, since the
+       * entry refers to it; see server_site_reload()) */
+      if (site->meta) {
+         memset(&info, 0, sizeof(info));
+         info.code = C_OK;
+         info.size = path_stat.st_size;
+         info.type = content_type_get(path, rcu_read_lock(&rcu_tok, site->ftypes));
+         info.mtime = path_stat.st_mtim;
+         if (hm_fmtdate(&path_stat.st_mtim.tv_sec, info.last_mod) == 0) {
+            metacache_put(uri, time(NULL), &info, site->meta);
+         }
+         rcu_read_unlock(rcu_tok, site->ftypes);
+      }
+
+      /* read ahead contents */
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+   }
+
+   close(fd);
+   free(path);
+}
+
+/* warmup_wait()
+ * DESC: waits until all documents of _warm_ have been listed & warmed, or until _deadline_
+ *       (an absolute CLOCK_REALTIME time; NULL for none) has passed.
+ * RETV: 0 if warmup is complete, -1 on error.
+ * ERRS:
+ *  - ETIMEDOUT: the deadline passed first (the threads keep listing & warming in the
+ *               background).
+ *  - see warmup_list_manifest(), warmup_list_walk(): listing the documents failed (those
+ *    listed until then have been warmed).
+ */
+int warmup_wait(const struct timespec *deadline, warmup_t *warm) {
+   int err;
+
+   err = 0;
+   pthread_mutex_lock(&warm->lock);
+   while (warm->nrunning > 0 && err != ETIMEDOUT) {
+      err = deadline ? pthread_cond_timedwait(&warm->cond, &warm->lock, deadline)
+         : pthread_cond_wait(&warm->cond, &warm->lock);
+   }
+   err = (warm->nrunning > 0) ? ETIMEDOUT : warm->err;
+   pthread_mutex_unlock(&warm->lock);
+
+   if (err) {
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
+
+/* warmup_done()
+ * DESC: returns the number of documents of _warm_ warmed so far, and gets the number of
+ *       documents listed so far into _nlistedp_ and their total size into _nbytesp_.
+ */
+size_t warmup_done(size_t *nlistedp, off_t *nbytesp, warmup_t *warm) {
+   size_t ndone;
+
+   pthread_mutex_lock(&warm->lock);
+   ndone = warm->ndone;
+   *nlistedp = warm->uris.cnt;
+   *nbytesp = warm->nbytes;
+   pthread_mutex_unlock(&warm->lock);
+
+   return ndone;
+}
+
+/* warmup_delete()
+ * DESC: stops warmup _warm_ (listing stops, and documents not yet started are skipped),
+ *       joins its threads and frees it.
+ */
+void warmup_delete(warmup_t *warm) {
+   pthread_mutex_lock(&warm->lock);
+   warm->stopping = 1;
+   pthread_cond_broadcast(&warm->cond);
+   pthread_mutex_unlock(&warm->lock);
+   for (size_t i = 0; i < warm->nthds; ++i) {
+      pthread_join(warm->thds[i], NULL);
+   }
+   if (warm->manifest) {
+      fclose(warm->manifest);
+   }
+
+   pthread_cond_destroy(&warm->cond);
+   pthread_mutex_destroy(&warm->lock);
+   free(warm->thds);
+   VECTOR_DELETE(&warm->uris, warmup_uri_del);
+   memset(warm, 0, sizeof(*warm));
+}
+
+/* warmup_uri_del(): frees listed URI at _urip_ (see VECTOR_DELETE()). */
+int warmup_uri_del(char **urip) {
+   free(*urip);
+   return 0;
+}
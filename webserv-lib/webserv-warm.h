@@ -0,0 +1,51 @@
+#ifndef __WEBSERV_WARM_H
+#define __WEBSERV_WARM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "webserv-serv.h"
+
+/* defines */
+#define WARMUP_NTHDS 4 // default number of warmup threads
+
+/* types */
+/* documents to warm (request URIs, e.g. "/index.html") */
+typedef struct {
+   char **arr;
+   size_t cnt;
+   size_t len;
+} warmup_uris_t;
+
+/* startup warmup of a site: one thread lists the documents while the others (and then
+ * it too) look them up (filling the site's metadata cache) and ask the kernel to read them
+ * ahead into the page cache */
+typedef struct {
+   const server_site_t *site;
+   FILE *manifest;           // manifest to list documents from (NULL to walk the docroot)
+   off_t budget;             // maximum total size of the listed documents (0: no limit)
+   warmup_uris_t uris;
+   off_t nbytes;             // total size of the listed documents
+   size_t next;              // next document to warm
+   size_t ndone;             // documents warmed
+   size_t nrunning;          // threads still running
+   int listing;              // whether a thread has taken on listing the documents
+   int listed;               // whether all documents have been listed
+   int err;                  // errno of listing failure (0 if none)
+   int stopping;             // whether remaining documents are to be skipped
+   pthread_t *thds;
+   size_t nthds;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;      // signaled when documents are listed & when the last thread is done
+} warmup_t;
+
+/* prototypes */
+int warmup_start(const char *manifest, off_t budget, size_t nthds, const server_site_t *site,
+                 warmup_t *warm);
+int warmup_wait(const struct timespec *deadline, warmup_t *warm);
+size_t warmup_done(size_t *nlistedp, off_t *nbytesp, warmup_t *warm);
+void warmup_delete(warmup_t *warm);
+
+#endif
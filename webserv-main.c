@@ -3,13 +3,34 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include "webserv-lib.h"
 #include "webserv-util.h"
 #include "webserv-dbg.h"
 #include "webserv-main.h"
+#include "webserv-prefork.h"
 
-int server_accepting = 0; // whether server is accepting new connections
+atomic_int server_accepting = 0; // whether server is accepting new connections (cleared
+                                  // by signal handlers & the reload thread)
+int server_listen_shared = 0; // whether the listening sockets are shared with other
+                              // processes (prefork workers, or a new process they were
+                              // handed off to); they mustn't be shut down or unlinked
+mem_level_t server_mem_level = MEM_OK; // memory pressure caches were last adjusted to
+server_conf_t server_conf = {
+   .maxhdr = HM_MAXHDR_DFL,
+   .maxbody = 0,
+   .quantum = QUANTUM,
+   .sched = SERVER_SCHED_RR,
+   .iothreads = IOTHREADS,
+   .codel_target = 0,
+   .tcp = SERVER_TCP_NAGLE,
+   .drain = DRAIN_DEADLINE,
+};
 
 /* main()
  * NOTE: this main method is shared between webserv-multi and webserv-single. main() performs setup &
@@ -18,9 +39,20 @@ int server_accepting = 0; // whether server is accepting new connections
 int main(int argc, char *argv[]) {
    int optc;
    int optinval;
-   const char *optstr = "p:t:";
+   const char *optstr = "p:t:T:H:B:Q:S:I:W:w:D:A:m:M:C:r:R:L:6Pd:f:b:N:U:u:G:F:a:";
    const char *port = PORT;
    const char *types_path = CONTENT_TYPES_PATH;
+   const char *snap_path = NULL;
+   const char *pack_path = NULL;
+   const char *warm_manifest = NULL;
+   off_t warm_budget = 0;
+   time_t warm_deadline = WARMUP_DEADLINE;
+   size_t mem_soft = 0, mem_hard = 0;
+   double req_rate = 0, req_burst = 0, byte_rate = 0, byte_burst = 0;
+   server_listen_t listen_opts = {.backlog = BACKLOG};
+   const char *unix_path = NULL;
+   mode_t unix_mode = 0;
+   size_t nworkers = 0;
    
    /* parse arguments */
    optinval = 0;
@@ -31,16 +63,141 @@ int main(int argc, char *argv[]) {
          break;
       case 't':
          types_path = optarg;
+         break;
+      case 'T':
+         snap_path = optarg;
+         break;
+      case 'H':
+         if ((server_conf.maxhdr = strtoul(optarg, NULL, 0)) == 0) {
+            optinval = 1;
+         }
+         break;
+      case 'B':
+         server_conf.maxbody = strtoul(optarg, NULL, 0);
+         break;
+      case 'Q':
+         server_conf.quantum = strtoul(optarg, NULL, 0);
+         break;
+      case 'S':
+         if (strcmp(optarg, "rr") == 0) {
+            server_conf.sched = SERVER_SCHED_RR;
+         } else if (strcmp(optarg, "srpt") == 0) {
+            server_conf.sched = SERVER_SCHED_SRPT;
+         } else {
+            optinval = 1;
+         }
+         break;
+      case 'I':
+         server_conf.iothreads = strtoul(optarg, NULL, 0);
+         break;
+      case 'W':
+         warm_manifest = optarg;
+         break;
+      case 'w':
+         warm_budget = strtoull(optarg, NULL, 0);
+         break;
+      case 'D':
+         warm_deadline = strtoul(optarg, NULL, 0);
+         break;
+      case 'A':
+         pack_path = optarg;
+         break;
+      case 'm':
+         mem_soft = strtoull(optarg, NULL, 0);
+         break;
+      case 'M':
+         mem_hard = strtoull(optarg, NULL, 0);
+         break;
+      case 'C':
+         server_conf.codel_target = strtoull(optarg, NULL, 0) * 1000000;
+         break;
+      case 'r':
+         if (parse_rate(optarg, &req_rate, &req_burst) < 0) {
+            optinval = 1;
+         }
+         break;
+      case 'R':
+         if (parse_rate(optarg, &byte_rate, &byte_burst) < 0) {
+            optinval = 1;
+         }
+         break;
+      case 'L':
+         if ((listen_opts.backlog = strtol(optarg, NULL, 0)) <= 0) {
+            optinval = 1;
+         }
+         break;
+      case '6':
+         listen_opts.ipv6 = 1;
+         break;
+      case 'P':
+         listen_opts.reuseport = 1;
+         break;
+      case 'd':
+         listen_opts.defer_accept = strtol(optarg, NULL, 0);
+         break;
+      case 'f':
+         listen_opts.fastopen = strtol(optarg, NULL, 0);
+         break;
+      case 'b':
+         listen_opts.busy_poll = strtol(optarg, NULL, 0);
+         break;
+      case 'N':
+         if (strcmp(optarg, "nagle") == 0) {
+            server_conf.tcp = SERVER_TCP_NAGLE;
+         } else if (strcmp(optarg, "nodelay") == 0) {
+            server_conf.tcp = SERVER_TCP_NODELAY;
+         } else if (strcmp(optarg, "cork") == 0) {
+            server_conf.tcp = SERVER_TCP_CORK;
+         } else {
+            optinval = 1;
+         }
+         break;
+      case 'U':
+         unix_path = optarg;
+         break;
+      case 'u':
+         unix_mode = strtoul(optarg, NULL, 8);
+         break;
+      case 'G':
+         server_conf.drain = strtoul(optarg, NULL, 0);
+         break;
+      case 'F':
+         nworkers = strtoul(optarg, NULL, 0);
+         break;
+      case 'a':
+         if (affinity_parse(optarg, &server_conf.cpus) < 0) {
+            optinval = 1;
+         }
+         break;
       default:
          optinval = 1;
          break;
       }
    }
    if (optinval) {
-      fprintf(stderr, "%s: [-p port]\n", argv[0]);
+      fprintf(stderr, "%s: [-p port] [-t types] [-T snapshot] [-H maxhdr] [-B maxbody] "
+              "[-Q quantum] [-S rr|srpt] [-I iothreads] [-W manifest] [-w budget] "
+              "[-D deadline] [-A archive] [-m memsoft] [-M memhard] [-C target] "
+              "[-r reqrate[,burst]] [-R byterate[,burst]] [-L backlog] [-6] [-P] "
+              "[-d defer] [-f fastopen] [-b busypoll] [-N nagle|nodelay|cork] "
+              "[-U unixpath] [-u unixmode] [-G drain] [-F workers] [-a cpulist]\n", argv[0]);
       exit(1);
    }
 
+   /* started by an old server process to take over its listening sockets? */
+   int handoff_fd = handoff_inherited();
+   mem_set_limits(mem_soft, mem_hard);
+
+   /* confine server to its CPUs before starting any threads (or workers, which each get
+    * one of them; see prefork_run()) */
+   if (server_conf.cpus.ncpus) {
+      if (affinity_set(&server_conf.cpus) < 0) {
+         perror("affinity_set");
+         exit(2);
+      }
+      printf("webserv-main: running on %zu CPUs\n", server_conf.cpus.ncpus);
+   }
+
    /* install signal handlers */
    struct sigaction sa;
    
@@ -61,53 +218,422 @@ int main(int argc, char *argv[]) {
       exit(2);
    }
 
-   /* load content types table */
-   filetype_table_t typetab;
-   if (content_types_load(types_path, &typetab) < 0) {
-      perror("content_types_init");
+   /* load content types table (from snapshot, if it is up to date) */
+   filetype_table_t *typetab;
+   if ((typetab = malloc(sizeof(*typetab))) == NULL
+       || content_types_open(types_path, snap_path, typetab) < 0) {
+      perror("content_types_open");
       exit(3);
    }
 
-   /* save parsed & sorted content type table */
-   if (DEBUG) {
-      if (content_types_save("mime_sorted.types", &typetab) < 0) {
-         perror("content_types_save");
+   /* set up site */
+   server_site_t site;
+   rcu_t typetab_rcu;
+   metacache_t meta;
+   if (rcu_init(typetab, &typetab_rcu) < 0 || metacache_init(METACACHE_TTL, &meta) < 0) {
+      perror("server_site");
+      exit(3);
+   }
+   site.docroot = DOCUMENT_ROOT;
+   site.servname = SERVER_NAME;
+   site.ftypes = &typetab_rcu;
+   site.maxbody = server_conf.maxbody;
+   site.meta = &meta;
+   site.pack = NULL;
+   site.ratelim = NULL;
+
+   /* set up per-client rate limits */
+   ratelim_t ratelim;
+   if (req_rate || byte_rate) {
+      if (ratelim_init(req_rate, (req_burst < 1) ? 1 : req_burst, byte_rate, byte_burst,
+                       &ratelim) < 0) {
+         perror("ratelim_init");
+         exit(3);
+      }
+      site.ratelim = &ratelim;
+   }
+
+   /* map archive to serve documents from (read-only: no uploads) */
+   pack_t *pack;
+   rcu_t pack_rcu;
+   if (pack_path) {
+      if ((pack = malloc(sizeof(*pack))) == NULL || pack_open(pack_path, pack) < 0) {
+         perror("pack_open");
+         exit(3);
+      }
+      if (rcu_init(pack, &pack_rcu) < 0) {
+         perror("server_site");
+         exit(3);
+      }
+      site.pack = &pack_rcu;
+      site.maxbody = 0;
+   }
+
+   /* handle SIGHUP & SIGUSR2 in reload thread */
+   pthread_t reload_thd;
+   reload_args_t reload_args = {types_path, snap_path, pack_path, &site, argv, NULL, 0,
+                                pthread_self()};
+   if (reload_start(&reload_args, &reload_thd) < 0) {
+      perror("reload_start");
+      exit(3);
+   }
+
+   /* warm up caches before opening the listener (for at most warm_deadline seconds) */
+   warmup_t warm;
+   int warming = (warm_manifest || warm_budget);
+   if (warming) {
+      struct timespec start, end, deadline;
+      size_t ndone, nlisted;
+      off_t nbytes;
+      long msec;
+      int timedout;
+      
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += warm_deadline;
+      if (warmup_start(warm_manifest, warm_budget, WARMUP_NTHDS, &site, &warm) < 0) {
+         perror("warmup_start");
+         exit(4);
+      }
+      if ((timedout = warmup_wait(warm_deadline ? &deadline : NULL, &warm) < 0)
+          && errno != ETIMEDOUT) {
+         perror("warmup_wait");
          exit(4);
       }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      msec = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+      ndone = warmup_done(&nlisted, &nbytes, &warm);
+      printf("webserv-main: warmed %zu of %zu documents (%jd bytes listed) in %ld ms%s\n",
+             ndone, nlisted, (intmax_t) nbytes, msec,
+             timedout ? "; deadline passed, continuing in background" : "");
    }
    
-   /* start web server */
-   int servfd, exitno;
-   if ((servfd = server_start(port, BACKLOG)) < 0) {
+   /* start web server (on TCP, and on a Unix domain socket for local proxies), or take
+    * over the old server's listening sockets */
+   int servfds[2], exitno;
+   size_t nservfds = 0;
+   if (handoff_fd >= 0) {
+      ssize_t nrecv;
+      if ((nrecv = handoff_recv(handoff_fd, servfds, 2)) < 0) {
+         perror("handoff_recv");
+         exit(5);
+      }
+      nservfds = nrecv;
+      if (nservfds != 1 + (unix_path != NULL)) {
+         fprintf(stderr, "%s: handed %zu listening sockets, expected %d; exiting.\n", argv[0],
+                 nservfds, 1 + (unix_path != NULL));
+         exit(5);
+      }
+      printf("webserv-main: took over %zu listening sockets from process %d\n", nservfds,
+             (int) getppid());
+   } else if ((servfds[nservfds++] = server_start(port, &listen_opts)) < 0
+       || (unix_path
+           && (servfds[nservfds++] = server_start_unix(unix_path, unix_mode,
+                                                       listen_opts.backlog)) < 0)) {
       fprintf(stderr, "%s: failed to start server; exiting.\n", argv[0]);
       exit(5);
    }
-   server_accepting = 1;
+   server_print_listen(port, &listen_opts);
+   if (unix_path) {
+      printf("webserv-main: listening on unix socket %s\n", unix_path);
+   }
+   reload_args.servfds = servfds;
+   reload_args.nservfds = nservfds;
+   atomic_store(&server_accepting, 1);
 
-   /* run server loop */
+   /* tell the old server it can stop accepting */
+   if (handoff_fd >= 0) {
+      if (handoff_ready(handoff_fd) < 0) {
+         perror("handoff_ready");
+      }
+      close(handoff_fd);
+   }
+
+   /* fork worker processes to run the server loop, supervising them from this one (with
+    * no other threads, nor anything of the warmup's left to share); workers race to
+    * accept, so one that loses must not block */
    exitno = 0;
-   if (server_loop(servfd, &typetab) < 0) {
+   int reloading = 1, looping = 1;
+   if (nworkers) {
+      pthread_cancel(reload_thd);
+      pthread_join(reload_thd, NULL);
+      reloading = 0;
+      if (warming) {
+         warmup_delete(&warm);
+         warming = 0;
+      }
+      for (size_t i = 0; i < nservfds; ++i) {
+         if (fcntl(servfds[i], F_SETFL, fcntl(servfds[i], F_GETFL) | O_NONBLOCK) < 0) {
+            perror("fcntl");
+         }
+      }
+      switch (prefork_run(nworkers, &reload_args)) {
+      case -1:
+         exitno = 6;
+         /* fallthrough */
+      case 0:
+         looping = 0;
+         break;
+      default:
+         server_listen_shared = 1;
+         reload_args.main_thd = pthread_self();
+         if (reload_start(&reload_args, &reload_thd) < 0) {
+            perror("reload_start");
+            exit(3);
+         }
+         reloading = 1;
+         break;
+      }
+   }
+
+   /* run server loop */
+   if (looping && server_loop(servfds, nservfds, &site) < 0) {
       fprintf(stderr, "%s: internal error occurred; exiting.\n", argv[0]);
       exitno = 6;
    }
 
    /* cleanup */
-   if (close(servfd) < 0) {
-      perror("close");
-      exitno = 7;
+   for (size_t i = 0; i < nservfds; ++i) {
+      if (close(servfds[i]) < 0) {
+         perror("close");
+         exitno = 7;
+      }
+   }
+   if (unix_path && unix_path[0] != SERVER_UNIX_ABSTRACT && !server_listen_shared
+       && unlink(unix_path) < 0) {
+      perror("unlink");
+   }
+   if (warming) {
+      warmup_delete(&warm);
+   }
+   if (reloading) {
+      pthread_cancel(reload_thd);
+      pthread_join(reload_thd, NULL);
+   }
+   if (site.pack) {
+      pack_unref(rcu_delete(&pack_rcu));
+   }
+   typetab = rcu_delete(&typetab_rcu);
+   content_types_delete(typetab);
+   free(typetab);
+   metacache_delete(&meta);
+   if (site.ratelim) {
+      ratelim_delete(&ratelim);
+   }
+   if (mem_soft || mem_hard) {
+      printf("webserv-main: peak memory use %zu bytes\n", mem_peak());
    }
-   content_types_delete(&typetab);
    
    exit(exitno);
 }
 
+/* server_print_listen()
+ * DESC: prints the listener settings the server started with, so benchmark runs can be
+ *       told apart (see server_start()).
+ */
+void server_print_listen(const char *port, const server_listen_t *opts) {
+   static const char *tcp_names[] = {
+      [SERVER_TCP_NAGLE]   = "nagle",
+      [SERVER_TCP_NODELAY] = "nodelay",
+      [SERVER_TCP_CORK]    = "cork",
+   };
+   
+   printf("webserv-main: listening on port %s (%s, backlog %d, reuseport %s, "
+          "defer accept %ds, fast open %d, busy poll %dus, tcp %s)\n", port,
+          opts->ipv6 ? "IPv6 dual-stack" : "IPv4", opts->backlog,
+          opts->reuseport ? "on" : "off", opts->defer_accept, opts->fastopen,
+          opts->busy_poll, tcp_names[server_conf.tcp]);
+}
+
+/* parse_rate()
+ * DESC: parses rate limit option argument _arg_ of the form RATE[,BURST] (per second;
+ *       BURST defaults to RATELIM_BURST seconds' worth of RATE).
+ * RETV: 0 on success, -1 if _arg_ is malformed.
+ */
+int parse_rate(const char *arg, double *ratep, double *burstp) {
+   char *end;
+
+   *ratep = strtod(arg, &end);
+   *burstp = *ratep * RATELIM_BURST;
+   if (*end == ',') {
+      *burstp = strtod(end + 1, &end);
+   }
+   if (*end != '\0' || *ratep < 0 || *burstp < 0) {
+      return -1;
+   }
+   return 0;
+}
+
+/* reload_start()
+ * DESC: starts the reload thread (see reload_loop()) with arguments _args_, having SIGHUP
+ *       & SIGUSR2 blocked in the calling thread (and so in all threads it starts later)
+ *       and all signals blocked in the reload thread.
+ * ARGS:
+ *  - args: reload thread's arguments.
+ *  - thdp: where to return the reload thread.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see pthread_create(3)
+ */
+int reload_start(reload_args_t *args, pthread_t *thdp) {
+   sigset_t sigset, sigset_old;
+   int err;
+
+   sigemptyset(&sigset);
+   sigaddset(&sigset, SIGHUP);
+   sigaddset(&sigset, SIGUSR2);
+   pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+   sigfillset(&sigset);
+   pthread_sigmask(SIG_SETMASK, &sigset, &sigset_old);
+   err = pthread_create(thdp, NULL, (void *(*)(void *)) reload_loop, args);
+   pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+   if (err) {
+      errno = err;
+      return -1;
+   }
+
+   return 0;
+}
+
+/* reload_loop()
+ * DESC: reloads the content types table (and archive, if any) of the site being served
+ *       whenever SIGHUP is received (see server_site_reload(), server_site_reload_pack()),
+ *       and hands the listening sockets off to a new server process whenever SIGUSR2 is
+ *       (see server_handoff()). Runs in its own thread, off the request path, until
+ *       canceled.
+ * ARGS:
+ *  - args: paths of types file, snapshot & archive, site to reload, and what's needed to
+ *          hand off.
+ * RETV: NULL.
+ */
+void *reload_loop(reload_args_t *args) {
+   sigset_t sigset;
+   int sig;
+
+   sigemptyset(&sigset);
+   sigaddset(&sigset, SIGHUP);
+   sigaddset(&sigset, SIGUSR2);
+   while (sigwait(&sigset, &sig) == 0) {
+      /* don't get canceled mid-reload */
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+      if (sig == SIGUSR2) {
+         server_handoff(args);
+         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+         continue;
+      }
+      printf("webserv-main: reloading content types...\n");
+      if (server_site_reload(args->types_path, args->snap_path, args->site) < 0) {
+         perror("server_site_reload");
+      }
+      if (args->pack_path) {
+         printf("webserv-main: reloading archive...\n");
+         if (server_site_reload_pack(args->pack_path, args->site) < 0) {
+            perror("server_site_reload_pack");
+         }
+      }
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+   }
+
+   return NULL;
+}
+
+/* server_handoff()
+ * DESC: restarts the server without refusing any connections: starts a new server process
+ *       (the binary at argv[0], which a deploy may have replaced, with the same arguments)
+ *       and hands it the listening sockets (see handoff_spawn()). This process keeps
+ *       accepting until the new one is serving, then stops accepting -- without shutting
+ *       the listening sockets down, as they are shared now -- and drains its connections
+ *       (for at most server_conf.drain seconds). A prefork master hands off its workers'
+ *       listening sockets, and then stops them (see prefork_run()); workers can't hand off.
+ * ARGS:
+ *  - args: reload thread's arguments (argv, listening sockets, main thread).
+ * RETV: 0 on success, -1 if the handoff failed (the new process is killed, and this one
+ *       carries on serving).
+ * NOTE: prints errors.
+ */
+int server_handoff(reload_args_t *args) {
+   pid_t pid;
+   int sock;
+
+   if (!atomic_load(&server_accepting)) {
+      fprintf(stderr, "webserv-main: not accepting connections, can't hand off\n");
+      return -1;
+   }
+   if (server_listen_shared) {
+      fprintf(stderr, "webserv-main: listening sockets are shared, can't hand off%s\n",
+              prefork_self ? " (signal the prefork master instead)" : "");
+      return -1;
+   }
+   printf("webserv-main: handing off to new %s...\n", args->argv[0]);
+   if ((pid = handoff_spawn(args->argv, &sock)) < 0) {
+      perror("handoff_spawn");
+      return -1;
+   }
+   if (handoff_send(sock, args->servfds, args->nservfds) < 0
+       || handoff_wait(sock, HANDOFF_TIMEOUT) < 0) {
+      perror("server_handoff");
+      kill(pid, SIGTERM);
+      waitpid(pid, NULL, 0);
+      close(sock);
+      return -1;
+   }
+   close(sock);
+
+   /* stop accepting (waking up the server loop) */
+   printf("webserv-main: process %d is serving\n", (int) pid);
+   server_listen_shared = 1;
+   atomic_store(&server_accepting, 0);
+   pthread_kill(args->main_thd, SIGINT);
+
+   return 0;
+}
+
+/* server_mem_adjust()
+ * DESC: adjusts the caches to memory pressure (see mem_level()): past the soft limit, the
+ *       site's metadata cache shrinks to METACACHE_MINSIZE entries and the wholly free
+ *       slabs of _pool_ are released; once there is room below the soft limit again, the
+ *       metadata cache grows back. Called periodically by server_loop().
+ * ARGS:
+ *  - pool: server loop's buffer pool.
+ *  - site: site being served.
+ * RETV: the memory pressure after adjusting.
+ */
+mem_level_t server_mem_adjust(bufpool_t *pool, const server_site_t *site) {
+   mem_level_t level;
+   size_t regrow;
+
+   if ((level = mem_level()) >= MEM_SOFT) {
+      bufpool_trim(pool);
+      if (site->meta) {
+         metacache_resize(METACACHE_MINSIZE, site->meta);
+      }
+      level = mem_level();
+   } else if (site->meta && site->meta->nents < METACACHE_SIZE) {
+      /* only grow back if that won't cross the soft limit (no flapping) */
+      regrow = (METACACHE_SIZE - site->meta->nents) * sizeof(*site->meta->ents);
+      if (mem_budget.soft == 0 || mem_used() + regrow < mem_budget.soft) {
+         metacache_resize(METACACHE_SIZE, site->meta);
+      }
+   }
+
+   if (level != server_mem_level) {
+      printf("webserv-main: %zu bytes in use: %s\n", mem_used(),
+             (level == MEM_HARD) ? "past hard limit, turning away new connections"
+             : (level == MEM_SOFT) ? "past soft limit, shrinking caches"
+             : "below limits");
+      server_mem_level = level;
+   }
+   
+   return level;
+}
+
 /* handler_sigint()
  * DESC: catches the SIGINT signal and tells the server to stop accepting new connections.
  */
 void handler_sigint(int signum) {
    /* stop accepting new connections */
    printf("webserv-main: closing server to new connections...\n");
-   server_accepting = 0;
+   atomic_store(&server_accepting, 0);
 }
 
 /* handler_sigpipe()
@@ -1,18 +1,67 @@
 #ifndef __WEBSERV_MAIN_H
 #define __WEBSERV_MAIN_H
 
+/* types */
+/* order in which connections ready to be sent their response are served per wakeup
+ * (webserv-single only) */
+typedef enum {
+   SERVER_SCHED_RR = 0, // round-robin (poll order)
+   SERVER_SCHED_SRPT    // shortest remaining response first
+} server_sched_t;
+
+/* server configuration (set from command-line options in main()) */
+typedef struct {
+   size_t maxhdr;  // maximum request header size (bytes); larger requests get 431
+   size_t maxbody; // maximum request (PUT) body size (bytes); 0 disables uploads
+   size_t quantum; // maximum response bytes sent to a connection per wakeup (0: no limit)
+   server_sched_t sched; // write scheduling policy
+   size_t iothreads; // number of I/O threads requests are handled in (0: in the event loop)
+   uint64_t codel_target; // target delay (ns) from accept to first read past which new
+                          // connections are turned away (see codel_t; 0: admit all)
+   server_tcp_t tcp; // TCP write policy of client connections
+   time_t drain;     // seconds connections in flight get to finish once the server stops
+                     // accepting (0: no deadline)
+   affinity_t cpus;  // CPUs to run on (empty: any)
+} server_conf_t;
+
+/* arguments of reload_loop() thread */
+typedef struct {
+   const char *types_path;
+   const char *snap_path;  // NULL for none
+   const char *pack_path;  // NULL for none
+   server_site_t *site;
+   char **argv;            // arguments to start a new server process with (see
+                           // server_handoff())
+   const int *servfds;     // listening sockets (set once the server is accepting)
+   size_t nservfds;
+   pthread_t main_thd;     // thread running server_loop()
+} reload_args_t;
+
 /* beloved globals */
-int server_accepting;
+extern atomic_int server_accepting;
+extern int server_listen_shared;
+extern server_conf_t server_conf;
+extern mem_level_t server_mem_level;
 
 /* macros */
 #define DOCUMENT_ROOT "/home/nmosier"
 #define SERVER_NAME "webserv-single/1.0"
 #define PORT "1024"
-#define BACKLOG 10
+#define BACKLOG SOMAXCONN // default listen(2) backlog (the kernel caps it at net.core.somaxconn)
 #define CONTENT_TYPES_PATH "/etc/mime.types"
+#define QUANTUM 0x10000 // default write quantum (64 KiB)
+#define IOTHREADS 4     // default number of I/O threads
+#define WARMUP_DEADLINE 10 // default seconds warmup may delay opening the listener
+#define DRAIN_DEADLINE 30  // default seconds connections get to finish when stopping
 
 /* prototypes */
-int server_loop(int servfd, const filetype_table_t *ftypes);
+int server_loop(const int *servfds, size_t nservfds, const server_site_t *site);
+int reload_start(reload_args_t *args, pthread_t *thdp);
+void *reload_loop(reload_args_t *args);
+int server_handoff(reload_args_t *args);
+mem_level_t server_mem_adjust(bufpool_t *pool, const server_site_t *site);
+void server_print_listen(const char *port, const server_listen_t *opts);
+int parse_rate(const char *arg, double *ratep, double *burstp);
 void handler_sigint(int signum);
 void handler_sigpipe(int signum);
 
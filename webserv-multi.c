@@ -7,6 +7,9 @@
 #include <poll.h>
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -16,14 +19,28 @@
 #include "webserv-dbg.h"
 #include "webserv-contype.h"
 #include "webserv-main.h"
+#include "webserv-prefork.h"
 
 /* macros */
 #define PTHREAD_MINLEN 16
+#define CLIENT_THREAD_COST 0x10000 // memory charged per client thread until it is joined
+                                   // (estimated resident stack & thread bookkeeping)
+#define DRAIN_TICK_NSEC 100000000  // how often finished threads are joined while draining
+#define ACCEPT_TICK_MSEC 1000      // how often finished threads are joined (& statistics
+                                   // published) while no connections come in
 
 /* types */
 struct client_thread_args {
    int client_fd;
-   const filetype_table_t *ftypes;
+   bufpool_t *pool;
+   const server_site_t *site;
+   codel_t *codel;    // admission controller to sample the connection's delay in (or NULL)
+   ratelim_key_t peer; // client's rate limit key (see ratelim_key())
+   sa_family_t family; // client's address family (see server_conn_tcp())
+   uint64_t accepted; // time connection was accepted (see codel_clock())
+   webserv_ctx_t ctx; // thread's context (statistics are summed once it has been joined)
+   atomic_int done;   // set once the thread is about to exit (it can be joined without
+                      // blocking)
 };
 
 typedef struct {
@@ -37,43 +54,173 @@ typedef struct {
    size_t cnt;
 } client_threads_t;
 
+/* buffer pools of the threads started on their connection's incoming CPU (see
+ * client_thread_attr()), one per NUMA node: a thread borrows from its CPU's node's pool, so
+ * the slabs it first touches are on that node, and buffers are only recycled among threads
+ * on the same node */
+typedef struct {
+   bufpool_t *pools;      // pool of each node (indexed by node number)
+   size_t npools;
+   bufpool_t **cpu_pool;  // pool of each CPU's node (indexed by CPU number; NULL if unknown)
+} nodepools_t;
+
 /* prototypes */
 void *client_loop(struct client_thread_args *thd_args);
+int client_threads_reap(int all, client_threads_t *thds, webserv_stats_t *stats);
+int client_threads_drain(client_threads_t *thds, webserv_stats_t *stats);
+int client_wait(int client_fd, short events);
+int server_accept_any(struct pollfd *pfds, size_t npfds, int timeout, size_t *nextp,
+                      struct sockaddr_storage *peer);
+pthread_attr_t *client_thread_attr(int client_fd, const affinity_t *cpus, int *cpup,
+                                   pthread_attr_t *attr);
+int nodepools_init(const affinity_t *cpus, nodepools_t *np);
+void nodepools_trim(nodepools_t *np);
+void nodepools_delete(nodepools_t *np);
 int client_thread_info_init(client_thread_info_t *thd_info);
 int client_thread_info_del(client_thread_info_t *thd_info);
 
 /* server_loop()
- * DESC: accepts & responds to new connections by creating new threads.
+ * DESC: accepts & responds to new connections by creating new threads. Threads that have
+ *       finished are joined as new connections come in, or every ACCEPT_TICK_MSEC while
+ *       none do (a prefork worker publishes its statistics then too). Past the hard
+ *       memory limit, new connections are turned away with a canned 503 instead (see
+ *       server_reject()); past the soft limit, caches shrink (see server_mem_adjust()).
+ *       With server_conf.codel_target set, new connections are also turned away (503)
+ *       while the delay from accepting connections to their threads first reading them
+ *       stays above target (see codel_t). Clients over their rate limits are turned away
+ *       with a canned 429 (see ratelim_t).
+ *       Once no longer accepting, connections in flight get server_conf.drain seconds to
+ *       finish before they are shut down.
+ *       With server_conf.cpus set (and more than one of them to run on), each connection's
+ *       thread is started on the CPU its packets arrive on, if that is one of them (see
+ *       client_thread_attr()), and borrows its buffers from that CPU's NUMA node's pool
+ *       (see nodepools_t).
  * ARGS:
- *  - servfd: server socket (already set to listening).
- *  - ftypes: pointer to content type table.
+ *  - servfds: server sockets (TCP and/or Unix domain, already listening).
+ *  - nservfds: number of server sockets.
+ *  - site: site to serve.
  * RETV: returns 0 on success, -1 on error.
  * NOTE: prints errors.
  */
-int server_loop(int servfd, const filetype_table_t *ftypes) {
+int server_loop(const int *servfds, size_t nservfds, const server_site_t *site) {
    int retv;
+   int thd_failed; // whether a joined thread failed (reported once all are joined)
    client_threads_t thds;
+   bufpool_t pool;
+   nodepools_t nodepools; // (see nodepools_t; none unless steering)
+   codel_t codel_ctl, *codel;
+   webserv_stats_t stats;
+   struct pollfd *servpfds;
+   size_t servnext; // server socket to accept from first (see server_accept_any())
+   affinity_t cpus; // CPUs connections' threads may be steered to
+   int steer;       // whether to steer connections' threads to their incoming CPU
+   size_t nsteered;
    
    /* initialize variables */
    retv = 0;
+   thd_failed = 0;
+   servnext = 0;
+   nsteered = 0;
+   memset(&stats, 0, sizeof(stats));
+   memset(&cpus, 0, sizeof(cpus));
+   memset(&nodepools, 0, sizeof(nodepools));
+   steer = server_conf.cpus.ncpus && affinity_get(&cpus) == 0 && cpus.ncpus > 1;
    VECTOR_INIT(&thds);
+   if ((servpfds = calloc(nservfds, sizeof(*servpfds))) == NULL) {
+      perror("calloc");
+      return -1;
+   }
+   for (size_t i = 0; i < nservfds; ++i) {
+      servpfds[i].fd = servfds[i];
+      servpfds[i].events = POLLIN;
+   }
+   if (bufpool_init(server_conf.maxhdr, &pool) < 0) {
+      perror("bufpool_init");
+      free(servpfds);
+      return -1;
+   }
+   if (steer && nodepools_init(&cpus, &nodepools) < 0) {
+      perror("nodepools_init");
+      bufpool_delete(&pool);
+      free(servpfds);
+      return -1;
+   }
+   codel = NULL;
+   if (server_conf.codel_target) {
+      if (codel_init(server_conf.codel_target, CODEL_INTERVAL, &codel_ctl) < 0) {
+         perror("codel_init");
+         nodepools_delete(&nodepools);
+         bufpool_delete(&pool);
+         free(servpfds);
+         return -1;
+      }
+      codel = &codel_ctl;
+   }
    
    /* accept new connections & spin off new threads */
-   while (retv >= 0 && server_accepting) {
+   while (retv >= 0 && atomic_load(&server_accepting)) {
       int client_fd;
+      struct sockaddr_storage peer;
+      ratelim_key_t key;
+      uint64_t now;
       client_thread_info_t thd_info;
+      pthread_attr_t attr, *attrp;
+      mem_level_t level;
+      int cpu;
+      int err;
       
       /* accept new connection */
-      if ((client_fd = server_accept(servfd)) < 0) {
-         if (errno != EINTR) {
+      if ((client_fd = server_accept_any(servpfds, nservfds, ACCEPT_TICK_MSEC, &servnext,
+                                         &peer)) < 0) {
+         if (errno == ETIMEDOUT) {
+            /* none came in: join finished threads all the same (an idle worker's
+             * statistics would go stale otherwise) */
+            if (client_threads_reap(0, &thds, &stats) < 0) {
+               thd_failed = 1;
+            }
+            prefork_publish(&stats);
+            continue;
+         } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("server_accept");
             retv = -1;
             break;
          } else {
-            continue; // restart loop in case of interrupt
+            continue; // restart loop in case of interrupt (or another worker accepting it)
          }
       }
       
+      /* join finished threads & shed load if out of memory */
+      if (client_threads_reap(0, &thds, &stats) < 0) {
+         thd_failed = 1;
+      }
+      prefork_publish(&stats);
+      if ((level = server_mem_adjust(&pool, site)) >= MEM_SOFT) {
+         nodepools_trim(&nodepools);
+      }
+      if (level == MEM_HARD) {
+         if (server_reject(client_fd, C_UNAVAILABLE, SERVER_RETRY_AFTER, &stats) < 0) {
+            perror("server_reject");
+         }
+         continue;
+      }
+      key = ratelim_key((struct sockaddr *) &peer);
+      if (site->ratelim) {
+         ratelim_expire(site->ratelim);
+         if (!ratelim_admit(key, site->ratelim)) {
+            if (server_reject(client_fd, C_TOOMANY, RATELIM_RETRY_AFTER, &stats) < 0) {
+               perror("server_reject");
+            }
+            continue;
+         }
+      }
+      now = codel ? codel_clock() : 0;
+      if (codel && !codel_admit(now, codel)) {
+         if (server_reject(client_fd, C_UNAVAILABLE, CODEL_RETRY_AFTER, &stats) < 0) {
+            perror("server_reject");
+         }
+         continue;
+      }
+      
       /* initialize thread info */
       if (client_thread_info_init(&thd_info) < 0) {
          perror("client_thread_info_init");
@@ -84,17 +231,36 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
          break;
       }
       thd_info.args->client_fd = client_fd;
-      thd_info.args->ftypes = ftypes;
+      thd_info.args->pool = &pool;
+      thd_info.args->site = site;
+      thd_info.args->codel = codel;
+      thd_info.args->accepted = now;
+      thd_info.args->peer = key;
+      thd_info.args->family = peer.ss_family;
+      atomic_init(&thd_info.args->done, 0);
       
-      /* spin off new thread */
-      if (pthread_create(&thd_info.thd, NULL, (void *(*)(void *)) client_loop, thd_info.args)) {
+      /* spin off new thread (on its incoming CPU, with its node's pool, if steering) */
+      attrp = steer ? client_thread_attr(client_fd, &cpus, &cpu, &attr) : NULL;
+      if (attrp && nodepools.cpu_pool && nodepools.cpu_pool[cpu]) {
+         thd_info.args->pool = nodepools.cpu_pool[cpu];
+      }
+      err = pthread_create(&thd_info.thd, attrp, (void *(*)(void *)) client_loop,
+                           thd_info.args);
+      if (attrp) {
+         pthread_attr_destroy(attrp);
+         ++nsteered;
+      }
+      if (err) {
+         errno = err;
          perror("pthread_create");
          if (close(client_fd) < 0) {
             perror("close");
          }
+         client_thread_info_del(&thd_info);
          retv = -1;
          break;
       }
+      mem_charge(CLIENT_THREAD_COST);
 
       /* add thread info to list */
       if (VECTOR_INSERT(&thd_info, &thds) < 0) {
@@ -111,26 +277,33 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
 
    /* cleanup */
    
-   /* shutdown server socket (reading) */
-   if (shutdown(servfd, SHUT_RD) < 0) {
-      perror("shutdown");
+   /* shutdown server sockets (reading), unless other processes are accepting from them
+    * too */
+   for (size_t i = 0; i < nservfds && !server_listen_shared; ++i) {
+      if (shutdown(servfds[i], SHUT_RD) < 0) {
+         perror("shutdown");
+      }
    }
+   free(servpfds);
 
    /* wait for threads to die */
    printf("waiting for %zu connections to close...\n", thds.cnt);
-   for (size_t i = 0; i < thds.cnt; ++i) {
-      void *thd_retv;
-
-      /* join thread */
-      if (pthread_join(thds.arr[i].thd, &thd_retv) < 0) {
-         retv = -1;
-      }
-      if (thd_retv == (void *) -1) {
-         /* error occurred in thread */
-         retv = -1;
-      }
+   if (client_threads_drain(&thds, &stats) < 0 || thd_failed) {
+      retv = -1;
    }
+   prefork_publish(&stats);
+   webserv_stats_print(stdout, &stats);
    VECTOR_DELETE(&thds, client_thread_info_del);
+   bufpool_delete(&pool);
+   if (codel) {
+      printf("admission control turned away %" PRIu64 " connections\n", codel_dropped(codel));
+      codel_delete(codel);
+   }
+   if (steer) {
+      printf("started %zu connections' threads on their incoming CPU (%zu NUMA nodes' "
+             "buffer pools)\n", nsteered, nodepools.npools);
+   }
+   nodepools_delete(&nodepools);
 
    return retv;
 }
@@ -140,55 +313,108 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
  * DESC: reads request from client socket, sends response, closes client socket, and dies.
  * ARGS:
  *  - thd_args: pointer to client socket thread's arguments, which contains a pointer
- *              to a content type table and the client socket's file descriptor.
+ *              to the site being served, the request buffer pool, the client socket's
+ *              file descriptor and the thread's context.
  * RETV: returns (void *) 0 upon success, (void *) -1 upon error.
  */
 void *client_loop(struct client_thread_args *thd_args) {
    int client_fd;
    httpmsg_t req, res;
-   const filetype_table_t *ftypes;
+   const server_site_t *site;
+   webserv_ctx_t *ctx;
    int msg_stat, msg_err;
+   int resflags;
    void *retv;
 
    /* initialize variables */
    client_fd = thd_args->client_fd;
-   ftypes = thd_args->ftypes;
+   site = thd_args->site;
+   ctx = &thd_args->ctx;
    retv = (void *) 0;
    request_init(&req);
    response_init(&res);
+   if (webserv_ctx_init(site->servname, ctx) < 0) {
+      perror("webserv_ctx_init");
+      retv = (void *) -1;
+      goto cleanup;
+   }
+   if ((resflags = server_conn_tcp(client_fd, thd_args->family, server_conf.tcp)) < 0) {
+      perror("server_conn_tcp");
+      goto cleanup;
+   }
 
-   /* read request to completion */
-   while ((msg_stat = request_read(client_fd, &req)) < 0
-          && (msg_err = message_error(errno)) == MSG_EAGAIN) {}
+   /* read request to completion (sampling how long the connection waited to be read) */
+   msg_stat = request_read(client_fd, &req, thd_args->pool);
+   if (thd_args->codel) {
+      codel_sample(thd_args->accepted, codel_clock(), thd_args->codel);
+   }
+   while (msg_stat < 0 && (msg_err = message_error(errno)) == MSG_EAGAIN) {
+      client_wait(client_fd, POLLIN);
+      msg_stat = request_read(client_fd, &req, thd_args->pool);
+   }
 
-   /* check for any read errors */
+   /* parse request */
+   if (msg_stat >= 0 && (msg_stat = request_parse(&req)) < 0) {
+      msg_err = message_error(errno);
+   }
+
+   /* check for any read/parse errors */
    if (msg_stat < 0) {
       if (msg_err == MSG_ECONN) {
          printf("connection to client socket %d interrupted while receiving\n", client_fd);
-      } else {
+         goto cleanup;
+      } else if (msg_err != MSG_ECLIENT) {
          perror("request_read");
          retv = (void *) -1;
+         goto cleanup;
       }
-      goto cleanup;
+      
+      /* malformed or oversized request -- respond with error status */
+      if (server_handle_err(server_err2code(errno), ctx, &res) < 0) {
+         perror("server_handle_err");
+         retv = (void *) -1;
+         goto cleanup;
+      }
+   } else if (site->ratelim && !ratelim_take(thd_args->peer, site->ratelim)) {
+      /* client over its rate limits */
+      if (server_handle_limited(ctx, &res) < 0) {
+         perror("server_handle_limited");
+         retv = (void *) -1;
+         goto cleanup;
+      }
+   } else if (server_handle_req(client_fd, site, ctx, &req, &res) < 0) {
+      /* create response (failing only this request, with a 500) */
+      perror("server_handle_req");
+      if (server_handle_err(C_SERVERERROR, ctx, &res) < 0) {
+         perror("server_handle_err");
+         retv = (void *) -1;
+         goto cleanup;
+      }
+   } else if (site->ratelim) {
+      ratelim_charge(thd_args->peer, res.hm_body_size, site->ratelim);
    }
 
-   /* parse request */
-   if (request_parse(&req) < 0) {
-      perror("request_parse");
-      retv = (void *) -1;
-      goto cleanup;
-   }
-   
-   /* create response */
-   if (server_handle_req(client_fd, DOCUMENT_ROOT, SERVER_NAME, &req, &res, ftypes) < 0) {
-      perror("server_handle_req");
-      retv = (void *) -1;
-      goto cleanup;
+   /* receive request body (if any) to completion */
+   while (request_body_pending(&req)) {
+      if (server_handle_body(client_fd, site, ctx, &req, &res) < 0) {
+         if ((msg_err = message_error(errno)) == MSG_EAGAIN) {
+            client_wait(client_fd, POLLIN);
+         } else if (msg_err == MSG_ECONN) {
+            printf("connection to client socket %d interrupted while receiving\n", client_fd);
+            goto cleanup;
+         } else {
+            perror("server_handle_body");
+            retv = (void *) -1;
+            goto cleanup;
+         }
+      }
    }
 
    /* send response */
-   while ((msg_stat = response_send(client_fd, &res)) < 0
-          && (msg_err = message_error(errno)) == MSG_EAGAIN) {}
+   while ((msg_stat = response_send(client_fd, 0, resflags, &res)) < 0
+          && (msg_err = message_error(errno)) == MSG_EAGAIN) {
+      client_wait(client_fd, POLLOUT);
+   }
    if (msg_stat < 0) {
       if (msg_err == MSG_ECONN) {
          printf("connection to client socket %d interrupted while sending\n", client_fd);
@@ -206,10 +432,230 @@ void *client_loop(struct client_thread_args *thd_args) {
    }
    request_delete(&req);
    response_delete(&res);
+   atomic_store(&thd_args->done, 1);
+
+   return retv;
+}
+
+/* client_threads_reap()
+ * DESC: joins the client threads in _thds_ that are done (or all of them, blocking until
+ *       they are), removing them from _thds_ and adding their statistics to _stats_.
+ * ARGS:
+ *  - all: whether to join all threads (else only those that have finished).
+ *  - thds: client threads.
+ *  - stats: where to sum the joined threads' statistics.
+ * RETV: 0 if all joined threads succeeded, -1 if any failed.
+ */
+int client_threads_reap(int all, client_threads_t *thds, webserv_stats_t *stats) {
+   void *thd_retv;
+   int retv;
+
+   retv = 0;
+   for (size_t i = 0; i < thds->cnt; ) {
+      if (!all && !atomic_load(&thds->arr[i].args->done)) {
+         ++i;
+         continue;
+      }
+
+      /* join thread */
+      if ((errno = pthread_join(thds->arr[i].thd, &thd_retv))) {
+         perror("pthread_join");
+         retv = -1;
+      } else if (thd_retv == (void *) -1) {
+         /* error occurred in thread */
+         retv = -1;
+      }
+      mem_uncharge(CLIENT_THREAD_COST);
+      webserv_stats_add(&thds->arr[i].args->ctx.stats, stats);
+      VECTOR_REMOVE(i, thds, client_thread_info_del);
+   }
 
    return retv;
 }
 
+/* client_threads_drain()
+ * DESC: joins all client threads in _thds_ (see client_threads_reap()), giving them
+ *       server_conf.drain seconds to finish; the connections of those still running after
+ *       that are shut down, so they finish at once.
+ * RETV: 0 if all threads succeeded, -1 if any failed.
+ */
+int client_threads_drain(client_threads_t *thds, webserv_stats_t *stats) {
+   struct timespec tick = {0, DRAIN_TICK_NSEC};
+   time_t drain_by;
+   size_t nleft;
+   int retv;
+
+   retv = 0;
+   drain_by = time(NULL) + server_conf.drain;
+   while (server_conf.drain && thds->cnt > 0 && time(NULL) < drain_by) {
+      if (client_threads_reap(0, thds, stats) < 0) {
+         retv = -1;
+      }
+      nanosleep(&tick, NULL);
+   }
+
+   if (server_conf.drain) {
+      nleft = 0;
+      for (size_t i = 0; i < thds->cnt; ++i) {
+         /* (a thread may just have closed its connection, and a file reused the descriptor:
+          * shutdown(2) fails on that, harmlessly) */
+         if (!atomic_load(&thds->arr[i].args->done)) {
+            shutdown(thds->arr[i].args->client_fd, SHUT_RDWR);
+            ++nleft;
+         }
+      }
+      if (nleft) {
+         printf("drain deadline passed; closing %zu connections\n", nleft);
+      }
+   }
+   if (client_threads_reap(1, thds, stats) < 0) {
+      retv = -1;
+   }
+
+   return retv;
+}
+
+/* client_wait()
+ * DESC: blocks until client socket _client_fd_ is ready for _events_ (see poll(2)), instead
+ *       of spinning on nonblocking reads/writes that would block.
+ * RETV: see poll(2).
+ */
+int client_wait(int client_fd, short events) {
+   struct pollfd pfd;
+
+   pfd.fd = client_fd;
+   pfd.events = events;
+   return poll(&pfd, 1, -1);
+}
+
+/* server_accept_any()
+ * DESC: blocks until a connection comes in on any of the server sockets polled by _pfds_,
+ *       then accepts it. The sockets are checked round-robin, starting at _*nextp_, so a
+ *       busy one can't starve the others. Polls even a lone socket, which prefork workers
+ *       share (non-blocking; see prefork_run()).
+ * ARGS:
+ *  - pfds: server sockets (polled for POLLIN).
+ *  - npfds: number of server sockets.
+ *  - timeout: longest time to wait, in milliseconds (-1 for no limit; see poll(2)).
+ *  - nextp: where the server socket to check first is kept between calls.
+ *  - peer: where to return the client's address.
+ * RETV: see server_accept() (EAGAIN: another process accepted the connection first); -1
+ *       if poll(2) fails (e.g. EINTR).
+ * ERRS:
+ *  - ETIMEDOUT: no connection came in within _timeout_.
+ */
+int server_accept_any(struct pollfd *pfds, size_t npfds, int timeout, size_t *nextp,
+                      struct sockaddr_storage *peer) {
+   size_t i;
+   int nready;
+
+   if ((nready = poll(pfds, npfds, timeout)) <= 0) {
+      if (nready == 0) {
+         errno = ETIMEDOUT;
+      }
+      return -1;
+   }
+   for (i = 0; i < npfds && pfds[(*nextp + i) % npfds].revents == 0; ++i) {}
+   i = (*nextp + i) % npfds;
+   *nextp = (i + 1) % npfds;
+   
+   return server_accept(pfds[i].fd, peer);
+}
+
+/* client_thread_attr()
+ * DESC: sets up thread attributes _attr_ to start the thread serving connection
+ *       _client_fd_ on the CPU that handles the NIC queue its packets arrive on (see
+ *       affinity_incoming_cpu()), if that is one of _cpus_, so its data is in that CPU's
+ *       cache (its buffers are that CPU's node's to give; see nodepools_t).
+ * ARGS:
+ *  - cpup: where to return the CPU (if started on one).
+ * RETV: _attr_ (to be destroyed after use), NULL to start the thread anywhere.
+ */
+pthread_attr_t *client_thread_attr(int client_fd, const affinity_t *cpus, int *cpup,
+                                   pthread_attr_t *attr) {
+   int cpu;
+
+   if (!affinity_has((cpu = affinity_incoming_cpu(client_fd)), cpus)
+       || pthread_attr_init(attr)) {
+      return NULL;
+   }
+   if (affinity_attr(cpu, attr) < 0) {
+      pthread_attr_destroy(attr);
+      return NULL;
+   }
+
+   *cpup = cpu;
+   return attr;
+}
+
+/* nodepools_init()
+ * DESC: initializes the per-node buffer pools _np_ of the NUMA nodes of CPUs _cpus_ (see
+ *       nodepools_t). If no CPU's node is known (e.g. the kernel was built without NUMA),
+ *       there are none.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see malloc(3), bufpool_init()
+ */
+int nodepools_init(const affinity_t *cpus, nodepools_t *np) {
+   int node, maxnode;
+   int err;
+
+   memset(np, 0, sizeof(*np));
+   maxnode = -1;
+   for (int cpu = 0; cpu < AFFINITY_MAXCPUS; ++cpu) {
+      if (affinity_has(cpu, cpus) && (node = affinity_node(cpu)) > maxnode) {
+         maxnode = node;
+      }
+   }
+   if (maxnode < 0) {
+      return 0;
+   }
+
+   if ((np->pools = calloc(maxnode + 1, sizeof(*np->pools))) == NULL
+       || (np->cpu_pool = calloc(AFFINITY_MAXCPUS, sizeof(*np->cpu_pool))) == NULL) {
+      goto cleanup;
+   }
+   for (; np->npools < (size_t) maxnode + 1; ++np->npools) {
+      if (bufpool_init(server_conf.maxhdr, &np->pools[np->npools]) < 0) {
+         goto cleanup;
+      }
+   }
+   for (int cpu = 0; cpu < AFFINITY_MAXCPUS; ++cpu) {
+      if (affinity_has(cpu, cpus) && (node = affinity_node(cpu)) >= 0) {
+         np->cpu_pool[cpu] = &np->pools[node];
+      }
+   }
+
+   return 0;
+
+ cleanup:
+   err = errno;
+   nodepools_delete(np);
+   errno = err;
+   return -1;
+}
+
+/* nodepools_trim()
+ * DESC: releases the wholly free slabs of per-node pools _np_ (see bufpool_trim()).
+ */
+void nodepools_trim(nodepools_t *np) {
+   for (size_t i = 0; i < np->npools; ++i) {
+      bufpool_trim(&np->pools[i]);
+   }
+}
+
+/* nodepools_delete()
+ * DESC: frees per-node pools _np_ (once no thread borrows from them any more).
+ */
+void nodepools_delete(nodepools_t *np) {
+   for (size_t i = 0; i < np->npools; ++i) {
+      bufpool_delete(&np->pools[i]);
+   }
+   free(np->pools);
+   free(np->cpu_pool);
+   memset(np, 0, sizeof(*np));
+}
+
 /* client_thread_info_init()
  * DESC: initializes a client thread info record.
  * RETV: 0 upon success, -1 upon error.
@@ -0,0 +1,47 @@
+/* webserv-pack
+ * DESC: packs a document root into an archive that webserv-single and webserv-multi can
+ *       serve from in place (-A option; see pack_build()). Content types are taken from
+ *       the types file at pack time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "webserv-lib.h"
+#include "webserv-main.h"
+
+int main(int argc, char *argv[]) {
+   int optc;
+   int optinval;
+   const char *types_path = CONTENT_TYPES_PATH;
+   filetype_table_t ftypes;
+
+   /* parse arguments */
+   optinval = 0;
+   while ((optc = getopt(argc, argv, "t:")) >= 0) {
+      switch (optc) {
+      case 't':
+         types_path = optarg;
+         break;
+      default:
+         optinval = 1;
+         break;
+      }
+   }
+   if (optinval || argc - optind != 2) {
+      fprintf(stderr, "usage: %s [-t types] docroot archive\n", argv[0]);
+      exit(1);
+   }
+
+   if (content_types_load(types_path, &ftypes) < 0) {
+      perror("content_types_load");
+      exit(2);
+   }
+   if (pack_build(argv[optind], &ftypes, argv[optind + 1]) < 0) {
+      perror("pack_build");
+      content_types_delete(&ftypes);
+      exit(3);
+   }
+   content_types_delete(&ftypes);
+
+   exit(0);
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "webserv-lib.h"
+#include "webserv-main.h"
+#include "webserv-prefork.h"
+
+prefork_slot_t *prefork_self = NULL; // this worker's slot (NULL unless a prefork worker)
+
+/* prefork_run()
+ * DESC: forks _nworkers_ worker processes, which return at once to run the server loop,
+ *       and supervises them from the calling (master) process until they have all exited:
+ *        - a worker that exits while the server is running (e.g. it crashed) is restarted;
+ *        - SIGINT stops the workers (each drains its connections), then the master;
+ *        - SIGHUP is passed on to the workers (each reloads its own copy of the site);
+ *        - SIGUSR1 prints the workers' statistics, summed;
+ *        - SIGUSR2 hands the listening sockets off to a new master (see server_handoff()).
+ *       Each worker starts as a copy of the master, so what the master has loaded by then
+ *       (content types, archive) is shared copy-on-write. With server_conf.cpus set, each
+ *       worker is pinned to one of those CPUs (worker i to the i-th, wrapping around)
+ *       before it sets anything up, so its buffers & pools are on its local NUMA node.
+ * ARGS:
+ *  - nworkers: number of workers.
+ *  - args: reload thread's arguments (for handing off).
+ * RETV: 1 in a worker, 0 in the master once all workers have exited, -1 on error.
+ * NOTE: call once the listening sockets are open and no other threads are running (they
+ *       wouldn't be in the workers). Prints errors, and the summed statistics on exit.
+ */
+int prefork_run(size_t nworkers, reload_args_t *args) {
+   prefork_t pf;
+   sigset_t sigset, sigset_worker;
+   webserv_stats_t stats;
+   int sig, stopping;
+
+   if (prefork_init(nworkers, &pf) < 0) {
+      perror("prefork_init");
+      return -1;
+   }
+
+   /* handle signals synchronously (workers get the signal mask back) */
+   sigemptyset(&sigset);
+   sigaddset(&sigset, SIGINT);
+   sigaddset(&sigset, SIGCHLD);
+   sigaddset(&sigset, SIGHUP);
+   sigaddset(&sigset, SIGUSR1);
+   sigaddset(&sigset, SIGUSR2);
+   pthread_sigmask(SIG_BLOCK, &sigset, &sigset_worker);
+
+   /* start workers (stopping those started already if one can't be) */
+   stopping = 0;
+   for (size_t i = 0; i < nworkers && !stopping; ++i) {
+      switch (prefork_spawn(i, &sigset_worker, &pf)) {
+      case 0:
+         return 1;
+      case -1:
+         perror("prefork_spawn");
+         prefork_signal(SIGINT, &pf);
+         stopping = 1;
+         break;
+      }
+   }
+   if (!stopping) {
+      printf("webserv-prefork: started %zu workers\n", nworkers);
+   }
+
+   /* supervise workers */
+   while (pf.nrunning > 0) {
+      if (sigwait(&sigset, &sig)) {
+         continue;
+      }
+      switch (sig) {
+      case SIGCHLD:
+         if (prefork_reap(stopping, &sigset_worker, &pf) == 0) {
+            return 1;
+         }
+         break;
+      case SIGINT:
+         if (!stopping) {
+            printf("webserv-prefork: stopping %zu workers...\n", pf.nrunning);
+            atomic_store(&server_accepting, 0);
+            stopping = 1;
+            prefork_signal(SIGINT, &pf);
+         }
+         break;
+      case SIGHUP:
+         prefork_signal(SIGHUP, &pf);
+         break;
+      case SIGUSR1:
+         memset(&stats, 0, sizeof(stats));
+         prefork_stats(&pf, &stats);
+         printf("webserv-prefork: %zu workers running: ", pf.nrunning);
+         webserv_stats_print(stdout, &stats);
+         fflush(stdout);
+         break;
+      case SIGUSR2:
+         server_handoff(args); // raises SIGINT to stop once the new master is serving
+         break;
+      }
+   }
+
+   memset(&stats, 0, sizeof(stats));
+   prefork_stats(&pf, &stats);
+   printf("webserv-prefork: all workers exited (%zu restarts); in total, ", pf.nrestarts);
+   webserv_stats_print(stdout, &stats);
+   prefork_delete(&pf);
+   pthread_sigmask(SIG_SETMASK, &sigset_worker, NULL);
+
+   return stopping ? 0 : -1;
+}
+
+/* prefork_init()
+ * DESC: initializes prefork master _pf_ for _nworkers_ workers, with none running.
+ * RETV: 0 on success, -1 on error.
+ * ERRS:
+ *  - see mmap(2)
+ */
+int prefork_init(size_t nworkers, prefork_t *pf) {
+   void *slots;
+
+   memset(pf, 0, sizeof(*pf));
+   if ((slots = mmap(NULL, nworkers * sizeof(*pf->slots), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+      return -1;
+   }
+   pf->slots = slots; // zero-filled
+   pf->nworkers = nworkers;
+
+   return 0;
+}
+
+/* prefork_spawn()
+ * DESC: starts worker _i_ of prefork master _pf_ (pinned to its CPU; see prefork_run()),
+ *       ignoring SIGUSR1.
+ * ARGS:
+ *  - i: index of worker's slot.
+ *  - sigset_worker: signal mask the worker starts with.
+ *  - pf: prefork master.
+ * RETV: 0 in the new worker, 1 in the master, -1 on error.
+ * ERRS:
+ *  - see fork(2)
+ */
+int prefork_spawn(size_t i, const sigset_t *sigset_worker, prefork_t *pf) {
+   struct sigaction sa;
+   pid_t pid;
+
+   fflush(NULL); // (or the worker would print what's buffered again)
+   if ((pid = fork()) < 0) {
+      return -1;
+   }
+   if (pid == 0) {
+      prefork_self = &pf->slots[i];
+
+      /* ignore SIGUSR1 (it is for the master, and would kill a worker sent it by mistake,
+       * e.g. by pkill(1)) before unblocking signals */
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = SIG_IGN;
+      sigemptyset(&sa.sa_mask);
+      sigaction(SIGUSR1, &sa, NULL);
+      pthread_sigmask(SIG_SETMASK, sigset_worker, NULL);
+      if (server_conf.cpus.ncpus) {
+         prefork_pin(i);
+      }
+      return 0;
+   }
+
+   pf->slots[i].pid = pid;
+   pf->slots[i].started = time(NULL);
+   ++pf->nrunning;
+
+   return 1;
+}
+
+/* prefork_pin()
+ * DESC: pins this worker, worker _i_, to its CPU (see prefork_run()).
+ * NOTE: prints errors (the worker runs unpinned then).
+ */
+void prefork_pin(size_t i) {
+   affinity_t cpu;
+   int cpuno;
+
+   cpuno = affinity_nth(i, &server_conf.cpus);
+   affinity_single(cpuno, &cpu);
+   if (affinity_set(&cpu) < 0) {
+      perror("prefork_pin");
+      return;
+   }
+   printf("webserv-prefork: worker %zu (%d) on CPU %d, NUMA node %d\n", i, (int) getpid(),
+          cpuno, affinity_node(cpuno));
+}
+
+/* prefork_reap()
+ * DESC: reaps the workers of prefork master _pf_ that have exited, keeping their last
+ *       statistics, and restarts them (unless _stopping_).
+ * ARGS:
+ *  - stopping: whether the workers are being stopped.
+ *  - sigset_worker: signal mask workers start with.
+ *  - pf: prefork master.
+ * RETV: 0 in a restarted worker, 1 in the master.
+ * NOTE: prints errors.
+ */
+int prefork_reap(int stopping, const sigset_t *sigset_worker, prefork_t *pf) {
+   prefork_slot_t *slot;
+   pid_t pid;
+   int status;
+   size_t i;
+
+   while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      /* (other children, e.g. a new master handed off to, are no concern) */
+      for (i = 0; i < pf->nworkers && pf->slots[i].pid != pid; ++i) {}
+      if (i == pf->nworkers) {
+         continue;
+      }
+      slot = &pf->slots[i];
+      webserv_stats_add(&slot->stats, &pf->retired);
+      memset(&slot->stats, 0, sizeof(slot->stats));
+      slot->pid = 0;
+      --pf->nrunning;
+      if (stopping) {
+         continue;
+      }
+
+      if (WIFSIGNALED(status)) {
+         fprintf(stderr, "webserv-prefork: worker %d killed by signal %d; restarting\n",
+                 (int) pid, WTERMSIG(status));
+      } else {
+         fprintf(stderr, "webserv-prefork: worker %d exited with status %d; restarting\n",
+                 (int) pid, WEXITSTATUS(status));
+      }
+      if (time(NULL) - slot->started < PREFORK_MIN_UPTIME) {
+         sleep(PREFORK_MIN_UPTIME);
+      }
+      switch (prefork_spawn(i, sigset_worker, pf)) {
+      case 0:
+         return 0;
+      case -1:
+         perror("prefork_spawn");
+         break;
+      default:
+         ++pf->nrestarts;
+         break;
+      }
+   }
+
+   return 1;
+}
+
+/* prefork_signal()
+ * DESC: sends signal _sig_ to all running workers of prefork master _pf_.
+ */
+void prefork_signal(int sig, const prefork_t *pf) {
+   for (size_t i = 0; i < pf->nworkers; ++i) {
+      if (pf->slots[i].pid > 0) {
+         kill(pf->slots[i].pid, sig);
+      }
+   }
+}
+
+/* prefork_stats()
+ * DESC: adds the statistics of all workers of prefork master _pf_ (running ones as last
+ *       published) to _stats_.
+ */
+void prefork_stats(const prefork_t *pf, webserv_stats_t *stats) {
+   webserv_stats_add(&pf->retired, stats);
+   for (size_t i = 0; i < pf->nworkers; ++i) {
+      webserv_stats_add(&pf->slots[i].stats, stats);
+   }
+}
+
+/* prefork_publish()
+ * DESC: publishes this worker's statistics _stats_ (all of them so far) to the master.
+ *       Does nothing unless this is a prefork worker.
+ * NOTE: the master may read them meanwhile; each counter is written whole.
+ */
+void prefork_publish(const webserv_stats_t *stats) {
+   if (prefork_self == NULL) {
+      return;
+   }
+   __atomic_store_n(&prefork_self->stats.nreqs, stats->nreqs, __ATOMIC_RELAXED);
+   for (int i = 0; i < WEBSERV_NCLASSES; ++i) {
+      __atomic_store_n(&prefork_self->stats.nresps[i], stats->nresps[i], __ATOMIC_RELAXED);
+   }
+}
+
+/* prefork_delete()
+ * DESC: frees prefork master _pf_ (once all its workers have exited).
+ */
+void prefork_delete(prefork_t *pf) {
+   munmap(pf->slots, pf->nworkers * sizeof(*pf->slots));
+   pf->slots = NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef __WEBSERV_PREFORK_H
+#define __WEBSERV_PREFORK_H
+
+#include <stddef.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/* defines */
+#define PREFORK_MIN_UPTIME 1 // seconds a worker must have run for to be restarted at once
+                             // (one that exits sooner is restarted after this long, so a
+                             // worker that can't start doesn't make the master spin)
+
+/* types */
+/* a worker's record, in memory shared by the master & all workers */
+typedef struct {
+   pid_t pid;               // worker's process (0 while not running)
+   time_t started;          // time the worker was started
+   webserv_stats_t stats;   // worker's statistics, as last published (see prefork_publish())
+} prefork_slot_t;
+
+/* prefork master: supervises worker processes that each run server_loop() on the
+ * listening sockets they inherit */
+typedef struct {
+   prefork_slot_t *slots;   // one per worker (shared memory)
+   size_t nworkers;
+   size_t nrunning;
+   size_t nrestarts;        // workers restarted after exiting on their own
+   webserv_stats_t retired; // statistics of workers that exited
+} prefork_t;
+
+/* globals */
+extern prefork_slot_t *prefork_self;
+
+/* prototypes */
+int prefork_run(size_t nworkers, reload_args_t *args);
+int prefork_init(size_t nworkers, prefork_t *pf);
+int prefork_spawn(size_t i, const sigset_t *sigset_worker, prefork_t *pf);
+void prefork_pin(size_t i);
+int prefork_reap(int stopping, const sigset_t *sigset_worker, prefork_t *pf);
+void prefork_signal(int sig, const prefork_t *pf);
+void prefork_stats(const prefork_t *pf, webserv_stats_t *stats);
+void prefork_publish(const webserv_stats_t *stats);
+void prefork_delete(prefork_t *pf);
+
+#endif
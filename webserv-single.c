@@ -1,9 +1,12 @@
 #include <stdlib.h>
 #include <errno.h>
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -12,65 +15,182 @@
 #include "webserv-fds.h"
 #include "webserv-dbg.h"
 #include "webserv-main.h"
+#include "webserv-prefork.h"
 
-int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds);
+int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds, codel_t *codel,
+                             const server_site_t *site, webserv_ctx_t *ctx);
 int handle_pollevents_client(int clientfd, int index, int revents, httpfds_t *hfds,
-                             const filetype_table_t *ftypes);
+                             bufpool_t *pool, iopool_t *iop, codel_t *codel,
+                             const server_site_t *site, webserv_ctx_t *ctx);
+int handle_pollevents_req(int clientfd, int index, int buffered, httpfds_t *hfds,
+                          bufpool_t *pool, iopool_t *iop, const server_site_t *site,
+                          webserv_ctx_t *ctx);
+int handle_pollevents_handled(int clientfd, int index, int keepalive, httpfds_t *hfds,
+                              const server_site_t *site, webserv_ctx_t *ctx);
+int handle_pollevents_failed(int index, httpfds_t *hfds, webserv_ctx_t *ctx);
+int handle_pollevents_io(httpfds_t *hfds, iopool_t *iop, const server_site_t *site,
+                         webserv_ctx_t *ctx);
+int handle_pollevents_body(int clientfd, int index, httpfds_t *hfds, const server_site_t *site,
+                           webserv_ctx_t *ctx);
+int handle_pollevents_sent(int clientfd, int index, httpfds_t *hfds, bufpool_t *pool,
+                           iopool_t *iop, const server_site_t *site, webserv_ctx_t *ctx);
+int handle_pollevents_write(int clientfd, int index, size_t quantum, size_t *sentp,
+                            httpfds_t *hfds, bufpool_t *pool, iopool_t *iop,
+                            const server_site_t *site, webserv_ctx_t *ctx);
+void handle_iojob(iopool_job_t *job, webserv_ctx_t *ctx);
+size_t server_runq(httpfds_runent_t *runq, size_t nrun, httpfds_t *hfds, bufpool_t *pool,
+                   iopool_t *iop, const server_site_t *site, webserv_ctx_t *ctx, int *retvp);
+int runent_cmp(const void *ent1, const void *ent2);
 
 
 /* server_loop()
- * DESC: repeatedly poll(2)'s server socket for new connections to accept and client sockets
+ * DESC: repeatedly poll(2)'s server sockets for new connections to accept and client sockets
  *       for (i) more request data to receive and then (ii) more response data to send. Returns
  *       once server_accepting is 0 and all requests have been serviced.
+ *       Connections are kept alive between requests; an idle connection holds no buffers
+ *       (see httpconn_t) and is closed after HTTPFDS_TIMEOUT seconds; one whose request
+ *       body or response makes no progress for HTTPFDS_PROGRESS seconds is closed too.
+ *       Responses are sent after all other events of a wakeup have been handled, from a
+ *       run queue that connections stay in across wakeups until their socket is full, at
+ *       most server_conf.quantum bytes per connection and wakeup, in the order given by
+ *       server_conf.sched (see server_runq()), so a client that reads fast cannot
+ *       monopolize the loop.
+ *       With server_conf.iothreads I/O threads, requests are handled (file lookups, reads)
+ *       off the loop, so a request that blocks on the disk does not stall other clients.
+ *       Past the hard memory limit, new connections are turned away with a canned 503
+ *       (see server_reject()); past the soft limit, caches shrink (see server_mem_adjust()).
+ *       With server_conf.codel_target set, new connections are also turned away (503)
+ *       while the delay from accepting connections to first reading them stays above
+ *       target (see codel_t). Clients over their rate limits are turned away with 429,
+ *       on connecting or per request (see ratelim_t).
+ *       Once no longer accepting, connections in flight get server_conf.drain seconds to
+ *       finish before they are closed.
  * ARGS:
- *  - servfd: server socket file descriptor.
- *  - ftypes: pointer to content type table.
+ *  - servfds: server sockets (TCP and/or Unix domain, already listening).
+ *  - nservfds: number of server sockets.
+ *  - site: site to serve.
  * RETV: 0 upon success, -1 upon error.
  * NOTE: prints errors.
  */
-int server_loop(int servfd, const filetype_table_t *ftypes) {
+int server_loop(const int *servfds, size_t nservfds, const server_site_t *site) {
    httpfds_t hfds;
+   httpfds_runent_t *runq;
+   size_t runq_len, nrun;
+   bufpool_t pool;
+   iopool_t iopool, *iop;
+   codel_t codel_ctl, *codel;
+   webserv_ctx_t ctx;
+   time_t now, swept;
+   time_t drain_by; // time connections still open are closed at once stopped (0: never)
+   size_t nlisten;
    int retv;
    int shutdwn;
 
    /* intialize variables */
    retv = 0;
    shutdwn = 0;
+   drain_by = 0;
+   runq = NULL;
+   runq_len = 0;
+   nrun = 0;
+   iop = NULL;
+   codel = NULL;
    httpfds_init(&hfds);
+   if (bufpool_init(server_conf.maxhdr, &pool) < 0) {
+      perror("bufpool_init");
+      return -1;
+   }
+   if (webserv_ctx_init(site->servname, &ctx) < 0) {
+      perror("webserv_ctx_init");
+      bufpool_delete(&pool);
+      return -1;
+   }
+   ctx.persist = 1;
+   swept = webserv_ctx_now(&ctx);
    
-   /* insert server socket to list */
-   if (httpfds_insert(servfd, POLLIN, &hfds) < 0) {
-      perror("httpfds_insert");
-      if (httpfds_delete(&hfds) < 0) {
-         perror("httpfds_delete");
+   /* insert server sockets to list (they take the first slots) */
+   for (nlisten = 0; nlisten < nservfds; ++nlisten) {
+      if (httpfds_insert(servfds[nlisten], POLLIN, 0, &hfds) < 0) {
+         perror("httpfds_insert");
+         while (nlisten > 0) {
+            hfds.fds[--nlisten].fd = -1; // don't want to close server sockets
+         }
+         if (httpfds_delete(&hfds) < 0) {
+            perror("httpfds_delete");
+         }
+         bufpool_delete(&pool);
+         return -1;
+      }
+      hfds.conns[nlisten].state = HC_NONE;
+   }
+
+   /* start I/O threads & insert their completion eventfd to list */
+   if (server_conf.iothreads) {
+      if (iopool_init(server_conf.iothreads, site->servname, &iopool) < 0) {
+         perror("iopool_init");
+         retv = -1;
+      } else if (httpfds_insert(iopool.evfd, POLLIN, 0, &hfds) < 0) {
+         perror("httpfds_insert");
+         iopool_delete(NULL, &iopool);
+         retv = -1;
+      } else {
+         iop = &iopool;
+         hfds.conns[nlisten++].state = HC_NONE;
+      }
+   }
+
+   /* set up admission control */
+   if (retv >= 0 && server_conf.codel_target) {
+      if (codel_init(server_conf.codel_target, CODEL_INTERVAL, &codel_ctl) < 0) {
+         perror("codel_init");
+         retv = -1;
+      } else {
+         codel = &codel_ctl;
       }
-      return -1;
    }
 
    /* service clients as long as sockets open & fatal error hasn't occurred */
-   while (retv >= 0 && (server_accepting || hfds.nopen > 1)) {
+   while (retv >= 0 && (atomic_load(&server_accepting) || hfds.nopen > nlisten)) {
       int nready;
 
       /* if no longer accepting, stop reading */
-      if (!server_accepting && !shutdwn) {
-         if (shutdown(servfd, SHUT_RD) < 0) {
-            perror("shutdown");
-            if (httpfds_delete(&hfds) < 0) {
-               perror("httpfds_delete");
+      if (!atomic_load(&server_accepting) && !shutdwn) {
+         /* stop polling server sockets (& shut them down, unless other processes are
+          * accepting from them too) */
+         for (size_t i = 0; i < nservfds; ++i) {
+            hfds.fds[i].fd = -1;
+            if (!server_listen_shared && shutdown(servfds[i], SHUT_RD) < 0) {
+               perror("shutdown");
+               retv = -1;
             }
-            return -1;
+         }
+         if (retv < 0) {
+            break;
          }
          shutdwn = 1;
+         if (server_conf.drain) {
+            drain_by = webserv_ctx_now(&ctx) + server_conf.drain;
+         }
+
+         /* close idle connections & don't keep any others alive (connections that haven't
+          * been sent a response yet are owed one: their request may be on its way) */
+         ctx.persist = 0;
+         for (size_t i = 0; i < hfds.count; ++i) {
+            if (hfds.fds[i].fd >= 0 && hfds.conns[i].state == HC_IDLE && hfds.conns[i].served
+                && httpfds_remove(i, &hfds) < 0) {
+               perror("httpfds_remove");
+            }
+         }
+         continue;
       }
       
-      /* poll for new connections / reading requests / sending responses */
-      if ((nready = poll(hfds.fds, hfds.count, -1)) < 0) {
+      /* poll for new connections / reading requests / sending responses / I/O completions
+       * (without waiting if responses are queued to be sent) */
+      if ((nready = poll(hfds.fds, hfds.count, nrun ? 0 : HTTPFDS_SWEEP_MSEC)) < 0) {
          if (errno != EINTR) {
             perror("poll");
-            if (httpfds_delete(&hfds) < 0) {
-               perror("httpfds_delete");
-            }
-            return -1;
+            retv = -1;
+            break;
          }
          continue;
       }
@@ -78,26 +198,43 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
       if (DEBUG) {
          fprintf(stderr, "poll: %d descriptors ready\n", nready);
       }
+
+      /* make room for every connection in run queue */
+      if (runq_len < hfds.count) {
+         httpfds_runent_t *runq_tmp;
+
+         if ((runq_tmp = reallocarray(runq, hfds.len, sizeof(*runq))) == NULL) {
+            perror("reallocarray");
+            retv = -1;
+            break;
+         }
+         runq = runq_tmp;
+         runq_len = hfds.len;
+      }
       
-      for (size_t i = 0; nready > 0; ++i) {
+      for (size_t i = 0; retv >= 0 && nready > 0; ++i) {
          int fd;
          int revents;
          
          fd = hfds.fds[i].fd;
          revents = hfds.fds[i].revents;
          if (fd >= 0 && revents) {
-            if (fd == servfd) {
-               if (handle_pollevents_server(fd, revents, &hfds) < 0) {
+            if (i < nservfds) {
+               if (handle_pollevents_server(fd, revents, &hfds, codel, site, &ctx) < 0) {
                   fprintf(stderr, "server_loop: server socket error\n");
-                  if (httpfds_delete(&hfds) < 0) {
-                     perror("httpfds_delete");
-                  }
-                  return -1;
+                  retv = -1;
                }
-            } else {
-               if (handle_pollevents_client(fd, i, revents, &hfds, ftypes) < 0) {
-                  return -1;
+            } else if (iop && fd == iop->evfd) {
+               retv = handle_pollevents_io(&hfds, iop, site, &ctx);
+            } else if ((revents & (POLLERR | POLLIN)) == 0 && (revents & POLLOUT)) {
+               /* ready to send response: queue up (unless still queued) */
+               if (!hfds.conns[i].queued) {
+                  runq[nrun++].id = httpfds_id(i, &hfds);
+                  hfds.conns[i].queued = 1;
                }
+            } else {
+               retv = handle_pollevents_client(fd, i, revents, &hfds, &pool, iop, codel, site,
+                                               &ctx);
             }
             
             --nready;
@@ -105,16 +242,57 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
          
       }
 
-      /* pack httpfds in case some connections were closed */
-      httpfds_pack(&hfds);
+      /* send (quanta of) queued responses, in scheduling order */
+      if (retv >= 0) {
+         nrun = server_runq(runq, nrun, &hfds, &pool, iop, site, &ctx, &retv);
+      }
+
+      /* close connections that have been idle for too long & adjust caches to memory
+       * pressure (at most once per second) */
+      if ((now = webserv_ctx_now(&ctx)) != swept) {
+         if (drain_by && now >= drain_by) {
+            printf("drain deadline passed; closing %zu connections\n", hfds.nopen - nlisten);
+            break;
+         }
+         httpfds_expire(now, &hfds);
+         server_mem_adjust(&pool, site);
+         if (site->ratelim) {
+            ratelim_expire(site->ratelim);
+         }
+         if (prefork_self) {
+            webserv_stats_t stats = ctx.stats;
+
+            if (iop) {
+               iopool_stats(iop, &stats);
+            }
+            prefork_publish(&stats);
+         }
+         swept = now;
+      }
    }
 
+   /* let I/O threads finish (they may still use connections' requests & responses) */
+   if (iop) {
+      iopool_delete(&ctx.stats, iop);
+      hfds.fds[nservfds].fd = -1; // closed by iopool_delete()
+   }
+   
    /* remove (& close) all client sockets */
-   hfds.fds[0].fd = -1; // don't want to close server socket
+   for (size_t i = 0; i < nservfds; ++i) {
+      hfds.fds[i].fd = -1; // don't want to close server sockets
+   }
    if (httpfds_delete(&hfds) < 0) {
       perror("httpfds_delete");
       retv = -1;
    }
+   free(runq);
+   bufpool_delete(&pool);
+   prefork_publish(&ctx.stats);
+   webserv_stats_print(stdout, &ctx.stats);
+   if (codel) {
+      printf("admission control turned away %" PRIu64 " connections\n", codel_dropped(codel));
+      codel_delete(codel);
+   }
 
    return retv;
 }
@@ -126,13 +304,17 @@ int server_loop(int servfd, const filetype_table_t *ftypes) {
  *  - servfd: server socket.
  *  - revents: the _revents_ field filled out by poll(2) for the server socket.
  *  - hfds: pointer to HTTP file descriptors record.
+ *  - codel: admission controller (NULL to admit all connections).
+ *  - site: site being served (its rate limits are checked).
+ *  - ctx: event loop's worker context.
  * RETV: 0 upon success, -1 upon error.
  * ERRS:
  *  - getsockopt(2): if error occurred in server socket.
  *  - server_accept()
  *  - httpfds_insert()
  */
-int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds) {
+int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds, codel_t *codel,
+                             const server_site_t *site, webserv_ctx_t *ctx) {
    if (revents & POLLERR) {
       int sockerr;
       socklen_t errlen;
@@ -149,18 +331,68 @@ int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds) {
       return -1;
    } else if (revents & POLLIN) {
       int new_client_fd;
+      struct sockaddr_storage peer;
+      ratelim_key_t key;
+      ssize_t index;
+      uint64_t now;
+      int resflags;
       
       /* accept new connection */
-      if ((new_client_fd = server_accept(servfd)) < 0) {
+      if ((new_client_fd = server_accept(servfd, &peer)) < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0; // another worker accepted it (see prefork_run())
+         }
          perror("server_accept");
          return -1;
       }
+
+      /* out of memory: turn connection away before it allocates anything */
+      if (mem_level() == MEM_HARD) {
+         if (server_reject(new_client_fd, C_UNAVAILABLE, SERVER_RETRY_AFTER, &ctx->stats) < 0) {
+            perror("server_reject");
+         }
+         return 0;
+      }
+
+      /* client over its rate limits: turn it away until it has slowed down */
+      key = ratelim_key((struct sockaddr *) &peer);
+      if (site->ratelim && !ratelim_admit(key, site->ratelim)) {
+         if (server_reject(new_client_fd, C_TOOMANY, RATELIM_RETRY_AFTER, &ctx->stats) < 0) {
+            perror("server_reject");
+         }
+         return 0;
+      }
+
+      /* overloaded: turn connection away so admitted ones keep their latency */
+      now = codel ? codel_clock() : 0;
+      if (codel && !codel_admit(now, codel)) {
+         if (server_reject(new_client_fd, C_UNAVAILABLE, CODEL_RETRY_AFTER, &ctx->stats) < 0) {
+            perror("server_reject");
+         }
+         return 0;
+      }
+
+      /* never block the loop on a client socket */
+      if (fcntl(new_client_fd, F_SETFL, O_NONBLOCK) < 0) {
+         perror("fcntl");
+         close(new_client_fd);
+         return -1;
+      }
+      if ((resflags = server_conn_tcp(new_client_fd, peer.ss_family, server_conf.tcp)) < 0) {
+         perror("server_conn_tcp");
+         close(new_client_fd);
+         return 0;
+      }
       
-      /* add new connection to list */
-      if (httpfds_insert(new_client_fd, POLLIN, hfds) < 0) {
+      /* add new (idle) connection to list */
+      if ((index = httpfds_insert(new_client_fd, POLLIN,
+                                  webserv_ctx_now(ctx) + HTTPFDS_TIMEOUT, hfds)) < 0) {
          perror("httpfds_insert");
          return -1;
       }
+      hfds->conns[index].accepted = now;
+      hfds->conns[index].peer = key;
+      hfds->conns[index].resflags = resflags;
    }
 
    return 0;
@@ -173,13 +405,20 @@ int handle_pollevents_server(int servfd, int revents, httpfds_t *hfds) {
  *  - index: index of client socket in HTTP file descriptor array.
  *  - revents: mask set by poll(2).
  *  - hfds: pointer to HTTP file descriptor record.
- *  - ftypes: pointer to content type table.
+ *  - pool: pool to borrow request buffers from.
+ *  - iop: pool of I/O threads to handle requests in (NULL to handle them in the loop).
+ *  - codel: admission controller to sample new connections' delay in (NULL for none).
+ *  - site: site being served.
+ *  - ctx: event loop's worker context.
  * RETV: 0 upon success, -1 upon error.
  */
 int handle_pollevents_client(int clientfd, int index, int revents, httpfds_t *hfds,
-                             const filetype_table_t *ftypes) {
+                             bufpool_t *pool, iopool_t *iop, codel_t *codel,
+                             const server_site_t *site, webserv_ctx_t *ctx) {
+   httpconn_t *conn;
    int retv;
 
+   conn = &hfds->conns[index];
    retv = 0;
    if (revents & POLLERR) {
       /* close client socket & mark as closed */
@@ -188,64 +427,473 @@ int handle_pollevents_client(int clientfd, int index, int revents, httpfds_t *hf
          retv = -1;
       }
    } else if (revents & POLLIN) {
-      httpmsg_t *reqp, *resp;
-      
-      /* initialize variables */
-      reqp = &hfds->reqs[index];
-      resp = &hfds->resps[index];
-      
-      /* read data */
-      if (request_read(clientfd, reqp) < 0) {
-         /* incomplete read -- check if due to nonblocking */
-         if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            /* fatal error (unrelated to blocking) */
-            perror("request_read");
+      switch (conn->state) {
+      case HC_IDLE:
+         /* first read from a new connection: sample how long it waited */
+         if (codel && conn->accepted) {
+            codel_sample(conn->accepted, codel_clock(), codel);
+            conn->accepted = 0;
+         }
+         
+         /* start of next request: attach request & response */
+         if (httpfds_attach(index, pool, hfds) == NULL) {
+            perror("httpfds_attach");
             if (httpfds_remove(index, hfds) < 0) {
                perror("httpfds_remove");
             }
+            return -1;
+         }
+         conn->state = HC_READ;
+         conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_TIMEOUT;
+         /* fallthrough */
+      case HC_READ:
+         retv = handle_pollevents_req(clientfd, index, 0, hfds, pool, iop, site, ctx);
+         break;
+      case HC_BODY:
+         retv = handle_pollevents_body(clientfd, index, hfds, site, ctx);
+         break;
+      }
+   } else if (revents & POLLOUT) {
+      /* send (at most a quantum of) response */
+      retv = handle_pollevents_write(clientfd, index, server_conf.quantum, NULL, hfds, pool,
+                                     iop, site, ctx);
+   }
+
+   return retv;
+}
+
+/* handle_pollevents_req()
+ * DESC: receives (more of) the request header on client socket _clientfd_ and, once it is
+ *       complete, creates the response (or starts receiving the request body), or hands
+ *       the request to an I/O thread to do so (see handle_pollevents_io()).
+ * ARGS:
+ *  - buffered: whether the complete request header has already been received (see
+ *              request_buffered()), so nothing is read from the socket.
+ *  - (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_req(int clientfd, int index, int buffered, httpfds_t *hfds,
+                          bufpool_t *pool, iopool_t *iop, const server_site_t *site,
+                          webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+   httpmsg_t *reqp, *resp;
+   int retv;
+
+   /* initialize variables */
+   conn = &hfds->conns[index];
+   reqp = &conn->msgs->req;
+   resp = &conn->msgs->res;
+   retv = 0;
+      
+   /* read & parse data */
+   if ((!buffered && request_read(clientfd, reqp, pool) < 0) || request_parse(reqp) < 0) {
+      switch (message_error(errno)) {
+      case MSG_EAGAIN:
+         break; // incomplete read -- more to come
+
+      case MSG_ECLIENT:
+         /* malformed or oversized request -- respond with error status */
+         if (server_handle_err(server_err2code(errno), ctx, resp) < 0) {
+            perror("server_handle_err");
+            retv = -1;
+         }
+         conn->state = HC_WRITE;
+         conn->keepalive = 0;
+         conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+         hfds->fds[index].events = POLLOUT;
+         break;
+
+      case MSG_ECONN:
+         /* client hung up */
+         if (httpfds_remove(index, hfds) < 0) {
+            perror("httpfds_remove");
             retv = -1;
          }
+         break;
+
+      default:
+         /* fatal error */
+         perror("request_read");
+         if (httpfds_remove(index, hfds) < 0) {
+            perror("httpfds_remove");
+         }
+         retv = -1;
+         break;
+      }
+   } else if (site->ratelim && !ratelim_take(conn->peer, site->ratelim)) {
+      /* client over its rate limits */
+      if (server_handle_limited(ctx, resp) < 0) {
+         perror("server_handle_limited");
+         retv = -1;
+      }
+      conn->state = HC_WRITE;
+      conn->keepalive = 0;
+      conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+      hfds->fds[index].events = POLLOUT;
+   } else {
+      /* successfully parse request (no deadline while the server handles it) */
+      conn->deadline = 0;
+      if (iop) {
+         httpconn_msgs_t *msgs;
+
+         /* create response in I/O thread; ignore socket until it is done */
+         msgs = conn->msgs;
+         msgs->job.run = handle_iojob;
+         msgs->id = httpfds_id(index, hfds);
+         msgs->clientfd = clientfd;
+         msgs->site = site;
+         msgs->persist = ctx->persist;
+         conn->state = HC_IO;
+         httpfds_suspend(index, hfds);
+         iopool_submit(&msgs->job, iop);
+      } else if (server_handle_req(clientfd, site, ctx, reqp, resp) < 0) {
+         /* create response for request (failing only this request) */
+         perror("server_handle_req");
+         retv = handle_pollevents_failed(index, hfds, ctx);
       } else {
-         /* finished reading request */
-         /* parse complete request */
-         if (request_parse(reqp) < 0) {
-            /* parser error */
-            perror("request_parse");
-            if (httpfds_remove(index, hfds) < 0) {
-               perror("httpfds_remove");
-               retv = -1;
-            }
-            if (errno != EBADMSG) {
-               retv = -1; // internal error
-            }
-         } else {
-            /* successfully parse request */
-            /* create response for request */
-            if (server_handle_req(clientfd, DOCUMENT_ROOT, SERVER_NAME, reqp, resp, ftypes) < 0) {
-               perror("server_handle_req");
-               retv = -1;
-            }
+         retv = handle_pollevents_handled(clientfd, index, ctx->keepalive, hfds, site, ctx);
+      }
+   }
 
-            /* mark pollfd as ready to receive data */
-            hfds->fds[index].events = POLLOUT;
+   return retv;
+}
+
+/* handle_pollevents_handled()
+ * DESC: handles a request of client socket _clientfd_ having been handled (see
+ *       server_handle_req()): starts receiving the request body, if any, or else
+ *       marks the client as ready to be sent the response.
+ * ARGS:
+ *  - keepalive: whether connection is kept open after the response (ctx->keepalive of the
+ *               context the request was handled with).
+ *  - (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_handled(int clientfd, int index, int keepalive, httpfds_t *hfds,
+                              const server_site_t *site, webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+
+   conn = &hfds->conns[index];
+   if (site->ratelim) {
+      ratelim_charge(conn->peer, conn->msgs->res.hm_body_size, site->ratelim);
+   }
+   conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+   if (request_body_pending(&conn->msgs->req)) {
+      /* receive request body (some may have arrived with the headers) */
+      conn->state = HC_BODY;
+      hfds->fds[index].events = POLLIN;
+      return handle_pollevents_body(clientfd, index, hfds, site, ctx);
+   }
+
+   /* mark pollfd as ready to send data */
+   conn->state = HC_WRITE;
+   conn->keepalive = keepalive;
+   hfds->fds[index].events = POLLOUT;
+   return 0;
+}
+
+/* handle_pollevents_failed()
+ * DESC: handles the failure of the server to handle a request of the client at index
+ *       _index_ (see server_handle_req()): the client is sent a 500 and the connection is
+ *       closed (or closed at once, if not even that can be created). Other clients are
+ *       unaffected.
+ * ARGS: (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_failed(int index, httpfds_t *hfds, webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+
+   conn = &hfds->conns[index];
+   if (server_handle_err(C_SERVERERROR, ctx, &conn->msgs->res) < 0) {
+      perror("server_handle_err");
+      if (httpfds_remove(index, hfds) < 0) {
+         perror("httpfds_remove");
+         return -1;
+      }
+      return 0;
+   }
+   conn->state = HC_WRITE;
+   conn->keepalive = 0;
+   conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+   hfds->fds[index].events = POLLOUT;
+   return 0;
+}
+
+/* handle_iojob()
+ * DESC: handles a request in an I/O thread (see iopool_job_t), recording the result in
+ *       the connection's messages for handle_pollevents_io().
+ * ARGS:
+ *  - job: job embedded in connection's messages (httpconn_msgs_t).
+ *  - ctx: I/O thread's worker context.
+ */
+void handle_iojob(iopool_job_t *job, webserv_ctx_t *ctx) {
+   httpconn_msgs_t *msgs;
+
+   msgs = (httpconn_msgs_t *) job;
+   ctx->persist = msgs->persist;
+   msgs->retv = server_handle_req(msgs->clientfd, msgs->site, ctx, &msgs->req, &msgs->res);
+   msgs->err = errno;
+   msgs->keepalive = ctx->keepalive;
+}
+
+/* handle_pollevents_io()
+ * DESC: handles the completion eventfd of I/O threads: resumes polling every connection
+ *       whose request has been handled (a request that failed is answered with a 500;
+ *       see handle_pollevents_failed()). Each of them is still open, as its job is still
+ *       using its request & response (and socket) until reaped here.
+ * ARGS: (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_io(httpfds_t *hfds, iopool_t *iop, const server_site_t *site,
+                         webserv_ctx_t *ctx) {
+   iopool_job_t *job, *next;
+   int retv;
+
+   retv = 0;
+   for (job = iopool_reap(iop); job != NULL; job = next) {
+      httpconn_msgs_t *msgs;
+      ssize_t index;
+
+      next = job->next;
+      msgs = (httpconn_msgs_t *) job;
+      index = httpfds_lookup(msgs->id, hfds);
+      assert(index >= 0); // (suspended connections are never removed; see httpfds_suspend())
+      httpfds_resume(index, hfds);
+
+      if (msgs->retv < 0) {
+         /* fail only this request */
+         errno = msgs->err;
+         perror("server_handle_req");
+         if (handle_pollevents_failed(index, hfds, ctx) < 0) {
+            retv = -1;
          }
+      } else if (retv >= 0) {
+         retv = handle_pollevents_handled(msgs->clientfd, index, msgs->keepalive, hfds, site,
+                                          ctx);
       }
-   } else if (revents & POLLOUT) {
-      /* send response */
-      if (response_send(clientfd, &hfds->resps[index]) < 0) {
-         /* incomplete write -- check if due to nonblocking */
-         if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("response_send");
-            return -1;
+   }
+
+   return retv;
+}
+
+/* handle_pollevents_sent()
+ * DESC: handles the completion of a response on client socket _clientfd_: closes the
+ *       connection, or keeps it open for the next request. Unless a pipelined request
+ *       has already been received, the connection then becomes idle and its request &
+ *       response (and their buffers) are released.
+ * ARGS: (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_sent(int clientfd, int index, httpfds_t *hfds, bufpool_t *pool,
+                           iopool_t *iop, const server_site_t *site, webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+   ssize_t carried;
+
+   conn = &hfds->conns[index];
+   if (!conn->keepalive || !ctx->persist) {
+      if (httpfds_remove(index, hfds) < 0) {
+         perror("httpfds_remove");
+         return -1;
+      }
+      return 0;
+   }
+
+   /* keep bytes of the next request, if any */
+   if ((carried = request_next(&conn->msgs->req)) < 0) {
+      perror("request_next");
+      if (httpfds_remove(index, hfds) < 0) {
+         perror("httpfds_remove");
+      }
+      return -1;
+   }
+   response_delete(&conn->msgs->res);
+   response_init(&conn->msgs->res);
+   message_set_pool(pool, &conn->msgs->res);
+
+   hfds->fds[index].events = POLLIN;
+   conn->keepalive = 0;
+   conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_TIMEOUT;
+   conn->served = 1;
+   if (carried == 0) {
+      httpfds_detach(index, hfds);
+      conn->state = HC_IDLE;
+      return 0;
+   }
+
+   conn->state = HC_READ;
+   if (request_buffered(&conn->msgs->req)) {
+      return handle_pollevents_req(clientfd, index, 1, hfds, pool, iop, site, ctx);
+   }
+   return 0;
+}
+
+/* handle_pollevents_body()
+ * DESC: receives as much of the request body on client socket _clientfd_ as is available
+ *       and, once it is complete, marks the client as ready to be sent the response.
+ * ARGS: (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_body(int clientfd, int index, httpfds_t *hfds, const server_site_t *site,
+                           webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+   size_t received;
+
+   conn = &hfds->conns[index];
+   received = conn->msgs->req.hm_line.reql.body.received;
+   if (server_handle_body(clientfd, site, ctx, &conn->msgs->req, &conn->msgs->res) < 0) {
+      switch (message_error(errno)) {
+      case MSG_EAGAIN:
+         /* more to come: give the client more time if it is making progress */
+         if (conn->msgs->req.hm_line.reql.body.received != received) {
+            conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
          }
-      } else {
-         /* sending completed -- can remove httpfd */
+         return 0;
+
+      case MSG_ECONN:
+         /* client hung up */
          if (httpfds_remove(index, hfds) < 0) {
             perror("httpfds_remove");
             return -1;
          }
+         return 0;
+
+      default:
+         perror("server_handle_body");
+         if (httpfds_remove(index, hfds) < 0) {
+            perror("httpfds_remove");
+         }
+         return -1;
       }
    }
 
-   return retv;
+   /* body received & response created */
+   conn->state = HC_WRITE;
+   conn->keepalive = ctx->keepalive;
+   conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+   hfds->fds[index].events = POLLOUT;
+   return 0;
+}
+
+/* handle_pollevents_write()
+ * DESC: sends at most _quantum_ more bytes of the response on client socket _clientfd_ (0
+ *       for no limit) and, once it is sent, closes the connection or waits for the next
+ *       request. The connection stays in the write run queue if it used up the quantum
+ *       (its socket may well take more), and leaves it otherwise.
+ * ARGS:
+ *  - quantum: maximum number of bytes to send.
+ *  - sentp: where to store the number of bytes sent (NULL if not needed).
+ *  - (see handle_pollevents_client())
+ * RETV: 0 upon success, -1 upon error.
+ */
+int handle_pollevents_write(int clientfd, int index, size_t quantum, size_t *sentp,
+                            httpfds_t *hfds, bufpool_t *pool, iopool_t *iop,
+                            const server_site_t *site, webserv_ctx_t *ctx) {
+   httpconn_t *conn;
+   size_t sent;
+
+   conn = &hfds->conns[index];
+   sent = response_sent(&conn->msgs->res);
+   if (response_send(clientfd, quantum, conn->resflags, &conn->msgs->res) == 0) {
+      /* sending completed -- close connection or wait for next request */
+      if (sentp) {
+         *sentp = response_sent(&conn->msgs->res) - sent;
+      }
+      conn->queued = 0;
+      return handle_pollevents_sent(clientfd, index, hfds, pool, iop, site, ctx);
+   }
+   sent = response_sent(&conn->msgs->res) - sent;
+   if (sentp) {
+      *sentp = sent;
+   }
+
+   /* incomplete write -- check if due to nonblocking (or quantum used up) */
+   switch (message_error(errno)) {
+   case MSG_EAGAIN:
+      /* give the client more time if it is reading */
+      if (sent) {
+         conn->deadline = webserv_ctx_now(ctx) + HTTPFDS_PROGRESS;
+      }
+      conn->queued = (quantum && sent >= quantum);
+      return 0;
+
+   case MSG_ECONN:
+      /* client hung up */
+      if (httpfds_remove(index, hfds) < 0) {
+         perror("httpfds_remove");
+         return -1;
+      }
+      return 0;
+
+   default:
+      perror("response_send");
+      return -1;
+   }
+}
+
+/* server_runq()
+ * DESC: sends the responses of the connections in write run queue _runq_:
+ *        - SERVER_SCHED_RR: a quantum to each, in the order they were queued;
+ *        - SERVER_SCHED_SRPT: shortest remaining response first, HTTPFDS_PASS_QUANTA
+ *          quanta in all (at most one to each), so a long transfer makes way for short
+ *          responses queued since (in this or any later wakeup) instead of taking a full
+ *          turn ahead of them; those not reached are served in the next pass.
+ *       Connections that leave the queue (see handle_pollevents_write()) or have been
+ *       closed are dropped from it.
+ * ARGS:
+ *  - runq: run queue.
+ *  - nrun: number of entries in run queue.
+ *  - retvp: where to store -1 upon error.
+ *  - (see handle_pollevents_client())
+ * RETV: the number of entries left in the run queue.
+ */
+size_t server_runq(httpfds_runent_t *runq, size_t nrun, httpfds_t *hfds, bufpool_t *pool,
+                   iopool_t *iop, const server_site_t *site, webserv_ctx_t *ctx, int *retvp) {
+   size_t budget, quantum, sent, nleft;
+   ssize_t index;
+   int srpt;
+
+   srpt = (server_conf.sched == SERVER_SCHED_SRPT);
+   if (srpt) {
+      for (size_t j = 0; j < nrun; ++j) {
+         index = httpfds_lookup(runq[j].id, hfds);
+         runq[j].remaining = index < 0 ? 0 : response_remaining(&hfds->conns[index].msgs->res);
+      }
+      qsort(runq, nrun, sizeof(*runq), runent_cmp);
+   }
+
+   budget = server_conf.quantum * HTTPFDS_PASS_QUANTA;
+   nleft = 0;
+   for (size_t j = 0; j < nrun; ++j) {
+      if ((index = httpfds_lookup(runq[j].id, hfds)) < 0) {
+         continue; // closed
+      }
+      if (*retvp >= 0 && !(srpt && server_conf.quantum && budget == 0)) {
+         quantum = server_conf.quantum;
+         if (srpt && quantum && quantum > budget) {
+            quantum = budget;
+         }
+         if (handle_pollevents_write(hfds->fds[index].fd, index, quantum, &sent, hfds, pool,
+                                     iop, site, ctx) < 0) {
+            *retvp = -1;
+         }
+         budget -= sent < budget ? sent : budget;
+         if (httpfds_id(index, hfds) != runq[j].id || !hfds->conns[index].queued) {
+            continue; // closed, or left queue
+         }
+      }
+      runq[nleft++] = runq[j];
+   }
+
+   return nleft;
+}
+
+/* runent_cmp()
+ * DESC: orders run queue entries by the number of response bytes left to send (for
+ *       SERVER_SCHED_SRPT; see qsort(3)).
+ */
+int runent_cmp(const void *ent1, const void *ent2) {
+   size_t rem1, rem2;
+
+   rem1 = ((const httpfds_runent_t *) ent1)->remaining;
+   rem2 = ((const httpfds_runent_t *) ent2)->remaining;
+   return (rem1 > rem2) - (rem1 < rem2);
 }